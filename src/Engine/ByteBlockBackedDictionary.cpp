@@ -21,28 +21,34 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-#if defined(__AVX512F__)
-#include <immintrin.h>
+#include "ByteBlockBackedDictionary.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
-#else
-#error AVX512 support required
-#endif
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// The x86-64 kernels are compiled for their instruction sets with the target
+// attribute and picked at runtime, so that the library can still be built for
+// and run on any x86-64 CPU.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MCBOPOMOFO_X86_64_KERNELS 1
+#include <immintrin.h>
 #endif
 
 #ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
-#if defined(__ARM_NEON)
+#if defined(__ARM_NEON) && defined(__aarch64__)
 #include <arm_neon.h>
-
-#include <cstdint>
 #else
 #error ARM NEON support required
 #endif
 #endif
 
-#include "ByteBlockBackedDictionary.h"
-
 namespace McBopomofo {
 
 namespace {
@@ -94,47 +100,246 @@ const char* AdvanceToNextNonContentCharacter(const char* ptr, const char* end) {
   return ptr;
 }
 
-#if !defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512) && \
-    !defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-const char* FindFirstNULL(const char* ptr, const char* end,
-                          size_t* firstLineNumber = nullptr) {
-  const char* i = ptr;
-  while (i != end) {
-    if (*i == 0) {
+const char* FindFirstNULL(const char* ptr, const char* end) {
+  while (ptr != end) {
+    if (*ptr == 0) {
       break;
     }
-    ++i;
+    ++ptr;
   }
+  return ptr;
+}
 
-  // Only count the line number if there is indeed a NULL.
-  if (i != end && firstLineNumber != nullptr) {
-    size_t lineCounter = 1;
-    while (ptr != i) {
-      if (*ptr == '\n') {
-        ++lineCounter;
-      }
-      ++ptr;
+size_t CountLFs(const char* ptr, const char* end) {
+  return static_cast<size_t>(std::count(ptr, end, '\n'));
+}
+
+bool IsCRLF(char c) { return c == '\n' || c == '\r'; }
+
+bool IsWhitespace(char c) { return c == ' ' || c == '\t'; }
+
+constexpr size_t kMinSlotCount = 16;
+
+// Runs task(0) to task(count - 1) on threads of their own, except task(0),
+// which runs on the calling thread.
+template <typename Task>
+void RunInParallel(size_t count, const Task& task) {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < count; ++i) {
+    threads.emplace_back(task, i);
+  }
+  task(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+uint32_t Hash(const std::string_view& key) {
+  return static_cast<uint32_t>(std::hash<std::string_view>()(key));
+}
+
+// A scanner provides the functions that go through the text byte by byte. The
+// parser is instantiated for each scanner, so that the calls are direct.
+struct GenericScanner {
+  static const char* advanceToNextCRLF(const char* ptr, const char* end) {
+    return AdvanceToNextCRLF(ptr, end);
+  }
+  static const char* advanceToNextNonContentCharacter(const char* ptr,
+                                                      const char* end) {
+    return AdvanceToNextNonContentCharacter(ptr, end);
+  }
+  static const char* findFirstNULL(const char* ptr, const char* end) {
+    return FindFirstNULL(ptr, end);
+  }
+  static size_t countLFs(const char* ptr, const char* end) {
+    return CountLFs(ptr, end);
+  }
+};
+
+#ifdef MCBOPOMOFO_X86_64_KERNELS
+
+// SSE2 is part of x86-64, so the SSE2 kernel needs no target attribute and
+// runs on every x86-64 CPU.
+
+const char* SSE2_AdvanceToNextCRLF(const char* ptr, const char* end) {
+  const __m128i lfs = _mm_set1_epi8('\n');
+  const __m128i crs = _mm_set1_epi8('\r');
+  while (end - ptr >= 16) {
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    const int mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(block, lfs), _mm_cmpeq_epi8(block, crs)));
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
     }
-    *firstLineNumber = lineCounter;
+    ptr += 16;
   }
+  return AdvanceToNextCRLF(ptr, end);
+}
 
-  return i;
+const char* SSE2_AdvanceToNextNonContentCharacter(const char* ptr,
+                                                  const char* end) {
+  const __m128i spaces = _mm_set1_epi8(' ');
+  const __m128i tabs = _mm_set1_epi8('\t');
+  const __m128i lfs = _mm_set1_epi8('\n');
+  const __m128i crs = _mm_set1_epi8('\r');
+  while (end - ptr >= 16) {
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    const __m128i whitespaces = _mm_or_si128(_mm_cmpeq_epi8(block, spaces),
+                                             _mm_cmpeq_epi8(block, tabs));
+    const __m128i crlfs =
+        _mm_or_si128(_mm_cmpeq_epi8(block, lfs), _mm_cmpeq_epi8(block, crs));
+    const int mask = _mm_movemask_epi8(_mm_or_si128(whitespaces, crlfs));
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
+    }
+    ptr += 16;
+  }
+  return AdvanceToNextNonContentCharacter(ptr, end);
 }
-#endif
 
-bool IsCRLF(char c) { return c == '\n' || c == '\r'; }
+const char* SSE2_FindFirstNULL(const char* ptr, const char* end) {
+  const __m128i zeros = _mm_setzero_si128();
+  while (end - ptr >= 16) {
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, zeros));
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
+    }
+    ptr += 16;
+  }
+  return FindFirstNULL(ptr, end);
+}
 
-bool IsWhitespace(char c) { return c == ' ' || c == '\t'; }
+size_t SSE2_CountLFs(const char* ptr, const char* end) {
+  const __m128i lfs = _mm_set1_epi8('\n');
+  size_t count = 0;
+  while (end - ptr >= 16) {
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    count += __builtin_popcount(
+        static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, lfs))));
+    ptr += 16;
+  }
+  return count + CountLFs(ptr, end);
+}
+
+struct SSE2Scanner {
+  static const char* advanceToNextCRLF(const char* ptr, const char* end) {
+    return SSE2_AdvanceToNextCRLF(ptr, end);
+  }
+  static const char* advanceToNextNonContentCharacter(const char* ptr,
+                                                      const char* end) {
+    return SSE2_AdvanceToNextNonContentCharacter(ptr, end);
+  }
+  static const char* findFirstNULL(const char* ptr, const char* end) {
+    return SSE2_FindFirstNULL(ptr, end);
+  }
+  static size_t countLFs(const char* ptr, const char* end) {
+    return SSE2_CountLFs(ptr, end);
+  }
+};
 
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
+#define AVX2_TARGET __attribute__((target("avx2,popcnt")))
 
-const char* AVX512_AdvanceToNextCRLF(const char* ptr,
-                                     const char* unaligned32End,
-                                     const char* end) {
+AVX2_TARGET const char* AVX2_AdvanceToNextCRLF(const char* ptr,
+                                               const char* end) {
   const __m256i lfs = _mm256_set1_epi8('\n');
   const __m256i crs = _mm256_set1_epi8('\r');
+  while (end - ptr >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+    const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, lfs),
+                        _mm256_cmpeq_epi8(block, crs))));
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
+    }
+    ptr += 32;
+  }
+  return AdvanceToNextCRLF(ptr, end);
+}
 
-  while (ptr < unaligned32End) {
+AVX2_TARGET const char* AVX2_AdvanceToNextNonContentCharacter(
+    const char* ptr, const char* end) {
+  const __m256i spaces = _mm256_set1_epi8(' ');
+  const __m256i tabs = _mm256_set1_epi8('\t');
+  const __m256i lfs = _mm256_set1_epi8('\n');
+  const __m256i crs = _mm256_set1_epi8('\r');
+  while (end - ptr >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+    const __m256i whitespaces = _mm256_or_si256(
+        _mm256_cmpeq_epi8(block, spaces), _mm256_cmpeq_epi8(block, tabs));
+    const __m256i crlfs = _mm256_or_si256(_mm256_cmpeq_epi8(block, lfs),
+                                          _mm256_cmpeq_epi8(block, crs));
+    const uint32_t mask = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_or_si256(whitespaces, crlfs)));
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
+    }
+    ptr += 32;
+  }
+  return AdvanceToNextNonContentCharacter(ptr, end);
+}
+
+AVX2_TARGET const char* AVX2_FindFirstNULL(const char* ptr, const char* end) {
+  const __m256i zeros = _mm256_setzero_si256();
+  while (end - ptr >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+    const uint32_t mask = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zeros)));
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
+    }
+    ptr += 32;
+  }
+  return FindFirstNULL(ptr, end);
+}
+
+AVX2_TARGET size_t AVX2_CountLFs(const char* ptr, const char* end) {
+  const __m256i lfs = _mm256_set1_epi8('\n');
+  size_t count = 0;
+  while (end - ptr >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+    count += _mm_popcnt_u32(static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, lfs))));
+    ptr += 32;
+  }
+  return count + CountLFs(ptr, end);
+}
+
+#undef AVX2_TARGET
+
+struct AVX2Scanner {
+  static const char* advanceToNextCRLF(const char* ptr, const char* end) {
+    return AVX2_AdvanceToNextCRLF(ptr, end);
+  }
+  static const char* advanceToNextNonContentCharacter(const char* ptr,
+                                                      const char* end) {
+    return AVX2_AdvanceToNextNonContentCharacter(ptr, end);
+  }
+  static const char* findFirstNULL(const char* ptr, const char* end) {
+    return AVX2_FindFirstNULL(ptr, end);
+  }
+  static size_t countLFs(const char* ptr, const char* end) {
+    return AVX2_CountLFs(ptr, end);
+  }
+};
+
+#define AVX512_TARGET \
+  __attribute__((target("avx512f,avx512bw,avx512vl,bmi,popcnt")))
+
+AVX512_TARGET const char* AVX512_AdvanceToNextCRLF(const char* ptr,
+                                                   const char* end) {
+  const __m256i lfs = _mm256_set1_epi8('\n');
+  const __m256i crs = _mm256_set1_epi8('\r');
+
+  while (end - ptr >= 32) {
     const __m256i block = _mm256_loadu_epi8(ptr);
     const __mmask32 foundLFs = _mm256_cmpeq_epi8_mask(block, lfs);
     const __mmask32 foundCRs = _mm256_cmpeq_epi8_mask(block, crs);
@@ -167,10 +372,9 @@ alignas(32) constexpr uint8_t HI_NIBBLES_LOOKUP[32] = {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 };
 
-const char* AVX512_AdvanceToNextNonContentCharacter(const char* ptr,
-                                                    const char* unaligned32End,
-                                                    const char* end) {
-  while (ptr < unaligned32End) {
+AVX512_TARGET const char* AVX512_AdvanceToNextNonContentCharacter(
+    const char* ptr, const char* end) {
+  while (end - ptr >= 32) {
     const __m256i input = _mm256_loadu_epi8(ptr);
 
     const __m256i mask = _mm256_set1_epi8(0x0f);
@@ -198,89 +402,69 @@ const char* AVX512_AdvanceToNextNonContentCharacter(const char* ptr,
 constexpr uintptr_t ALIGN64 = 64;
 constexpr uintptr_t ALIGN64_MASK = ALIGN64 - 1;
 
-const char* AVX512_FindFirstNULL(const char* ptr, const char* end,
-                                 size_t* firstLineNumber = nullptr) {
+AVX512_TARGET const char* AVX512_FindFirstNULL(const char* ptr,
+                                               const char* end) {
   const char* i = ptr;
-  bool found = false;
   if ((reinterpret_cast<uintptr_t>(i) & ALIGN64_MASK) != 0) {
     const char* headEnd = reinterpret_cast<const char*>(
         reinterpret_cast<uintptr_t>(i + ALIGN64_MASK) & ~ALIGN64_MASK);
     headEnd = headEnd < end ? headEnd : end;
     while (i != headEnd) {
       if (*i == '\0') {
-        found = true;
-        break;
+        return i;
       }
       ++i;
     }
   }
 
-  if (!found && i != end) {
+  if (i != end) {
     const char* middleEnd = reinterpret_cast<const char*>(
         reinterpret_cast<uintptr_t>(end) & ~ALIGN64_MASK);
     const __m512i zeros = _mm512_setzero_si512();
-    while (i != middleEnd) {
+    while (i < middleEnd) {
       const __m512i block = _mm512_load_si512(i);
       const __mmask64 mask = _mm512_cmpeq_epi8_mask(block, zeros);
       if (mask != 0) {
-        found = true;
-        i += _tzcnt_u32(mask);
-        break;
+        return i + _tzcnt_u64(mask);
       }
       i += ALIGN64;
     }
   }
 
-  if (!found) {
-    while (i != end) {
-      if (*i == 0) {
-        found = true;
-        break;
-      }
-      ++i;
-    }
-  }
+  return FindFirstNULL(i, end);
+}
 
-  if (!found || firstLineNumber == nullptr) {
-    return i;
+AVX512_TARGET size_t AVX512_CountLFs(const char* ptr, const char* end) {
+  const __m512i linefeeds = _mm512_set1_epi8('\n');
+  size_t count = 0;
+  while (end - ptr >= 64) {
+    const __m512i block = _mm512_loadu_si512(ptr);
+    const __mmask64 mask = _mm512_cmpeq_epi8_mask(block, linefeeds);
+    count += _mm_popcnt_u64(mask);
+    ptr += 64;
   }
+  return count + CountLFs(ptr, end);
+}
 
-  size_t lineCounter = 1;
-  if ((reinterpret_cast<uintptr_t>(ptr) & ALIGN64_MASK) != 0) {
-    const char* headEnd = reinterpret_cast<const char*>(
-        reinterpret_cast<uintptr_t>(ptr + ALIGN64_MASK) & ~ALIGN64_MASK);
-    headEnd = headEnd < i ? headEnd : i;
-    while (ptr != headEnd) {
-      if (*ptr == '\n') {
-        ++lineCounter;
-      }
-      ++ptr;
-    }
-  }
+#undef AVX512_TARGET
 
-  if (ptr != i) {
-    const char* middleEnd = reinterpret_cast<const char*>(
-        reinterpret_cast<uintptr_t>(i) & ~ALIGN64_MASK);
-    const __m512i linefeeds = _mm512_set1_epi8('\n');
-    while (ptr != middleEnd) {
-      const __m512i block = _mm512_load_si512(ptr);
-      const __mmask64 mask = _mm512_cmpeq_epi8_mask(block, linefeeds);
-      lineCounter += _mm_popcnt_u64(mask);
-      ptr += ALIGN64;
-    }
+struct AVX512Scanner {
+  static const char* advanceToNextCRLF(const char* ptr, const char* end) {
+    return AVX512_AdvanceToNextCRLF(ptr, end);
   }
-
-  while (ptr != i) {
-    if (*ptr == '\n') {
-      ++lineCounter;
-    }
-    ++ptr;
+  static const char* advanceToNextNonContentCharacter(const char* ptr,
+                                                      const char* end) {
+    return AVX512_AdvanceToNextNonContentCharacter(ptr, end);
   }
-  *firstLineNumber = lineCounter;
-  return i;
-}
+  static const char* findFirstNULL(const char* ptr, const char* end) {
+    return AVX512_FindFirstNULL(ptr, end);
+  }
+  static size_t countLFs(const char* ptr, const char* end) {
+    return AVX512_CountLFs(ptr, end);
+  }
+};
 
-#endif
+#endif  // MCBOPOMOFO_X86_64_KERNELS
 
 #ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
 
@@ -300,12 +484,11 @@ static inline int FirstNonZeroLane16(uint8x16_t v) {
   return 16;
 }
 
-const char* NEON_AdvanceToNextCRLF(const char* ptr, const char* unaligned16End,
-                                   const char* end) {
+const char* NEON_AdvanceToNextCRLF(const char* ptr, const char* end) {
   const uint8x16_t lfs = vdupq_n_u8(static_cast<uint8_t>('\n'));
   const uint8x16_t crs = vdupq_n_u8(static_cast<uint8_t>('\r'));
 
-  while (ptr < unaligned16End) {
+  while (end - ptr >= 16) {
     const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(ptr));
     const uint8x16_t matchLF = vceqq_u8(block, lfs);
     const uint8x16_t matchCR = vceqq_u8(block, crs);
@@ -337,7 +520,6 @@ alignas(16) constexpr uint8_t NEON_HI_NIBBLES_LOOKUP[16] = {
 };
 
 const char* NEON_AdvanceToNextNonContentCharacter(const char* ptr,
-                                                  const char* unaligned16End,
                                                   const char* end) {
   const uint8x16_t loTbl =
       vld1q_u8(reinterpret_cast<const uint8_t*>(NEON_LO_NIBBLES_LOOKUP));
@@ -345,7 +527,7 @@ const char* NEON_AdvanceToNextNonContentCharacter(const char* ptr,
       vld1q_u8(reinterpret_cast<const uint8_t*>(NEON_HI_NIBBLES_LOOKUP));
   const uint8x16_t nibbleMask = vdupq_n_u8(0x0f);
 
-  while (ptr < unaligned16End) {
+  while (end - ptr >= 16) {
     const uint8x16_t input = vld1q_u8(reinterpret_cast<const uint8_t*>(ptr));
     const uint8x16_t loNibbles = vandq_u8(input, nibbleMask);
     const uint8x16_t hiNibbles = vandq_u8(vshrq_n_u8(input, 4), nibbleMask);
@@ -363,114 +545,147 @@ const char* NEON_AdvanceToNextNonContentCharacter(const char* ptr,
   return AdvanceToNextNonContentCharacter(ptr, end);
 }
 
-constexpr uintptr_t NEON_ALIGN16 = 16;
-constexpr uintptr_t NEON_ALIGN16_MASK = NEON_ALIGN16 - 1;
-
-const char* NEON_FindFirstNULL(const char* ptr, const char* end,
-                               size_t* firstLineNumber = nullptr) {
-  const char* i = ptr;
-  bool found = false;
-
-  // Handle unaligned head
-  if ((reinterpret_cast<uintptr_t>(i) & NEON_ALIGN16_MASK) != 0) {
-    const char* headEnd = reinterpret_cast<const char*>(
-        (reinterpret_cast<uintptr_t>(i) + NEON_ALIGN16_MASK) &
-        ~NEON_ALIGN16_MASK);
-    headEnd = headEnd < end ? headEnd : end;
-    while (i != headEnd) {
-      if (*i == '\0') {
-        found = true;
-        break;
-      }
-      ++i;
+const char* NEON_FindFirstNULL(const char* ptr, const char* end) {
+  const uint8x16_t zeros = vdupq_n_u8(0);
+  while (end - ptr >= 16) {
+    const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(ptr));
+    const uint8x16_t match = vceqq_u8(block, zeros);
+    const int pos = FirstNonZeroLane16(match);
+    if (pos < 16) {
+      return ptr + pos;
     }
+    ptr += 16;
   }
 
-  if (!found && i != end) {
-    const char* middleEnd = reinterpret_cast<const char*>(
-        reinterpret_cast<uintptr_t>(end) & ~NEON_ALIGN16_MASK);
-    const uint8x16_t zeros = vdupq_n_u8(0);
-    while (i < middleEnd) {
-      const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(i));
-      const uint8x16_t match = vceqq_u8(block, zeros);
-      const int pos = FirstNonZeroLane16(match);
-      if (pos < 16) {
-        i += pos;
-        found = true;
-        break;
-      }
-      i += NEON_ALIGN16;
-    }
-  }
+  return FindFirstNULL(ptr, end);
+}
 
-  // Handle tail
-  if (!found) {
-    while (i != end) {
-      if (*i == '\0') {
-        found = true;
-        break;
-      }
-      ++i;
-    }
+size_t NEON_CountLFs(const char* ptr, const char* end) {
+  const uint8x16_t linefeeds = vdupq_n_u8(static_cast<uint8_t>('\n'));
+  size_t count = 0;
+  while (end - ptr >= 16) {
+    const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(ptr));
+    const uint8x16_t match = vceqq_u8(block, linefeeds);
+    // Count set bytes
+    count += vaddvq_u8(vshrq_n_u8(match, 7));
+    ptr += 16;
   }
+  return count + CountLFs(ptr, end);
+}
 
-  if (!found || firstLineNumber == nullptr) {
-    return i;
+struct NEONScanner {
+  static const char* advanceToNextCRLF(const char* ptr, const char* end) {
+    return NEON_AdvanceToNextCRLF(ptr, end);
+  }
+  static const char* advanceToNextNonContentCharacter(const char* ptr,
+                                                      const char* end) {
+    return NEON_AdvanceToNextNonContentCharacter(ptr, end);
   }
+  static const char* findFirstNULL(const char* ptr, const char* end) {
+    return NEON_FindFirstNULL(ptr, end);
+  }
+  static size_t countLFs(const char* ptr, const char* end) {
+    return NEON_CountLFs(ptr, end);
+  }
+};
 
-  // Count newlines from ptr to i
-  size_t lineCounter = 1;
-  const char* p = ptr;
+#endif  // ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
 
-  // Scalar head
-  if ((reinterpret_cast<uintptr_t>(p) & NEON_ALIGN16_MASK) != 0) {
-    const char* headEnd = reinterpret_cast<const char*>(
-        (reinterpret_cast<uintptr_t>(p) + NEON_ALIGN16_MASK) &
-        ~NEON_ALIGN16_MASK);
-    headEnd = headEnd < i ? headEnd : i;
-    while (p != headEnd) {
-      if (*p == '\n') {
-        ++lineCounter;
-      }
-      ++p;
-    }
-  }
+using Kernel = ByteBlockBackedDictionary::Kernel;
 
-  // NEON middle
-  if (p != i) {
-    const char* middleEnd = reinterpret_cast<const char*>(
-        reinterpret_cast<uintptr_t>(i) & ~NEON_ALIGN16_MASK);
-    const uint8x16_t linefeeds = vdupq_n_u8(static_cast<uint8_t>('\n'));
-    while (p < middleEnd) {
-      const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
-      const uint8x16_t match = vceqq_u8(block, linefeeds);
-      // Count set bytes
-      lineCounter += vaddvq_u8(vshrq_n_u8(match, 7));
-      p += NEON_ALIGN16;
-    }
+// Returns the fastest kernel that the CPU supports.
+Kernel DetectKernel() {
+#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
+  return Kernel::NEON;
+#elif defined(MCBOPOMOFO_X86_64_KERNELS)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("bmi") &&
+      __builtin_cpu_supports("popcnt")) {
+    return Kernel::AVX512;
   }
-
-  // Scalar tail
-  while (p != i) {
-    if (*p == '\n') {
-      ++lineCounter;
-    }
-    ++p;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    return Kernel::AVX2;
   }
+  return Kernel::SSE2;
+#else
+  return Kernel::GENERIC;
+#endif
+}
 
-  *firstLineNumber = lineCounter;
-  return i;
+Kernel BestKernel() {
+  static const Kernel kernel = DetectKernel();
+  return kernel;
 }
 
-#endif
+std::atomic<Kernel>& ActiveKernel() {
+  static std::atomic<Kernel> kernel(BestKernel());
+  return kernel;
+}
 
 }  // namespace
 
+bool ByteBlockBackedDictionary::isKernelSupported(Kernel kernel) {
+  // The kernels are ordered from the slowest to the fastest, and each one
+  // needs what the previous ones need.
+  switch (kernel) {
+    case Kernel::GENERIC:
+      return true;
+    case Kernel::SSE2:
+    case Kernel::AVX2:
+    case Kernel::AVX512:
+#ifdef MCBOPOMOFO_X86_64_KERNELS
+      return kernel <= BestKernel();
+#else
+      return false;
+#endif
+    case Kernel::NEON:
+      return BestKernel() == Kernel::NEON;
+  }
+  return false;
+}
+
+ByteBlockBackedDictionary::Kernel ByteBlockBackedDictionary::kernel() {
+  return ActiveKernel().load(std::memory_order_relaxed);
+}
+
+bool ByteBlockBackedDictionary::setKernel(Kernel kernel) {
+  if (!isKernelSupported(kernel)) {
+    return false;
+  }
+  ActiveKernel().store(kernel, std::memory_order_relaxed);
+  return true;
+}
+
 void ByteBlockBackedDictionary::clear() {
-  dict_.clear();
+  tables_.clear();
+  tableShift_ = 32;
+  keys_.clear();
+  values_.clear();
   issues_.clear();
 }
 
+bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
+                                      ColumnOrder columnOrder) {
+  switch (kernel()) {
+#ifdef MCBOPOMOFO_X86_64_KERNELS
+    case Kernel::SSE2:
+      return parse<SSE2Scanner>(block, size, columnOrder);
+    case Kernel::AVX2:
+      return parse<AVX2Scanner>(block, size, columnOrder);
+    case Kernel::AVX512:
+      return parse<AVX512Scanner>(block, size, columnOrder);
+#endif
+#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
+    case Kernel::NEON:
+      return parse<NEONScanner>(block, size, columnOrder);
+#endif
+    default:
+      return parse<GenericScanner>(block, size, columnOrder);
+  }
+}
+
+template <typename Scanner>
 bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
                                       ColumnOrder columnOrder) {
   if (block == nullptr) {
@@ -492,37 +707,38 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
   const char* ptr = block;
   const char* end = ptr + size;
 
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-  const char* unaligned32End =
-      reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(end) - 32);
-  if (unaligned32End < ptr) {
-    unaligned32End = ptr;
-  }
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-  const char* unaligned16End =
-      reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(end) - 16);
-  if (unaligned16End < ptr) {
-    unaligned16End = ptr;
-  }
-#endif
-
   // Validate that no NULL characters are in the text.
-  size_t errorAtLine = 0;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-  const char* ctrlCharPtr = AVX512_FindFirstNULL(ptr, end, &errorAtLine);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-  const char* ctrlCharPtr = NEON_FindFirstNULL(ptr, end, &errorAtLine);
-#else
-  const char* ctrlCharPtr = FindFirstNULL(ptr, end, &errorAtLine);
-#endif
-
+  const char* ctrlCharPtr = Scanner::findFirstNULL(ptr, end);
   if (ctrlCharPtr != end) {
+    size_t errorAtLine = Scanner::countLFs(ptr, ctrlCharPtr) + 1;
     issues_.emplace_back(Issue::Type::NULL_CHARACTER_IN_TEXT, errorAtLine);
     return false;
   }
 
+  size_t threadCount = parseThreadCount(size);
+  if (threadCount > 1) {
+    parseInParallel<Scanner>(ptr, end, columnOrder, threadCount);
+    return true;
+  }
+
+  // Every entry takes a line, so the number of lines bounds the number of
+  // entries, and counting them first saves growing the arrays many times.
+  size_t lineCount = Scanner::countLFs(ptr, end) + 1;
+  Lines lines;
+  lines.keys.reserve(lineCount);
+  lines.values.reserve(lineCount);
+  tables_.assign(1, std::vector<Slot>(kMinSlotCount, Slot{0, 0}));
+  tableShift_ = 32;
   size_t lineCounter = 1;
+  parseLines<Scanner>(ptr, end, columnOrder, lines, lineCounter);
+  build(lines);
+  return true;
+}
 
+template <typename Scanner>
+void ByteBlockBackedDictionary::parseLines(const char* ptr, const char* end,
+                                           ColumnOrder columnOrder,
+                                           Lines& lines, size_t& lineCounter) {
   if (columnOrder == ColumnOrder::KEY_THEN_VALUE) {
     while (ptr != end) {
       ptr = AdvanceToNextContentCharacter(ptr, end, lineCounter);
@@ -531,24 +747,12 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       if (*ptr == '#') {
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-        ptr = AVX512_AdvanceToNextCRLF(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-        ptr = NEON_AdvanceToNextCRLF(ptr, unaligned16End, end);
-#else
-        ptr = AdvanceToNextCRLF(ptr, end);
-#endif
+        ptr = Scanner::advanceToNextCRLF(ptr, end);
         continue;
       }
 
       const char* keyStart = ptr;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-      ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-      ptr = NEON_AdvanceToNextNonContentCharacter(ptr, unaligned16End, end);
-#else
-      ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+      ptr = Scanner::advanceToNextNonContentCharacter(ptr, end);
       const char* keyEnd = ptr;
 
       ptr = AdvanceToNextNonWhitespace(ptr, end);
@@ -561,13 +765,7 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       const char* valueStart = ptr;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-      ptr = AVX512_AdvanceToNextCRLF(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-      ptr = NEON_AdvanceToNextCRLF(ptr, unaligned16End, end);
-#else
-      ptr = AdvanceToNextCRLF(ptr, end);
-#endif
+      ptr = Scanner::advanceToNextCRLF(ptr, end);
       const char* valueEnd = ptr;
 
       if (valueEnd == valueStart) {
@@ -602,7 +800,7 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
 
       std::string_view key(keyStart, keyEnd - keyStart);
       std::string_view value(valueStart, valueEnd - valueStart);
-      dict_[key].emplace_back(value);
+      add(key, value, lines);
     }
   } else {
     while (ptr != end) {
@@ -612,24 +810,12 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       if (*ptr == '#') {
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-        ptr = AVX512_AdvanceToNextCRLF(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-        ptr = NEON_AdvanceToNextCRLF(ptr, unaligned16End, end);
-#else
-        ptr = AdvanceToNextCRLF(ptr, end);
-#endif
+        ptr = Scanner::advanceToNextCRLF(ptr, end);
         continue;
       }
 
       const char* valueStart = ptr;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-      ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-      ptr = NEON_AdvanceToNextNonContentCharacter(ptr, unaligned16End, end);
-#else
-      ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+      ptr = Scanner::advanceToNextNonContentCharacter(ptr, end);
       const char* valueEnd = ptr;
 
       ptr = AdvanceToNextNonWhitespace(ptr, end);
@@ -641,13 +827,7 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       const char* maybeKeyStart = ptr;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-      ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-      ptr = NEON_AdvanceToNextNonContentCharacter(ptr, unaligned16End, end);
-#else
-      ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+      ptr = Scanner::advanceToNextNonContentCharacter(ptr, end);
       const char* maybeKeyEnd = ptr;
       if (maybeKeyStart == maybeKeyEnd) {
         if (issues_.size() < MAX_ISSUES) {
@@ -670,36 +850,305 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
         // More content incoming.
         valueEnd = maybeKeyEnd;
         maybeKeyStart = ptr;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-        ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-        ptr = NEON_AdvanceToNextNonContentCharacter(ptr, unaligned16End, end);
-#else
-        ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+        ptr = Scanner::advanceToNextNonContentCharacter(ptr, end);
         maybeKeyEnd = ptr;
       }
 
       std::string_view key(maybeKeyStart, maybeKeyEnd - maybeKeyStart);
       std::string_view value(valueStart, valueEnd - valueStart);
-      dict_[key].emplace_back(value);
+      add(key, value, lines);
     }
   }
+}
 
-  return true;
+template <typename Scanner>
+void ByteBlockBackedDictionary::parseInParallel(const char* ptr,
+                                                const char* end,
+                                                ColumnOrder columnOrder,
+                                                size_t threadCount) {
+  // Split the block into chunks of about the same size, each ending right
+  // after a line feed, so that no line is split.
+  std::vector<const char*> bounds{ptr};
+  const size_t size = end - ptr;
+  for (size_t i = 1; i < threadCount; ++i) {
+    const char* bound = std::max(ptr + size * i / threadCount, bounds.back());
+    bound = static_cast<const char*>(memchr(bound, '\n', end - bound));
+    if (bound == nullptr || bound + 1 == end) {
+      break;
+    }
+    bounds.push_back(bound + 1);
+  }
+  bounds.push_back(end);
+  const size_t chunkCount = bounds.size() - 1;
+
+  // The keys are split between a power of two of tables by the high bits of
+  // their hashes, so that each table can be built on a thread of its own.
+  size_t tableCount = 1;
+  tableShift_ = 32;
+  while (tableCount < chunkCount) {
+    tableCount *= 2;
+    --tableShift_;
+  }
+
+  // Each chunk is first parsed into a dictionary of its own, as if it were the
+  // whole text, so its line numbers start from 1.
+  struct Chunk {
+    ByteBlockBackedDictionary dictionary;
+    Lines lines;
+    size_t lineFeedCount = 0;
+
+    // For each key of the chunk, its hash, its index in keys_, and the number
+    // of its values in the chunks before.
+    std::vector<uint32_t> hashes;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> offsets;
+
+    // The keys of the chunk that go to each table, in the order of their first
+    // lines.
+    std::vector<std::vector<uint32_t>> tableKeys;
+  };
+  std::vector<Chunk> chunks(chunkCount);
+  RunInParallel(chunkCount, [&](size_t i) {
+    Chunk& chunk = chunks[i];
+    chunk.lineFeedCount = Scanner::countLFs(bounds[i], bounds[i + 1]);
+    chunk.lines.keys.reserve(chunk.lineFeedCount + 1);
+    chunk.lines.values.reserve(chunk.lineFeedCount + 1);
+    chunk.dictionary.tables_.assign(
+        1, std::vector<Slot>(kMinSlotCount, Slot{0, 0}));
+    size_t lineCounter = 1;
+    chunk.dictionary.template parseLines<Scanner>(
+        bounds[i], bounds[i + 1], columnOrder, chunk.lines, lineCounter);
+
+    const size_t keyCount = chunk.dictionary.keys_.size();
+    chunk.hashes.resize(keyCount);
+    for (const Slot& slot : chunk.dictionary.tables_[0]) {
+      if (slot.index != 0) {
+        chunk.hashes[slot.index - 1] = slot.hash;
+      }
+    }
+    chunk.tableKeys.resize(tableCount);
+    for (uint32_t k = 0; k < keyCount; ++k) {
+      chunk.tableKeys[tableIndex(chunk.hashes[k])].push_back(k);
+    }
+    chunk.indices.resize(keyCount);
+    chunk.offsets.resize(keyCount);
+  });
+
+  // Build the tables, going through the chunks in order, so that the values
+  // of a key stay in the order of the lines. Each thread builds every
+  // chunkCount-th table.
+  tables_.resize(tableCount);
+  std::vector<std::vector<Key>> tableKeys(tableCount);
+  RunInParallel(chunkCount, [&](size_t i) {
+    for (size_t t = i; t < tableCount; t += chunkCount) {
+      std::vector<Slot>& table = tables_[t];
+      std::vector<Key>& keys = tableKeys[t];
+      table.assign(kMinSlotCount, Slot{0, 0});
+      for (Chunk& chunk : chunks) {
+        for (uint32_t k : chunk.tableKeys[t]) {
+          const Key& key = chunk.dictionary.keys_[k];
+          bool added = false;
+          uint32_t index =
+              findOrAddKey(table, keys, key.key, chunk.hashes[k], added);
+          chunk.indices[k] = index;
+          chunk.offsets[k] = keys[index].valuesCount;
+          keys[index].valuesCount += key.valuesCount;
+        }
+      }
+    }
+  });
+
+  // The keys of the tables are put one table after another in keys_.
+  std::vector<uint32_t> tableBegins(tableCount);
+  size_t keyCount = 0;
+  for (size_t t = 0; t < tableCount; ++t) {
+    tableBegins[t] = static_cast<uint32_t>(keyCount);
+    keyCount += tableKeys[t].size();
+  }
+  keys_.reserve(keyCount);
+  for (std::vector<Key>& keys : tableKeys) {
+    keys_.insert(keys_.end(), keys.begin(), keys.end());
+    keys = std::vector<Key>();
+  }
+  uint32_t begin = 0;
+  for (Key& key : keys_) {
+    key.valuesBegin = begin;
+    begin += key.valuesCount;
+  }
+  values_.resize(begin);
+
+  size_t lineOffset = 0;
+  for (const Chunk& chunk : chunks) {
+    for (const Issue& issue : chunk.dictionary.issues_) {
+      if (issues_.size() < MAX_ISSUES) {
+        issues_.emplace_back(issue.type, issue.lineNumber + lineOffset);
+      }
+    }
+    lineOffset += chunk.lineFeedCount;
+  }
+
+  // Finally, each thread points the slots of its tables to keys_, and puts the
+  // values of its chunk in place.
+  RunInParallel(chunkCount, [&](size_t i) {
+    for (size_t t = i; t < tableCount; t += chunkCount) {
+      for (Slot& slot : tables_[t]) {
+        if (slot.index != 0) {
+          slot.index += tableBegins[t];
+        }
+      }
+    }
+
+    Chunk& chunk = chunks[i];
+    for (size_t k = 0, size = chunk.indices.size(); k < size; ++k) {
+      chunk.indices[k] += tableBegins[tableIndex(chunk.hashes[k])];
+    }
+    for (size_t n = 0, size = chunk.lines.values.size(); n < size; ++n) {
+      uint32_t k = chunk.lines.keys[n];
+      const Key& key = keys_[chunk.indices[k]];
+      values_[key.valuesBegin + chunk.offsets[k]] = chunk.lines.values[n];
+      ++chunk.offsets[k];
+    }
+    chunk = Chunk();
+  });
+}
+
+size_t ByteBlockBackedDictionary::parseThreadCount(size_t size) const {
+  size_t threadCount = maxParseThreads_;
+  if (threadCount == 0) {
+    threadCount = std::min<size_t>(std::thread::hardware_concurrency(),
+                                   MAX_AUTOMATIC_PARSE_THREADS);
+  }
+  return std::max<size_t>(
+      1, std::min(threadCount, size / MIN_PARALLEL_PARSE_CHUNK_SIZE));
+}
+
+void ByteBlockBackedDictionary::add(const std::string_view& key,
+                                    const std::string_view& value,
+                                    Lines& lines) {
+  // The lines of a key are usually next to each other, so the key of the
+  // previous line is tried first, without hashing.
+  if (!lines.keys.empty() && keys_[lines.keys.back()].key == key) {
+    ++keys_[lines.keys.back()].valuesCount;
+    lines.keys.push_back(lines.keys.back());
+    lines.values.push_back(value);
+    return;
+  }
+
+  bool added = false;
+  uint32_t index = findOrAddKey(tables_[0], keys_, key, Hash(key), added);
+  if (!added) {
+    lines.grouped = false;
+  }
+  ++keys_[index].valuesCount;
+  lines.keys.push_back(index);
+  lines.values.push_back(value);
+}
+
+uint32_t ByteBlockBackedDictionary::findOrAddKey(std::vector<Slot>& table,
+                                                 std::vector<Key>& keys,
+                                                 const std::string_view& key,
+                                                 uint32_t hash, bool& added) {
+  Slot& slot = table[probe(table, keys, hash, key)];
+  added = slot.index == 0;
+  if (!added) {
+    return slot.index - 1;
+  }
+
+  keys.push_back(Key{key, 0, 0});
+  slot = Slot{hash, static_cast<uint32_t>(keys.size())};
+  if (keys.size() * 2 > table.size()) {
+    grow(table);
+  }
+  return static_cast<uint32_t>(keys.size()) - 1;
+}
+
+void ByteBlockBackedDictionary::build(Lines& lines) {
+  uint32_t begin = 0;
+  for (Key& key : keys_) {
+    key.valuesBegin = begin;
+    begin += key.valuesCount;
+  }
+
+  // If the lines of each key are next to each other, the values are already
+  // in place.
+  if (lines.grouped) {
+    values_ = std::move(lines.values);
+    return;
+  }
+
+  // Otherwise the values of each key are put together, keeping their order.
+  std::vector<uint32_t> counts(keys_.size(), 0);
+  values_.resize(lines.values.size());
+  for (size_t i = 0, size = lines.values.size(); i < size; ++i) {
+    uint32_t index = lines.keys[i];
+    values_[keys_[index].valuesBegin + counts[index]] = lines.values[i];
+    ++counts[index];
+  }
+}
+
+void ByteBlockBackedDictionary::grow(std::vector<Slot>& table) {
+  std::vector<Slot> slots(table.size() * 2, Slot{0, 0});
+  size_t mask = slots.size() - 1;
+  for (const Slot& slot : table) {
+    if (slot.index == 0) {
+      continue;
+    }
+    size_t i = slot.hash & mask;
+    while (slots[i].index != 0) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = slot;
+  }
+  table = std::move(slots);
+}
+
+size_t ByteBlockBackedDictionary::probe(const std::vector<Slot>& table,
+                                        const std::vector<Key>& keys,
+                                        uint32_t hash,
+                                        const std::string_view& key) {
+  size_t mask = table.size() - 1;
+  size_t i = hash & mask;
+  while (table[i].index != 0) {
+    if (table[i].hash == hash && keys[table[i].index - 1].key == key) {
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+const ByteBlockBackedDictionary::Key* ByteBlockBackedDictionary::find(
+    const std::string_view& key) const {
+  if (tables_.empty()) {
+    return nullptr;
+  }
+  uint32_t hash = Hash(key);
+  const std::vector<Slot>& table = tables_[tableIndex(hash)];
+  uint32_t index = table[probe(table, keys_, hash, key)].index;
+  return index == 0 ? nullptr : &keys_[index - 1];
 }
 
 bool ByteBlockBackedDictionary::hasKey(const std::string_view& key) const {
-  return dict_.find(key) != dict_.end();
+  return find(key) != nullptr;
 }
 
 std::vector<std::string_view> ByteBlockBackedDictionary::getValues(
     const std::string_view& key) const {
-  const auto it = dict_.find(key);
-  if (it == dict_.cend()) {
+  const Key* found = find(key);
+  if (found == nullptr) {
     return {};
   }
-  return it->second;
+  auto begin = values_.begin() + found->valuesBegin;
+  return std::vector<std::string_view>(begin, begin + found->valuesCount);
+}
+
+std::vector<std::string_view> ByteBlockBackedDictionary::keys() const {
+  std::vector<std::string_view> result;
+  result.reserve(keys_.size());
+  for (const Key& key : keys_) {
+    result.push_back(key.key);
+  }
+  return result;
 }
 
 }  // namespace McBopomofo
@@ -24,8 +24,8 @@
 #ifndef SRC_ENGINE_BYTEBLOCKBACKEDDICTIONARY_H_
 #define SRC_ENGINE_BYTEBLOCKBACKEDDICTIONARY_H_
 
+#include <cstdint>
 #include <string_view>
-#include <unordered_map>
 #include <vector>
 
 namespace McBopomofo {
@@ -85,21 +85,133 @@ class ByteBlockBackedDictionary {
     VALUE_THEN_KEY,
   };
 
+  // The implementations of the scanning of the text, in the order from the
+  // slowest to the fastest. By default, the fastest one that the CPU supports
+  // is used, which is at least SSE2 on x86-64; the NEON kernel is used when
+  // the library is built with ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON.
+  enum class Kernel {
+    GENERIC,
+    SSE2,
+    AVX2,
+    AVX512,
+    NEON,
+  };
+
+  static bool isKernelSupported(Kernel kernel);
+  static Kernel kernel();
+
+  // Sets the kernel used by all dictionaries, mostly for testing and
+  // benchmarking. Returns false if the kernel is not supported.
+  static bool setKernel(Kernel kernel);
+
   void clear();
   bool parse(const char* block, size_t size,
              ColumnOrder columnOrder = ColumnOrder::KEY_THEN_VALUE);
 
+  // Sets the number of threads that parse() may use. A large block is split
+  // into chunks at line boundaries, which are parsed on their own threads and
+  // then merged; the results, including the issues, are the same as parsing
+  // the block on one thread. The default, 0, uses up to one thread per CPU,
+  // and 1 always parses on the calling thread.
+  void setMaxParseThreads(size_t threads) { maxParseThreads_ = threads; }
+
   [[nodiscard]] bool hasKey(const std::string_view& key) const;
   [[nodiscard]] std::vector<std::string_view> getValues(
       const std::string_view& key) const;
 
+  // Returns all the keys, in no particular order.
+  [[nodiscard]] std::vector<std::string_view> keys() const;
+
   const std::vector<Issue>& issues() const { return issues_; }
 
  private:
   static constexpr size_t MAX_ISSUES = 100;
 
+  // A block is only split if each thread gets at least this many bytes.
+  static constexpr size_t MIN_PARALLEL_PARSE_CHUNK_SIZE = 512 * 1024;
+  static constexpr size_t MAX_AUTOMATIC_PARSE_THREADS = 8;
+
+  // A key and where its values are in values_.
+  struct Key {
+    std::string_view key;
+    uint32_t valuesBegin;
+    uint32_t valuesCount;
+  };
+
+  // A slot of the open-addressing hash table. The index is 1-based into
+  // keys_, and 0 means the slot is empty.
+  struct Slot {
+    uint32_t hash;
+    uint32_t index;
+  };
+
+  // The parsed lines, as the indices of their keys in keys_ and their values,
+  // before the values are grouped by their keys.
+  struct Lines {
+    std::vector<uint32_t> keys;
+    std::vector<std::string_view> values;
+
+    // Whether the lines of each key are next to each other.
+    bool grouped = true;
+  };
+
+  template <typename Scanner>
+  bool parse(const char* block, size_t size, ColumnOrder columnOrder);
+
+  // Parses the lines from ptr to end, counting the lines from lineCounter.
+  template <typename Scanner>
+  void parseLines(const char* ptr, const char* end, ColumnOrder columnOrder,
+                  Lines& lines, size_t& lineCounter);
+
+  template <typename Scanner>
+  void parseInParallel(const char* ptr, const char* end,
+                       ColumnOrder columnOrder, size_t threadCount);
+
+  [[nodiscard]] size_t parseThreadCount(size_t size) const;
+
+  // Adds a parsed line, and its key to the hash table if the key is new.
+  void add(const std::string_view& key, const std::string_view& value,
+           Lines& lines);
+
+  // Returns the index of the key in keys, and adds the key to keys and the
+  // table if it is new.
+  static uint32_t findOrAddKey(std::vector<Slot>& table, std::vector<Key>& keys,
+                               const std::string_view& key, uint32_t hash,
+                               bool& added);
+
+  // Puts the values of the lines in values_, grouped by their keys.
+  void build(Lines& lines);
+
+  // Doubles the number of slots of the table.
+  static void grow(std::vector<Slot>& table);
+
+  // Returns the position of the slot of the key in the table, or of the empty
+  // slot where the key would be.
+  [[nodiscard]] static size_t probe(const std::vector<Slot>& table,
+                                    const std::vector<Key>& keys, uint32_t hash,
+                                    const std::string_view& key);
+
+  // Returns which of tables_ has the key of the hash.
+  [[nodiscard]] size_t tableIndex(uint32_t hash) const {
+    return static_cast<size_t>(static_cast<uint64_t>(hash) >> tableShift_);
+  }
+
+  [[nodiscard]] const Key* find(const std::string_view& key) const;
+
   std::vector<Issue> issues_;
-  std::unordered_map<std::string_view, std::vector<std::string_view>> dict_;
+
+  // The values of all keys are in one array, and those of a key are
+  // contiguous and in the order of the lines. The keys are in one or, when
+  // parsed on several threads, a power of two of hash tables, which are picked
+  // by the high bits of the hashes; the keys of each table are in keys_ in the
+  // order of their first lines. The number of slots of a table is a power of
+  // two.
+  std::vector<std::vector<Slot>> tables_;
+  uint32_t tableShift_ = 32;
+  std::vector<Key> keys_;
+  std::vector<std::string_view> values_;
+
+  size_t maxParseThreads_ = 0;
 };
 
 }  // namespace McBopomofo
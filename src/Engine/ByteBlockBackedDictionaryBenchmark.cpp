@@ -23,13 +23,38 @@
 
 #include <benchmark/benchmark.h>
 
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "ByteBlockBackedDictionary.h"
 
 namespace {
 
+using McBopomofo::ByteBlockBackedDictionary;
+
+// The parse benchmarks are run with each kernel, given as the argument, and
+// skipped for the kernels that the CPU does not support.
+constexpr int kLastKernel =
+    static_cast<int>(ByteBlockBackedDictionary::Kernel::NEON);
+
+bool UseKernel(benchmark::State& state) {
+  static constexpr const char* kKernelNames[] = {"generic", "sse2", "avx2",
+                                                 "avx512", "neon"};
+  auto kernel = static_cast<ByteBlockBackedDictionary::Kernel>(state.range(0));
+  if (!ByteBlockBackedDictionary::setKernel(kernel)) {
+    state.SkipWithError("kernel not supported");
+    return false;
+  }
+  state.SetLabel(kKernelNames[state.range(0)]);
+  return true;
+}
+
 const std::string& GetTestData() {
   static const std::string data = []() {
     std::stringstream sst;
@@ -59,26 +84,163 @@ const std::string& GetTestData() {
 
 void BM_ByteBlockBackedDictionaryParseTest(benchmark::State& state) {
   const std::string& testData = GetTestData();
+  if (!UseKernel(state)) {
+    return;
+  }
 
   for (auto _ : state) {
-    McBopomofo::ByteBlockBackedDictionary dictionary;
+    ByteBlockBackedDictionary dictionary;
     dictionary.parse(testData.c_str(), testData.size());
   }
 }
-BENCHMARK(BM_ByteBlockBackedDictionaryParseTest);
+BENCHMARK(BM_ByteBlockBackedDictionaryParseTest)->DenseRange(0, kLastKernel);
 
 void BM_ByteBlockBackedDictionaryValueColumnFirstParseTest(
     benchmark::State& state) {
   const std::string& testData = GetTestData();
+  if (!UseKernel(state)) {
+    return;
+  }
+
+  for (auto _ : state) {
+    ByteBlockBackedDictionary dictionary;
+    dictionary.parse(testData.c_str(), testData.size(),
+                     ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+  }
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryValueColumnFirstParseTest)
+    ->DenseRange(0, kLastKernel);
+
+// A large file shaped like the user phrases: many keys, each with a few
+// values, in the value-then-key order.
+const std::string& GetLargeTestData() {
+  static const std::string data = []() {
+    std::stringstream sst;
+    sst << "# A large synthetic user phrase file\n";
+
+    constexpr int keys = 200000;
+    for (int k = 0; k < keys; ++k) {
+      for (int v = 0; v <= k % 3; ++v) {
+        sst << "value_" << k << "_" << v << " ㄎㄟ-" << k << "\n";
+      }
+    }
+    return sst.str();
+  }();
+  return data;
+}
+
+std::vector<std::string> GetLargeTestDataKeys() {
+  std::vector<std::string> keys;
+  // Every 7th key, and some that are missing.
+  for (int k = 0; k < 400000; k += 7) {
+    keys.push_back("ㄎㄟ-" + std::to_string(k));
+  }
+  return keys;
+}
+
+void BM_ByteBlockBackedDictionaryLargeParseTest(benchmark::State& state) {
+  const std::string& testData = GetLargeTestData();
+  if (!UseKernel(state)) {
+    return;
+  }
 
   for (auto _ : state) {
-    McBopomofo::ByteBlockBackedDictionary dictionary;
-    dictionary.parse(
-        testData.c_str(), testData.size(),
-        McBopomofo::ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+    ByteBlockBackedDictionary dictionary;
+    dictionary.parse(testData.c_str(), testData.size(),
+                     ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(testData.size()));
+
+#if defined(__GLIBC__)
+  // The heap used by the parsed dictionary.
+  struct mallinfo2 before = mallinfo2();
+  {
+    ByteBlockBackedDictionary dictionary;
+    dictionary.parse(testData.c_str(), testData.size(),
+                     ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+    struct mallinfo2 after = mallinfo2();
+    state.counters["heap_bytes"] =
+        static_cast<double>(after.uordblks - before.uordblks);
+  }
+#endif
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryLargeParseTest)
+    ->DenseRange(0, kLastKernel)
+    ->Unit(benchmark::kMillisecond);
+
+// A million lines of user phrases added over time, so that the lines of each
+// key are not next to each other.
+const std::string& GetMillionLineTestData() {
+  static const std::string data = []() {
+    std::stringstream sst;
+    for (int i = 0; i < 1000000; ++i) {
+      int k = static_cast<int>((i * 7919LL) % 300000);
+      sst << "value_" << i << " ㄎㄟ-" << k << "\n";
+    }
+    return sst.str();
+  }();
+  return data;
+}
+
+void BM_ByteBlockBackedDictionaryMillionLineParseTest(benchmark::State& state) {
+  const std::string& testData = GetMillionLineTestData();
+
+  for (auto _ : state) {
+    ByteBlockBackedDictionary dictionary;
+    dictionary.setMaxParseThreads(static_cast<size_t>(state.range(0)));
+    dictionary.parse(testData.c_str(), testData.size(),
+                     ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(testData.size()));
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryMillionLineParseTest)
+    ->ArgName("threads")
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+void BM_ByteBlockBackedDictionaryLargeGetValuesTest(benchmark::State& state) {
+  const std::string& testData = GetLargeTestData();
+  ByteBlockBackedDictionary dictionary;
+  dictionary.parse(testData.c_str(), testData.size(),
+                   ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+  std::vector<std::string> keys = GetLargeTestDataKeys();
+
+  size_t found = 0;
+  for (auto _ : state) {
+    for (const auto& key : keys) {
+      found += dictionary.getValues(key).size();
+    }
+  }
+  benchmark::DoNotOptimize(found);
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(keys.size()));
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryLargeGetValuesTest);
+
+void BM_ByteBlockBackedDictionaryLargeHasKeyTest(benchmark::State& state) {
+  const std::string& testData = GetLargeTestData();
+  ByteBlockBackedDictionary dictionary;
+  dictionary.parse(testData.c_str(), testData.size(),
+                   ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+  std::vector<std::string> keys = GetLargeTestDataKeys();
+
+  size_t found = 0;
+  for (auto _ : state) {
+    for (const auto& key : keys) {
+      found += dictionary.hasKey(key) ? 1 : 0;
+    }
   }
+  benchmark::DoNotOptimize(found);
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(keys.size()));
 }
-BENCHMARK(BM_ByteBlockBackedDictionaryValueColumnFirstParseTest);
+BENCHMARK(BM_ByteBlockBackedDictionaryLargeHasKeyTest);
 
 };  // namespace
 
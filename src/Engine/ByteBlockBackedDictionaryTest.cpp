@@ -21,6 +21,11 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include "ByteBlockBackedDictionary.h"
 #include "gtest/gtest.h"
 
@@ -280,4 +285,171 @@ TEST(ByteBlockBackedDictionaryTest, ComplexEntriesValueThenKey) {
   ASSERT_EQ(dict.getValues("comment").at(0), "value1 \t key1  #");
 }
 
+TEST(ByteBlockBackedDictionaryTest, ManyKeys) {
+  // Enough keys to grow the hash table several times, and each key has two
+  // values on lines far apart.
+  constexpr int kKeyCount = 1000;
+  std::string data;
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int k = 0; k < kKeyCount; ++k) {
+      data += "key" + std::to_string(k) + " value" + std::to_string(k) + "_" +
+              std::to_string(pass) + "\n";
+    }
+  }
+
+  ByteBlockBackedDictionary dict;
+  ASSERT_TRUE(dict.parse(data.c_str(), data.size()));
+  ASSERT_EQ(dict.keys().size(), kKeyCount);
+  for (int k = 0; k < kKeyCount; ++k) {
+    std::string key = "key" + std::to_string(k);
+    auto values = dict.getValues(key);
+    ASSERT_EQ(values.size(), 2);
+    ASSERT_EQ(values.at(0), "value" + std::to_string(k) + "_0");
+    ASSERT_EQ(values.at(1), "value" + std::to_string(k) + "_1");
+  }
+  ASSERT_FALSE(dict.hasKey("key" + std::to_string(kKeyCount)));
+
+  // Parsing again replaces everything.
+  constexpr char other[] = "key0 another\n";
+  ASSERT_TRUE(dict.parse(other, sizeof(other)));
+  ASSERT_EQ(dict.keys().size(), 1);
+  ASSERT_EQ(dict.getValues("key0").size(), 1);
+  ASSERT_EQ(dict.getValues("key0").at(0), "another");
+  ASSERT_FALSE(dict.hasKey("key1"));
+}
+
+// Lines of many lengths, so that the fields cross the boundaries of the blocks
+// that the SIMD kernels read.
+static std::string MakeKernelTestData() {
+  std::string data = "# comment\n";
+  for (int i = 0; i < 300; ++i) {
+    std::string key = "k" + std::to_string(i % 37) + std::string(i % 41, 'x');
+    std::string value = "v" + std::string(i % 67, 'y') + " z\t" +
+                        std::string(i % 5, 'w');
+    switch (i % 7) {
+      case 0:
+        data += key + "\t" + value + "\r\n";
+        break;
+      case 1:
+        data += "  " + key + "  \t" + value + " \t\n";
+        break;
+      case 2:
+        data += key + "\n";
+        break;
+      case 3:
+        data += std::string(i % 33, ' ') + "# " + value + "\n\n";
+        break;
+      default:
+        data += key + " " + value + "\n";
+        break;
+    }
+  }
+  return data;
+}
+
+static void ExpectSameParsing(const ByteBlockBackedDictionary& dict,
+                              const ByteBlockBackedDictionary& expected) {
+  auto keys = dict.keys();
+  auto expectedKeys = expected.keys();
+  std::sort(keys.begin(), keys.end());
+  std::sort(expectedKeys.begin(), expectedKeys.end());
+  ASSERT_EQ(keys, expectedKeys);
+  for (std::string_view key : keys) {
+    ASSERT_EQ(dict.getValues(key), expected.getValues(key));
+  }
+  ASSERT_EQ(dict.issues().size(), expected.issues().size());
+  for (size_t i = 0; i < dict.issues().size(); ++i) {
+    ASSERT_EQ(dict.issues()[i].type, expected.issues()[i].type);
+    ASSERT_EQ(dict.issues()[i].lineNumber, expected.issues()[i].lineNumber);
+  }
+}
+
+TEST(ByteBlockBackedDictionaryTest, AllSupportedKernelsParseTheSame) {
+  using Kernel = ByteBlockBackedDictionary::Kernel;
+  using ColumnOrder = ByteBlockBackedDictionary::ColumnOrder;
+  const Kernel defaultKernel = ByteBlockBackedDictionary::kernel();
+  ASSERT_TRUE(ByteBlockBackedDictionary::isKernelSupported(defaultKernel));
+  ASSERT_TRUE(ByteBlockBackedDictionary::isKernelSupported(Kernel::GENERIC));
+
+  const std::string data = MakeKernelTestData();
+  std::vector<std::string> dataWithNULs;
+  for (size_t pos : {size_t{0}, size_t{15}, size_t{16}, size_t{31}, size_t{32},
+                     size_t{63}, size_t{64}, size_t{65}, size_t{1000},
+                     data.size() - 2}) {
+    dataWithNULs.push_back(data);
+    dataWithNULs.back()[pos] = '\0';
+  }
+
+  for (Kernel kernel : {Kernel::GENERIC, Kernel::SSE2, Kernel::AVX2,
+                        Kernel::AVX512, Kernel::NEON}) {
+    if (!ByteBlockBackedDictionary::isKernelSupported(kernel)) {
+      ASSERT_FALSE(ByteBlockBackedDictionary::setKernel(kernel));
+      continue;
+    }
+
+    for (ColumnOrder order :
+         {ColumnOrder::KEY_THEN_VALUE, ColumnOrder::VALUE_THEN_KEY}) {
+      ByteBlockBackedDictionary expected;
+      ASSERT_TRUE(ByteBlockBackedDictionary::setKernel(Kernel::GENERIC));
+      ASSERT_TRUE(expected.parse(data.c_str(), data.size(), order));
+      ByteBlockBackedDictionary dict;
+      ASSERT_TRUE(ByteBlockBackedDictionary::setKernel(kernel));
+      ASSERT_TRUE(dict.parse(data.c_str(), data.size(), order));
+      ExpectSameParsing(dict, expected);
+    }
+
+    for (const auto& dataWithNUL : dataWithNULs) {
+      ByteBlockBackedDictionary expected;
+      ASSERT_TRUE(ByteBlockBackedDictionary::setKernel(Kernel::GENERIC));
+      ASSERT_FALSE(expected.parse(dataWithNUL.c_str(), dataWithNUL.size()));
+      ByteBlockBackedDictionary dict;
+      ASSERT_TRUE(ByteBlockBackedDictionary::setKernel(kernel));
+      ASSERT_FALSE(dict.parse(dataWithNUL.c_str(), dataWithNUL.size()));
+      ExpectSameParsing(dict, expected);
+    }
+  }
+
+  ByteBlockBackedDictionary::setKernel(defaultKernel);
+}
+
+// About 3 MB of lines, enough to be split for several threads. The keys come in
+// runs that cross the chunk boundaries, or are interleaved, and there is a
+// line with a missing column every errorInterval lines.
+static std::string MakeParallelParseTestData(bool interleaved,
+                                             int errorInterval) {
+  std::string data = "# comment\n";
+  for (int i = 0; i < 100000; ++i) {
+    int k = interleaved ? i % 1009 : i / (1 + i % 13 + i / 5000);
+    if (i % errorInterval == 0) {
+      data += "key_only_" + std::to_string(k) + "\n";
+    } else if (i % 11 == 0) {
+      data += "key_" + std::to_string(k) + "\tvalue_" + std::to_string(i) +
+              "\r\n\n";
+    } else {
+      data += "key_" + std::to_string(k) + " value_" + std::to_string(i) + "\n";
+    }
+  }
+  return data;
+}
+
+TEST(ByteBlockBackedDictionaryTest, ParallelParsingIsTheSame) {
+  for (bool interleaved : {false, true}) {
+    for (int errorInterval : {1499, 97}) {
+      const std::string data =
+          MakeParallelParseTestData(interleaved, errorInterval);
+      ByteBlockBackedDictionary expected;
+      expected.setMaxParseThreads(1);
+      ASSERT_TRUE(expected.parse(data.c_str(), data.size()));
+      ASSERT_FALSE(expected.issues().empty());
+
+      for (size_t threads : {2, 3, 4, 8}) {
+        ByteBlockBackedDictionary dict;
+        dict.setMaxParseThreads(threads);
+        ASSERT_TRUE(dict.parse(data.c_str(), data.size()));
+        ExpectSameParsing(dict, expected);
+      }
+    }
+  }
+}
+
 }  // namespace McBopomofo
@@ -0,0 +1,265 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+// mcbopomofo-convert: converts Bopomofo reading sequences to text, offline.
+//
+// Each input line is a sequence of readings separated by whitespace, such as
+// "ㄓㄨㄥ ㄨㄣˊ". Each output line is the walk of the readings of the
+// corresponding input line. A token that is not a known reading, such as a
+// punctuation mark, ends the current run of readings and is copied verbatim.
+//
+// The lines are converted by a pool of workers, each with its own
+// ReadingGrid, all sharing the same read-only language model. The output is in
+// the same order as the input. The throughput is reported to stderr.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "McBopomofoLM.h"
+#include "gramambular2/reading_grid.h"
+
+namespace {
+
+using Formosa::Gramambular2::ReadingGrid;
+using McBopomofo::McBopomofoLM;
+
+// The number of lines converted between two writes of the output. Large enough
+// to keep all workers busy, small enough to stream large inputs.
+constexpr size_t kBatchSize = 16384;
+
+// Same as the KeyHandler's.
+constexpr char kJoinSeparator[] = "-";
+
+struct Options {
+  std::string dataPath;
+  std::string inputPath;
+  std::string nodeSeparator;
+  size_t threads = 0;
+};
+
+void PrintUsage(const char* program) {
+  std::cerr << "usage: " << program
+            << " [--threads N] [--node-separator SEP] DATA_PATH [INPUT_PATH]\n"
+            << "\n"
+            << "Converts each line of Bopomofo readings separated by "
+               "whitespace to text.\n"
+            << "Reads from stdin if INPUT_PATH is absent or is \"-\".\n"
+            << "\n"
+            << "  --threads N           number of workers (default: number "
+               "of cores)\n"
+            << "  --node-separator SEP  inserted between the walked nodes, "
+               "for example \" \"\n"
+            << "                        to show the segmentation (default: "
+               "none)\n";
+}
+
+bool ParseOptions(int argc, char* argv[], Options* options) {
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--threads" && i + 1 < argc) {
+      char* end = nullptr;
+      long threads = std::strtol(argv[++i], &end, 10);
+      if (*end != '\0' || threads <= 0) {
+        return false;
+      }
+      options->threads = static_cast<size_t>(threads);
+    } else if (arg == "--node-separator" && i + 1 < argc) {
+      options->nodeSeparator = argv[++i];
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      return false;
+    } else {
+      positional.push_back(arg);
+    }
+  }
+  if (positional.empty() || positional.size() > 2) {
+    return false;
+  }
+  options->dataPath = positional[0];
+  options->inputPath = positional.size() > 1 ? positional[1] : "-";
+  if (options->threads == 0) {
+    options->threads =
+        std::max<size_t>(1, std::thread::hardware_concurrency());
+  }
+  return true;
+}
+
+class Converter {
+ public:
+  Converter(std::shared_ptr<McBopomofoLM> lm, std::string nodeSeparator)
+      : lm_(lm),
+        grid_(std::move(lm)),
+        nodeSeparator_(std::move(nodeSeparator)) {
+    grid_.setReadingSeparator(kJoinSeparator);
+  }
+
+  // Converts a line of readings; returns the number of readings converted.
+  size_t convert(const std::string& line, std::string* output) {
+    output->clear();
+    size_t converted = 0;
+    std::vector<std::string> readings;
+    std::istringstream tokens(line);
+    std::string token;
+    while (tokens >> token) {
+      if (lm_->hasUnigrams(token)) {
+        readings.push_back(std::move(token));
+        continue;
+      }
+      converted += walk(readings, output);
+      appendNode(token, output);
+    }
+    converted += walk(readings, output);
+    return converted;
+  }
+
+ private:
+  size_t walk(std::vector<std::string>& readings, std::string* output) {
+    if (readings.empty()) {
+      return 0;
+    }
+    grid_.clear();
+    grid_.insertReadings(readings);
+    for (const auto& node : grid_.walk().nodes) {
+      appendNode(node->value(), output);
+    }
+    size_t count = readings.size();
+    readings.clear();
+    return count;
+  }
+
+  void appendNode(const std::string& value, std::string* output) {
+    if (!output->empty()) {
+      *output += nodeSeparator_;
+    }
+    *output += value;
+  }
+
+  std::shared_ptr<McBopomofoLM> lm_;
+  ReadingGrid grid_;
+  std::string nodeSeparator_;
+};
+
+// Converts the lines with the workers, one converter per worker. Returns the
+// number of readings converted.
+size_t ConvertBatch(std::vector<std::unique_ptr<Converter>>& converters,
+                    const std::vector<std::string>& lines,
+                    std::vector<std::string>* outputs) {
+  outputs->resize(lines.size());
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> total{0};
+  auto work = [&](Converter* converter) {
+    size_t count = 0;
+    for (size_t i = next++; i < lines.size(); i = next++) {
+      count += converter->convert(lines[i], &(*outputs)[i]);
+    }
+    total += count;
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < converters.size(); ++i) {
+    workers.emplace_back(work, converters[i].get());
+  }
+  work(converters[0].get());
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  return total;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  auto lm = std::make_shared<McBopomofoLM>();
+  // The workers share the LM, and its unigram cache is not thread-safe.
+  lm->setUnigramCacheCapacity(0);
+  lm->loadLanguageModel(options.dataPath.c_str());
+  if (!lm->isDataModelLoaded()) {
+    std::cerr << "cannot load language model: " << options.dataPath << "\n";
+    return 1;
+  }
+
+  std::ifstream file;
+  if (options.inputPath != "-") {
+    file.open(options.inputPath);
+    if (!file) {
+      std::cerr << "cannot open input: " << options.inputPath << "\n";
+      return 1;
+    }
+  }
+  std::istream& input = options.inputPath == "-" ? std::cin : file;
+
+  std::vector<std::unique_ptr<Converter>> converters;
+  for (size_t i = 0; i < options.threads; ++i) {
+    converters.push_back(
+        std::make_unique<Converter>(lm, options.nodeSeparator));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  size_t totalReadings = 0;
+  size_t totalLines = 0;
+  std::vector<std::string> lines;
+  std::vector<std::string> outputs;
+  std::string line;
+  bool eof = false;
+  while (!eof) {
+    lines.clear();
+    while (lines.size() < kBatchSize) {
+      if (!std::getline(input, line)) {
+        eof = true;
+        break;
+      }
+      lines.push_back(std::move(line));
+    }
+    totalReadings += ConvertBatch(converters, lines, &outputs);
+    totalLines += lines.size();
+    for (size_t i = 0; i < lines.size(); ++i) {
+      std::cout << outputs[i] << "\n";
+    }
+  }
+  std::cout.flush();
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cerr << "converted " << totalLines << " lines, " << totalReadings
+            << " syllables in " << seconds << " s with " << options.threads
+            << " threads: "
+            << (seconds > 0 ? static_cast<double>(totalReadings) / seconds : 0)
+            << " syllables/sec\n";
+  return 0;
+}
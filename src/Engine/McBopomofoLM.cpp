@@ -24,9 +24,12 @@
 #include "McBopomofoLM.h"
 
 #include <algorithm>
+#include <ctime>
+#include <iterator>
 #include <limits>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -38,11 +41,18 @@ namespace McBopomofo {
 static constexpr std::string_view kMacroPrefix = "MACRO@";
 static constexpr double kMacroScore = -8.0;
 
+static bool IsMacro(const std::string& value) {
+  return value.size() > kMacroPrefix.size() &&
+         value.compare(0, kMacroPrefix.size(), kMacroPrefix) == 0;
+}
+
 void McBopomofoLM::loadLanguageModel(const char* languageModelDataPath) {
+  clearUnigramCache();
   if (languageModelDataPath) {
     languageModel_.close();
     languageModel_.open(languageModelDataPath);
   }
+  rebuildUserOverlay();
 }
 
 bool McBopomofoLM::isDataModelLoaded() const {
@@ -58,8 +68,10 @@ void McBopomofoLM::loadAssociatedPhrasesV2(const char* associatedPhrasesPath) {
 
 void McBopomofoLM::loadUserPhrases(const char* userPhrasesDataPath,
                                    const char* excludedPhrasesDataPath) {
+  clearUnigramCache();
   userPhrases_.close();
   excludedPhrases_.close();
+  userPhraseEdits_.clear();
 
   if (userPhrasesDataPath) {
     userPhrasesDataPath_ = userPhrasesDataPath;
@@ -74,6 +86,7 @@ void McBopomofoLM::loadUserPhrases(const char* userPhrasesDataPath,
   } else {
     excludedPhrasesDataPath_.reset();
   }
+  rebuildUserOverlay();
 }
 
 bool McBopomofoLM::isAssociatedPhrasesV2Loaded() const {
@@ -81,6 +94,7 @@ bool McBopomofoLM::isAssociatedPhrasesV2Loaded() const {
 }
 
 void McBopomofoLM::loadPhraseReplacementMap(const char* phraseReplacementPath) {
+  clearUnigramCache();
   phraseReplacement_.close();
 
   if (phraseReplacementPath) {
@@ -89,6 +103,7 @@ void McBopomofoLM::loadPhraseReplacementMap(const char* phraseReplacementPath) {
   } else {
     phraseReplacementPath_.reset();
   }
+  rebuildUserOverlay();
 }
 
 static McBopomofoLM::IssueType TranslateIssue(
@@ -137,40 +152,141 @@ std::vector<McBopomofoLM::UserFileIssue> McBopomofoLM::getUserFileIssues()
 
 std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
 McBopomofoLM::getUnigrams(const std::string& key) {
-  if (key == " ") {
-    std::vector<Formosa::Gramambular2::LanguageModel::Unigram> spaceUnigrams;
-    spaceUnigrams.emplace_back(" ", 0);
-    return spaceUnigrams;
+  bool hasMacros = false;
+  if (unigramCacheCapacity_ == 0) {
+    return lookUpUnigrams(key, hasMacros);
   }
 
-  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> allUnigrams;
-  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> userUnigrams;
+  auto mapIter = unigramCacheMap_.find(key);
+  if (mapIter != unigramCacheMap_.end()) {
+    ++unigramCacheStats_.hits;
+    unigramCacheList_.splice(unigramCacheList_.begin(), unigramCacheList_,
+                             mapIter->second);
+    return mapIter->second->second;
+  }
 
-  std::unordered_set<std::string> excludedValues;
-  std::unordered_set<std::string> insertedValues;
+  ++unigramCacheStats_.misses;
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> unigrams =
+      lookUpUnigrams(key, hasMacros);
+  if (hasMacros) {
+    return unigrams;
+  }
+
+  unigramCacheList_.emplace_front(key, unigrams);
+  unigramCacheMap_.emplace(unigramCacheList_.front().first,
+                           unigramCacheList_.begin());
+  if (unigramCacheList_.size() > unigramCacheCapacity_) {
+    unigramCacheMap_.erase(unigramCacheList_.back().first);
+    unigramCacheList_.pop_back();
+    ++unigramCacheStats_.evictions;
+  }
+  return unigrams;
+}
+
+// Removes the unigrams whose values are already in the list. A few unigrams
+// are compared with the ones kept so far, which needs no allocation; longer
+// lists are sorted by value instead, using buffers that the thread reuses.
+static void RemoveDuplicateValues(
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram>& unigrams) {
+  constexpr size_t kMaxLinearScanSize = 8;
+  const size_t size = unigrams.size();
+  if (size < 2) {
+    return;
+  }
+
+  if (size <= kMaxLinearScanSize) {
+    size_t kept = 1;
+    for (size_t i = 1; i < size; ++i) {
+      bool duplicate = false;
+      for (size_t j = 0; j < kept; ++j) {
+        if (unigrams[i].value() == unigrams[j].value()) {
+          duplicate = true;
+          break;
+        }
+      }
+      if (!duplicate) {
+        if (kept != i) {
+          unigrams[kept] = std::move(unigrams[i]);
+        }
+        ++kept;
+      }
+    }
+    unigrams.resize(kept);
+    return;
+  }
 
-  if (excludedPhrases_.hasUnigrams(key)) {
-    std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-        excludedUnigrams = excludedPhrases_.getUnigrams(key);
-    std::transform(excludedUnigrams.begin(), excludedUnigrams.end(),
-                   std::inserter(excludedValues, excludedValues.end()),
-                   [](const Formosa::Gramambular2::LanguageModel::Unigram& u) {
-                     return u.value();
-                   });
+  thread_local std::vector<size_t> order;
+  thread_local std::vector<bool> duplicate;
+  order.resize(size);
+  duplicate.assign(size, false);
+  for (size_t i = 0; i < size; ++i) {
+    order[i] = i;
+  }
+  // Ties are broken by the index, so that the first of the same values comes
+  // first. Unlike std::stable_sort(), std::sort() needs no buffer.
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    int result = unigrams[a].value().compare(unigrams[b].value());
+    return result < 0 || (result == 0 && a < b);
+  });
+  bool hasDuplicates = false;
+  for (size_t i = 1; i < size; ++i) {
+    if (unigrams[order[i]].value() == unigrams[order[i - 1]].value()) {
+      duplicate[order[i]] = true;
+      hasDuplicates = true;
+    }
+  }
+  if (!hasDuplicates) {
+    return;
   }
 
-  if (userPhrases_.hasUnigrams(key)) {
-    std::vector<Formosa::Gramambular2::LanguageModel::Unigram> rawUserUnigrams =
-        userPhrases_.getUnigrams(key);
-    userUnigrams = filterAndTransformUnigrams(rawUserUnigrams, excludedValues,
-                                              insertedValues);
+  size_t kept = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if (!duplicate[i]) {
+      if (kept != i) {
+        unigrams[kept] = std::move(unigrams[i]);
+      }
+      ++kept;
+    }
   }
+  unigrams.resize(kept);
+}
 
+std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
+McBopomofoLM::lookUpUnigrams(const std::string& key, bool& hasMacros) {
+  if (key == " ") {
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram> spaceUnigrams;
+    spaceUnigrams.emplace_back(" ", 0);
+    return spaceUnigrams;
+  }
+
+  // Readings the custom models do not change only need the conversions,
+  // which are done in the vector from the primary language model.
+  auto overlayIter = userOverlay_.find(key);
+  if (overlayIter == userOverlay_.end()) {
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram> allUnigrams =
+        languageModel_.getUnigrams(key);
+    filterAndTransformUnigrams(allUnigrams, 0, nullptr, hasMacros);
+    RemoveDuplicateValues(allUnigrams);
+    return allUnigrams;
+  }
+  const UserOverlayEntry& overlay = overlayIter->second;
+
+  // The user unigrams come first, so that a unigram from the primary language
+  // model with the same value is the one removed.
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> allUnigrams =
+      overlay.userUnigrams;
+  filterAndTransformUnigrams(allUnigrams, 0, &overlay, hasMacros);
+  RemoveDuplicateValues(allUnigrams);
+  const size_t userUnigramCount = allUnigrams.size();
   if (languageModel_.hasUnigrams(key)) {
-    std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-        rawGlobalUnigrams = languageModel_.getUnigrams(key);
-    allUnigrams = filterAndTransformUnigrams(rawGlobalUnigrams, excludedValues,
-                                             insertedValues);
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram> unigrams =
+        languageModel_.getUnigrams(key);
+    allUnigrams.reserve(userUnigramCount + unigrams.size());
+    std::move(unigrams.begin(), unigrams.end(),
+              std::back_inserter(allUnigrams));
+    filterAndTransformUnigrams(allUnigrams, userUnigramCount, &overlay,
+                               hasMacros);
+    RemoveDuplicateValues(allUnigrams);
   }
 
   // This relies on the fact that we always use the default separator.
@@ -179,9 +295,9 @@ McBopomofoLM::getUnigrams(const std::string& key) {
       std::string::npos;
 
   // If key is multi-syllabic (for example, ㄉㄨㄥˋ-ㄈㄢˋ), we just
-  // insert all collected userUnigrams on top of the unigrams fetched from
+  // keep all collected user unigrams on top of the unigrams fetched from
   // the database. If key is mono-syllabic (for example, ㄉㄨㄥˋ), then
-  // we'll have to rewrite the collected userUnigrams.
+  // we'll have to rewrite the collected user unigrams.
   //
   // This is because, by default, user unigrams have a score of 0, which
   // guarantees that grid walks will choose them. This is problematic,
@@ -192,27 +308,21 @@ McBopomofoLM::getUnigrams(const std::string& key) {
   // be able to compete with it. Without the rewrite, ㄉㄨㄥˋ-ㄗㄨㄛˋ
   // would always result in "丼" + "作" instead of "動作" because the
   // node for "丼" would dominate the walk.
-  if (isKeyMultiSyllable || allUnigrams.empty()) {
-    allUnigrams.insert(allUnigrams.begin(), userUnigrams.begin(),
-                       userUnigrams.end());
-  } else if (!userUnigrams.empty()) {
-    // Find the highest score from the existing allUnigrams.
+  if (!isKeyMultiSyllable && userUnigramCount > 0 &&
+      allUnigrams.size() > userUnigramCount) {
+    // Find the highest score from the unigrams of the database.
     double topScore = std::numeric_limits<double>::lowest();
-    for (const auto& unigram : allUnigrams) {
-      topScore = std::max(topScore, unigram.score());
+    for (size_t i = userUnigramCount; i < allUnigrams.size(); ++i) {
+      topScore = std::max(topScore, allUnigrams[i].score());
     }
 
     // Boost by a very small number. This is the score for user phrases.
     constexpr double epsilon = 0.000000001;
     double boostedScore = topScore + epsilon;
-
-    std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-        rewrittenUserUnigrams;
-    for (const auto& unigram : userUnigrams) {
-      rewrittenUserUnigrams.emplace_back(unigram.value(), boostedScore);
+    for (size_t i = 0; i < userUnigramCount; ++i) {
+      allUnigrams[i] = Formosa::Gramambular2::LanguageModel::Unigram(
+          allUnigrams[i].value(), boostedScore);
     }
-    allUnigrams.insert(allUnigrams.begin(), rewrittenUserUnigrams.begin(),
-                       rewrittenUserUnigrams.end());
   }
 
   return allUnigrams;
@@ -223,11 +333,15 @@ bool McBopomofoLM::hasUnigrams(const std::string& key) {
     return true;
   }
 
-  if (!excludedPhrases_.hasUnigrams(key)) {
-    return userPhrases_.hasUnigrams(key) || languageModel_.hasUnigrams(key);
+  auto overlayIter = userOverlay_.find(key);
+  if (overlayIter == userOverlay_.end()) {
+    return languageModel_.hasUnigrams(key);
   }
-
-  return !getUnigrams(key).empty();
+  const UserOverlayEntry& overlay = overlayIter->second;
+  if (overlay.fullyExcluded) {
+    return false;
+  }
+  return !overlay.userUnigrams.empty() || languageModel_.hasUnigrams(key);
 }
 
 std::string McBopomofoLM::getReading(const std::string& value) const {
@@ -251,6 +365,7 @@ std::vector<AssociatedPhrasesV2::Phrase> McBopomofoLM::findAssociatedPhrasesV2(
 }
 
 void McBopomofoLM::setPhraseReplacementEnabled(bool enabled) {
+  clearUnigramCache();
   phraseReplacementEnabled_ = enabled;
 }
 
@@ -259,6 +374,8 @@ bool McBopomofoLM::phraseReplacementEnabled() const {
 }
 
 void McBopomofoLM::setExternalConverterEnabled(bool enabled) {
+  clearUnigramCache();
+  clearExternalConversionCache();
   externalConverterEnabled_ = enabled;
 }
 
@@ -268,75 +385,346 @@ bool McBopomofoLM::externalConverterEnabled() const {
 
 void McBopomofoLM::setExternalConverter(
     std::function<std::string(const std::string&)> externalConverter) {
+  clearUnigramCache();
+  clearExternalConversionCache();
   externalConverter_ = std::move(externalConverter);
 }
 
+void McBopomofoLM::setExternalBatchConverter(
+    std::function<std::vector<std::string>(const std::vector<std::string>&)>
+        externalBatchConverter) {
+  clearUnigramCache();
+  clearExternalConversionCache();
+  externalBatchConverter_ = std::move(externalBatchConverter);
+}
+
+void McBopomofoLM::setExternalConversionCacheCapacity(size_t capacity) {
+  externalConversionCacheCapacity_ = capacity;
+  clearExternalConversionCache();
+}
+
+void McBopomofoLM::clearExternalConversionCache() {
+  for (auto& shard : externalConversionCache_) {
+    shard.clear();
+  }
+}
+
 void McBopomofoLM::setMacroConverter(
     std::function<std::string(const std::string&)> macroConverter) {
-  macroConverter_ = std::move(macroConverter);
+  if (macroConverter == nullptr) {
+    setMacroExpander(nullptr);
+    return;
+  }
+  setMacroExpander([macroConverter = std::move(macroConverter)](
+                       const std::string& input) {
+    return MacroExpansion{macroConverter(input)};
+  });
+}
+
+void McBopomofoLM::setMacroExpander(
+    std::function<MacroExpansion(const std::string&)> macroExpander) {
+  clearUnigramCache();
+  macroExpansions_.clear();
+  macroExpander_ = std::move(macroExpander);
 }
 
 std::string McBopomofoLM::convertMacro(const std::string& input) const {
-  if (macroConverter_ != nullptr) {
-    return macroConverter_(input);
+  return expandMacro(input);
+}
+
+std::string McBopomofoLM::expandMacro(const std::string& macro) const {
+  if (macroExpander_ == nullptr) {
+    return macro;
   }
-  return input;
+  std::time_t now = std::time(nullptr);
+  auto it = macroExpansions_.find(macro);
+  if (it != macroExpansions_.end() && now < it->second.expiry) {
+    return it->second.value;
+  }
+  MacroExpansion expansion = macroExpander_(macro);
+  if (now < expansion.expiry) {
+    macroExpansions_.insert_or_assign(macro, expansion);
+  }
+  return std::move(expansion.value);
 }
 
-std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-McBopomofoLM::filterAndTransformUnigrams(
-    const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>& unigrams,
-    const std::unordered_set<std::string>& excludedValues,
-    std::unordered_set<std::string>& insertedValues) const {
-  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> results;
-
-  for (auto&& unigram : unigrams) {
-    // excludedValues filters out the unigrams with the original value.
-    // insertedValues filters out the ones with the converted value
-    const std::string& rawValue = unigram.value();
-    if (excludedValues.find(rawValue) != excludedValues.end()) {
+void McBopomofoLM::setUnigramCacheCapacity(size_t capacity) {
+  unigramCacheCapacity_ = capacity;
+  clearUnigramCache();
+}
+
+double McBopomofoLM::UnigramCacheStats::hitRate() const {
+  uint64_t lookups = hits + misses;
+  return lookups == 0 ? 0 : static_cast<double>(hits) / lookups;
+}
+
+void McBopomofoLM::clearUnigramCache() {
+  if (unigramCacheList_.empty()) {
+    return;
+  }
+  unigramCacheMap_.clear();
+  unigramCacheList_.clear();
+  ++unigramCacheStats_.clears;
+}
+
+void McBopomofoLM::rebuildUserOverlay() {
+  clearUnigramCache();
+  userOverlay_.clear();
+
+  for (std::string_view key : excludedPhrases_.keys()) {
+    UserOverlayEntry& entry = userOverlay_[std::string(key)];
+    for (const auto& unigram : excludedPhrases_.getUnigrams(std::string(key))) {
+      entry.excludedValues.push_back(unigram.value());
+    }
+  }
+
+  for (std::string_view key : userPhrases_.keys()) {
+    userOverlay_[std::string(key)].userUnigrams =
+        userPhrases_.getUnigrams(std::string(key));
+  }
+
+  for (const auto& edit : userPhraseEdits_) {
+    applyUserPhraseEdit(edit);
+  }
+
+  for (auto& [key, entry] : userOverlay_) {
+    if (!entry.excludedValues.empty()) {
+      updateFullyExcluded(key, entry);
+    }
+  }
+
+  std::vector<std::string_view> replacedValues = phraseReplacement_.keys();
+  if (replacedValues.empty()) {
+    return;
+  }
+  auto addReplacement = [this](UserOverlayEntry& entry,
+                               const std::string& value) {
+    for (const auto& replacement : entry.replacements) {
+      if (replacement.first == value) {
+        return;
+      }
+    }
+    entry.replacements.emplace_back(value,
+                                    phraseReplacement_.valueForKey(value));
+  };
+  for (auto& [key, entry] : userOverlay_) {
+    for (const auto& unigram : entry.userUnigrams) {
+      if (!phraseReplacement_.valueForKey(unigram.value()).empty()) {
+        addReplacement(entry, unigram.value());
+      }
+    }
+  }
+  std::unordered_set<std::string_view> values(replacedValues.begin(),
+                                              replacedValues.end());
+  for (const auto& [key, value] : languageModel_.getReadingsOfValues(values)) {
+    addReplacement(userOverlay_[key], value);
+  }
+}
+
+void McBopomofoLM::addUserPhrase(const std::string& reading,
+                                 const std::string& value) {
+  userPhraseEdits_.push_back(UserPhraseEdit{reading, value, /*added=*/true});
+  UserOverlayEntry& entry = applyUserPhraseEdit(userPhraseEdits_.back());
+  if (!phraseReplacement_.valueForKey(value).empty() &&
+      std::none_of(entry.replacements.begin(), entry.replacements.end(),
+                   [&value](const auto& r) { return r.first == value; })) {
+    entry.replacements.emplace_back(value,
+                                    phraseReplacement_.valueForKey(value));
+  }
+  updateFullyExcluded(reading, entry);
+  eraseUnigramCacheEntry(reading);
+}
+
+void McBopomofoLM::removeUserPhrase(const std::string& reading,
+                                    const std::string& value) {
+  userPhraseEdits_.push_back(UserPhraseEdit{reading, value, /*added=*/false});
+  UserOverlayEntry& entry = applyUserPhraseEdit(userPhraseEdits_.back());
+  updateFullyExcluded(reading, entry);
+  eraseUnigramCacheEntry(reading);
+}
+
+McBopomofoLM::UserOverlayEntry& McBopomofoLM::applyUserPhraseEdit(
+    const UserPhraseEdit& edit) {
+  UserOverlayEntry& entry = userOverlay_[edit.reading];
+  auto& excluded = entry.excludedValues;
+  auto& unigrams = entry.userUnigrams;
+  auto excludedIter = std::find(excluded.begin(), excluded.end(), edit.value);
+  auto unigramIter =
+      std::find_if(unigrams.begin(), unigrams.end(), [&edit](const auto& u) {
+        return u.value() == edit.value;
+      });
+  if (edit.added) {
+    if (excludedIter != excluded.end()) {
+      excluded.erase(excludedIter);
+    }
+    if (unigramIter == unigrams.end()) {
+      unigrams.emplace_back(edit.value, UserPhrasesLM::kUserUnigramScore);
+    }
+  } else {
+    if (unigramIter != unigrams.end()) {
+      unigrams.erase(unigramIter);
+    }
+    if (excludedIter == excluded.end()) {
+      excluded.push_back(edit.value);
+    }
+  }
+  return entry;
+}
+
+void McBopomofoLM::eraseUnigramCacheEntry(const std::string& key) {
+  auto mapIter = unigramCacheMap_.find(key);
+  if (mapIter == unigramCacheMap_.end()) {
+    return;
+  }
+  auto listIter = mapIter->second;
+  unigramCacheMap_.erase(mapIter);
+  unigramCacheList_.erase(listIter);
+}
+
+void McBopomofoLM::updateFullyExcluded(const std::string& key,
+                                       UserOverlayEntry& entry) {
+  auto isExcluded = [&entry](const auto& unigram) {
+    return std::find(entry.excludedValues.begin(), entry.excludedValues.end(),
+                     unigram.value()) != entry.excludedValues.end();
+  };
+  entry.fullyExcluded =
+      std::all_of(entry.userUnigrams.begin(), entry.userUnigrams.end(),
+                  isExcluded);
+  if (entry.fullyExcluded && languageModel_.hasUnigrams(key)) {
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram> unigrams =
+        languageModel_.getUnigrams(key);
+    entry.fullyExcluded =
+        std::all_of(unigrams.begin(), unigrams.end(), isExcluded);
+  }
+}
+
+void McBopomofoLM::filterAndTransformUnigrams(
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram>& unigrams,
+    size_t begin, const UserOverlayEntry* overlay, bool& hasMacros) const {
+  size_t kept = begin;
+  for (size_t i = begin; i < unigrams.size(); ++i) {
+    // The excluded values filter out the unigrams with the original value.
+    const std::string& rawValue = unigrams[i].value();
+    const double score = unigrams[i].score();
+    if (overlay != nullptr &&
+        std::find(overlay->excludedValues.begin(),
+                  overlay->excludedValues.end(),
+                  rawValue) != overlay->excludedValues.end()) {
       continue;
     }
 
+    // Both strings are copied before the unigram is overwritten below.
     std::string value = rawValue;
-    if (phraseReplacementEnabled_) {
-      std::string replacement = phraseReplacement_.valueForKey(value);
-      if (!replacement.empty()) {
+    std::string originalValue = rawValue;
+    if (phraseReplacementEnabled_ && overlay != nullptr) {
+      for (const auto& [replacedValue, replacement] : overlay->replacements) {
+        if (replacedValue == value) {
+          if (!replacement.empty()) {
+            value = replacement;
+          }
+          break;
+        }
+      }
+    }
+
+    // Only the values with the macro prefix are expanded, which spares every
+    // other candidate a call and a copy.
+    if (IsMacro(value)) {
+      if (macroExpander_ != nullptr) {
+        std::string replacement = expandMacro(value);
         if (value != replacement) {
-          value = replacement;
+          value = std::move(replacement);
+          hasMacros = true;
         }
       }
+
+      // Check if the string is an unsupported macro
+      if (score == kMacroScore && IsMacro(value)) {
+        continue;
+      }
     }
-    if (macroConverter_ != nullptr) {
-      std::string replacement = macroConverter_(value);
-      if (value != replacement) {
-        value = replacement;
+
+    unigrams[kept++] = Formosa::Gramambular2::LanguageModel::Unigram(
+        std::move(value), score, std::move(originalValue));
+  }
+  unigrams.resize(kept);
+  convertExternally(unigrams, begin);
+}
+
+void McBopomofoLM::convertExternally(
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram>& unigrams,
+    size_t begin) const {
+  if (!externalConverterEnabled_ ||
+      (externalConverter_ == nullptr && externalBatchConverter_ == nullptr)) {
+    return;
+  }
+
+  auto replaceValue = [&unigrams](size_t i, const std::string& replacement) {
+    if (unigrams[i].value() != replacement) {
+      unigrams[i] = Formosa::Gramambular2::LanguageModel::Unigram(
+          replacement, unigrams[i].score(), unigrams[i].rawValue());
+    }
+  };
+
+  // The values that are not cached are converted together below.
+  thread_local std::vector<size_t> misses;
+  thread_local std::vector<std::string> missedValues;
+  misses.clear();
+  missedValues.clear();
+  const size_t shardCapacity =
+      std::max<size_t>(1, externalConversionCacheCapacity_ /
+                              kExternalConversionCacheShards);
+  auto shardOf = [this](const std::string& value)
+      -> std::unordered_map<std::string, std::string>& {
+    return externalConversionCache_[std::hash<std::string>()(value) %
+                                    kExternalConversionCacheShards];
+  };
+  for (size_t i = begin; i < unigrams.size(); ++i) {
+    if (externalConversionCacheCapacity_ > 0) {
+      const auto& shard = shardOf(unigrams[i].value());
+      auto it = shard.find(unigrams[i].value());
+      if (it != shard.end()) {
+        replaceValue(i, it->second);
+        continue;
       }
     }
+    misses.push_back(i);
+    missedValues.push_back(unigrams[i].value());
+  }
+  if (misses.empty()) {
+    return;
+  }
 
-    // Check if the string is an unsupported macro
-    if (unigram.score() == kMacroScore && value.size() > kMacroPrefix.size() &&
-        value.compare(0, kMacroPrefix.size(), kMacroPrefix) == 0) {
-      continue;
+  std::vector<std::string> converted;
+  if (externalBatchConverter_ != nullptr) {
+    converted = externalBatchConverter_(missedValues);
+    if (converted.size() != missedValues.size()) {
+      return;
     }
+  } else {
+    converted.reserve(missedValues.size());
+    for (const auto& value : missedValues) {
+      converted.push_back(externalConverter_(value));
+    }
+  }
 
-    if (externalConverterEnabled_ && externalConverter_ != nullptr) {
-      std::string replacement = externalConverter_(value);
-      if (value != replacement) {
-        value = replacement;
+  for (size_t j = 0; j < misses.size(); ++j) {
+    if (externalConversionCacheCapacity_ > 0) {
+      auto& shard = shardOf(missedValues[j]);
+      if (shard.size() >= shardCapacity) {
+        shard.clear();
       }
+      shard.emplace(std::move(missedValues[j]), converted[j]);
     }
-    if (insertedValues.find(value) == insertedValues.end()) {
-      results.emplace_back(value, unigram.score(), rawValue);
-      insertedValues.insert(value);
-    }
+    replaceValue(misses[j], converted[j]);
   }
-  return results;
 }
 
 void McBopomofoLM::loadLanguageModel(std::unique_ptr<ParselessPhraseDB> db) {
+  clearUnigramCache();
   languageModel_.close();
   languageModel_.open(std::move(db));
+  rebuildUserOverlay();
 }
 
 void McBopomofoLM::loadAssociatedPhrasesV2(
@@ -346,18 +734,26 @@ void McBopomofoLM::loadAssociatedPhrasesV2(
 }
 
 void McBopomofoLM::loadUserPhrases(const char* data, size_t length) {
+  clearUnigramCache();
   userPhrases_.close();
   userPhrases_.load(data, length);
+  userPhraseEdits_.clear();
+  rebuildUserOverlay();
 }
 
 void McBopomofoLM::loadExcludedPhrases(const char* data, size_t length) {
+  clearUnigramCache();
   excludedPhrases_.close();
   excludedPhrases_.load(data, length);
+  userPhraseEdits_.clear();
+  rebuildUserOverlay();
 }
 
 void McBopomofoLM::loadPhraseReplacementMap(const char* data, size_t length) {
+  clearUnigramCache();
   phraseReplacement_.close();
   phraseReplacement_.load(data, length);
+  rebuildUserOverlay();
 }
 
 }  // namespace McBopomofo
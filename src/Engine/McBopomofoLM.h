@@ -24,12 +24,17 @@
 #ifndef SRC_ENGINE_MCBOPOMOFOLM_H_
 #define SRC_ENGINE_MCBOPOMOFOLM_H_
 
+#include <array>
+#include <ctime>
 #include <filesystem>
 #include <functional>
+#include <list>
 #include <memory>
 #include <optional>
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "AssociatedPhrasesV2.h"
@@ -51,12 +56,31 @@ namespace McBopomofo {
 // 2. Drop the unigrams from the user-exclusion list.
 // 3. Replace the unigram values specified by the user phrase replacement map.
 // 4. Transform the unigram values with an external converter, if supplied.
+//    The converted values are cached, since the converter may be costly.
 // 5. Remove any duplicates.
 //
 // McBopomofoLM itself is not responsible for reloading custom models (user
 // phrases, excluded phrases, and replacement map). The LM's owner, usually the
 // input method controller, needs to take care of checking for updates and
 // telling McBopomofoLM to reload as needed.
+//
+// What the custom models change for each reading is merged into an overlay
+// whenever a model is loaded. Only the readings in the overlay go through
+// steps 2 and 3; all other readings, which are nearly all of them, go straight
+// to the primary language model.
+//
+// The results of the process are kept in a small LRU cache, since the same
+// readings are looked up again and again when the same sentences are typed.
+// The cache is cleared whenever a model is loaded or a setting that changes
+// the results is changed. Results that contain macros are never cached, since
+// macros such as the date of today change by themselves. Instead, the value of
+// each macro is cached on its own until it expires; see setMacroExpander().
+//
+// McBopomofoLM is not thread-safe while the cache is enabled, which it is by
+// default: getUnigrams() updates the cache, even though it only looks things
+// up. An LM that is shared by several threads must disable the cache with
+// setUnigramCacheCapacity(0) before the threads start, and must not have a
+// macro expander.
 class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
  public:
   McBopomofoLM() = default;
@@ -76,6 +100,15 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
 
   bool isAssociatedPhrasesV2Loaded() const;
 
+  // Adds a user phrase in memory, as if it were in the user phrases and not
+  // in the excluded phrases, until the user phrases are loaded again. Only the
+  // entry of the reading is updated, and no file is reparsed; the owner of the
+  // LM is responsible for writing the change to the files.
+  void addUserPhrase(const std::string& reading, const std::string& value);
+
+  // The opposite of addUserPhrase(): excludes a phrase in memory.
+  void removeUserPhrase(const std::string& reading, const std::string& value);
+
   // Loads (or reloads if already loaded) both the user phrases and the excluded
   // phrases files. If one argument is passed a nullptr, that file will not
   // be loaded or reloaded.
@@ -106,10 +139,63 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
   void setExternalConverter(
       std::function<std::string(const std::string&)> externalConverter);
 
+  // Sets a converter that converts all the values of a lookup that are not
+  // cached in one call. It is used instead of the external converter when
+  // set, and must return as many values as it is given, in the same order.
+  void setExternalBatchConverter(
+      std::function<std::vector<std::string>(const std::vector<std::string>&)>
+          externalBatchConverter);
+
+  static constexpr size_t kDefaultExternalConversionCacheCapacity = 8192;
+
+  // Sets the maximum number of values whose external conversions are cached.
+  // 0 disables the cache.
+  void setExternalConversionCacheCapacity(size_t capacity);
+
+  // The value of a macro, and the time until which it stays the same. The
+  // default expiry is in the past, which keeps the value from being cached.
+  struct MacroExpansion {
+    std::string value;
+    std::time_t expiry = 0;
+  };
+
+  // Sets the converter of the macros. It is only called for the values with
+  // the MACRO@ prefix. Its values are never cached, since the LM cannot tell
+  // how long they last.
   void setMacroConverter(
       std::function<std::string(const std::string&)> macroConverter);
+
+  // Sets a converter of the macros that also tells until when each value
+  // stays the same. The LM keeps each value until then, so a reading with many
+  // macros, which is looked up on every key, mostly skips the expander.
+  void setMacroExpander(
+      std::function<MacroExpansion(const std::string&)> macroExpander);
+
   std::string convertMacro(const std::string& input) const;
 
+  static constexpr size_t kDefaultUnigramCacheCapacity = 2048;
+
+  // Sets the maximum number of readings whose unigrams are cached. 0 disables
+  // the cache, which an LM shared by several threads must do.
+  void setUnigramCacheCapacity(size_t capacity);
+
+  struct UnigramCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t clears = 0;
+
+    // The share of getUnigrams() calls answered from the cache, or 0 if there
+    // were no calls.
+    double hitRate() const;
+  };
+
+  const UnigramCacheStats& unigramCacheStats() const {
+    return unigramCacheStats_;
+  }
+
+  void resetUnigramCacheStats() { unigramCacheStats_ = UnigramCacheStats(); }
+
   // Methods to allow loading in-memory data for testing purposes.
   void loadLanguageModel(std::unique_ptr<ParselessPhraseDB> db);
   void loadAssociatedPhrasesV2(std::unique_ptr<ParselessPhraseDB> db);
@@ -144,15 +230,70 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
   std::vector<UserFileIssue> getUserFileIssues() const;
 
  protected:
-  // Filters and converts the input unigrams and returns a new list of unigrams.
-  // Unigrams whose values are found in `excludedValues` are removed, and the
-  // kept values will be inserted to the `insertedValues` set.
-  std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-  filterAndTransformUnigrams(
-      const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>&
-          unigrams,
-      const std::unordered_set<std::string>& excludedValues,
-      std::unordered_set<std::string>& insertedValues) const;
+  // Expands a macro, from the cache if its value has not expired yet.
+  std::string expandMacro(const std::string& macro) const;
+
+  // Looks up the unigrams without the cache. hasMacros is set to whether any
+  // value is expanded as a macro.
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> lookUpUnigrams(
+      const std::string& key, bool& hasMacros);
+
+  void clearUnigramCache();
+
+  // What the user phrases, the excluded phrases and the phrase replacement
+  // map change for a reading.
+  struct UserOverlayEntry {
+    std::vector<std::string> excludedValues;
+    // The user phrases, before they are converted.
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram> userUnigrams;
+    // The replacements of the values of the reading, from the user phrases or
+    // the primary language model, as (value, replacement) pairs.
+    std::vector<std::pair<std::string, std::string>> replacements;
+    // Whether every value of the reading, from the user phrases or the
+    // primary language model, is excluded, so that hasUnigrams() can answer
+    // without looking up the unigrams.
+    bool fullyExcluded = false;
+  };
+
+  // Converts the values of the unigrams from the index `begin` onwards with
+  // the external converters, through the conversion cache.
+  void convertExternally(
+      std::vector<Formosa::Gramambular2::LanguageModel::Unigram>& unigrams,
+      size_t begin) const;
+
+  void clearExternalConversionCache();
+
+  // Rebuilds the overlay from the loaded models.
+  void rebuildUserOverlay();
+
+  // A phrase added or removed by addUserPhrase() or removeUserPhrase(). The
+  // edits are kept until the user phrases are loaded again, so that they
+  // survive when the overlay is rebuilt for another model.
+  struct UserPhraseEdit {
+    std::string reading;
+    std::string value;
+    bool added;
+  };
+
+  // Applies the edit to the user unigrams and the excluded values of the
+  // overlay entry of the reading, and returns the entry.
+  UserOverlayEntry& applyUserPhraseEdit(const UserPhraseEdit& edit);
+
+  void eraseUnigramCacheEntry(const std::string& key);
+
+  // Sets whether every value of the reading of the entry is excluded.
+  void updateFullyExcluded(const std::string& key, UserOverlayEntry& entry);
+
+  // Filters and converts the unigrams from the index `begin` onwards, in
+  // place, so that a lookup does not need a second vector. Unigrams whose
+  // values are excluded by the overlay entry are removed, and the values are
+  // replaced as the entry says if phrase replacement is enabled. The entry may
+  // be nullptr for a reading not in the overlay. `hasMacros` is set if any
+  // value is expanded as a macro. Values may be duplicated; see
+  // RemoveDuplicateValues().
+  void filterAndTransformUnigrams(
+      std::vector<Formosa::Gramambular2::LanguageModel::Unigram>& unigrams,
+      size_t begin, const UserOverlayEntry* overlay, bool& hasMacros) const;
 
   ParselessLM languageModel_;
   UserPhrasesLM userPhrases_;
@@ -168,8 +309,36 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
 
   bool externalConverterEnabled_ = false;
   std::function<std::string(const std::string&)> externalConverter_;
-
-  std::function<std::string(const std::string&)> macroConverter_;
+  std::function<std::vector<std::string>(const std::vector<std::string>&)>
+      externalBatchConverter_;
+
+  // The external conversions of the values, in shards picked by the hash of
+  // the value. A shard that is full is emptied, which bounds the memory
+  // without the bookkeeping of an LRU list and only drops a part of the cache
+  // at a time.
+  static constexpr size_t kExternalConversionCacheShards = 16;
+  size_t externalConversionCacheCapacity_ =
+      kDefaultExternalConversionCacheCapacity;
+  mutable std::array<std::unordered_map<std::string, std::string>,
+                     kExternalConversionCacheShards>
+      externalConversionCache_;
+
+  std::function<MacroExpansion(const std::string&)> macroExpander_;
+  mutable std::unordered_map<std::string, MacroExpansion> macroExpansions_;
+
+  std::unordered_map<std::string, UserOverlayEntry> userOverlay_;
+  std::vector<UserPhraseEdit> userPhraseEdits_;
+
+  // The most recently used entry is at the front of the list. The keys of the
+  // map are views of the readings in the list.
+  using UnigramCacheEntry =
+      std::pair<std::string,
+                std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>;
+  size_t unigramCacheCapacity_ = kDefaultUnigramCacheCapacity;
+  std::list<UnigramCacheEntry> unigramCacheList_;
+  std::unordered_map<std::string_view, std::list<UnigramCacheEntry>::iterator>
+      unigramCacheMap_;
+  UnigramCacheStats unigramCacheStats_;
 };
 
 }  // namespace McBopomofo
@@ -0,0 +1,108 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+
+#include "McBopomofoLM.h"
+#include "gtest/gtest.h"
+
+// Count every heap allocation, so that the tests can check the allocations of
+// the lookups on the typing path. This replaces the global operator new of the
+// whole binary, which is why these tests have a test executable of their own.
+static std::atomic<size_t> gAllocationCount{0};
+
+void* operator new(size_t size) {
+  gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+namespace McBopomofo {
+
+constexpr char kPrimaryLMData[] = R"(
+# format org.openvanilla.mcbopomofo.sorted
+ㄇㄧㄥˊ 明 -3.07936356
+ㄇㄧㄥˊ 名 -3.12166252
+ㄇㄧㄥˊ 銘 -4.43019121
+ㄉㄨㄥˋ-ㄗㄨㄛˋ 動作 -4.17449149
+ㄔㄥˊ-ㄕˋ 城市 -3.98856498
+ㄔㄥˊ-ㄕˋ 程式 -4.07624939
+ㄔㄥˊ-ㄕˋ 成事 -5.88664994
+)";
+
+constexpr char kUserPhrasesData[] = R"(
+茗 ㄇㄧㄥˊ
+程式 ㄔㄥˊ-ㄕˋ
+)";
+
+template <typename F>
+static size_t CountAllocations(F&& f) {
+  size_t allocationsAtStart = gAllocationCount.load();
+  f();
+  return gAllocationCount.load() - allocationsAtStart;
+}
+
+TEST(McBopomofoLMAllocationTest, LookupsMakeFewAllocations) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  lm.setUnigramCacheCapacity(0);
+
+  // The keys are made up front, since the longer ones need allocations too.
+  const std::string kFastPathKey = "ㄉㄨㄥˋ-ㄗㄨㄛˋ";
+  const std::string kUserPhraseKey = "ㄇㄧㄥˊ";
+  const std::string kCachedKey = "ㄔㄥˊ-ㄕˋ";
+
+  // Warm up the buffers that the thread reuses.
+  lm.getUnigrams(kFastPathKey);
+  lm.getUnigrams(kUserPhraseKey);
+
+  // The values are short enough for std::string to keep them inline, so the
+  // returned vector is the only allocation.
+  EXPECT_EQ(CountAllocations([&] { lm.getUnigrams(kFastPathKey); }), 1);
+  EXPECT_EQ(CountAllocations([&] { lm.hasUnigrams(kFastPathKey); }), 0);
+
+  // A reading with user phrases copies the user unigrams, and then makes room
+  // for the ones from the primary language model.
+  EXPECT_LE(CountAllocations([&] { lm.getUnigrams(kUserPhraseKey); }), 3);
+
+  // A cache hit copies the cached vector.
+  lm.setUnigramCacheCapacity(16);
+  lm.getUnigrams(kCachedKey);
+  EXPECT_EQ(CountAllocations([&] { lm.getUnigrams(kCachedKey); }), 1);
+}
+
+}  // namespace McBopomofo
@@ -22,9 +22,11 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 #include <cmath>
+#include <ctime>
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "McBopomofoLM.h"
 #include "gtest/gtest.h"
@@ -128,6 +130,128 @@ TEST(McBopomofoLMTest, ExcludedPhrases) {
   EXPECT_TRUE(unigrams.empty());
 }
 
+TEST(McBopomofoLMTest, HasUnigramsForFullyExcludedKeys) {
+  McBopomofoLM lm;
+  // The excluded phrases are loaded first, as the answers depend on the
+  // primary language model loaded after them.
+  lm.loadExcludedPhrases(kExcludedPhrasesData, sizeof(kExcludedPhrasesData));
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  EXPECT_FALSE(lm.hasUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ"));
+  EXPECT_TRUE(lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ").empty());
+
+  // A user phrase with the excluded value does not count.
+  constexpr char kExcludedUserPhrase[] = "動作 ㄉㄨㄥˋ-ㄗㄨㄛˋ\n";
+  lm.loadUserPhrases(kExcludedUserPhrase, sizeof(kExcludedUserPhrase));
+  EXPECT_FALSE(lm.hasUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ"));
+
+  constexpr char kUserPhrase[] = "洞作 ㄉㄨㄥˋ-ㄗㄨㄛˋ\n";
+  lm.loadUserPhrases(kUserPhrase, sizeof(kUserPhrase));
+  EXPECT_TRUE(lm.hasUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ"));
+  EXPECT_FALSE(lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ").empty());
+}
+
+TEST(McBopomofoLMTest, HasUnigramsForPartiallyExcludedKeys) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+
+  constexpr char kSomeExcluded[] = "明 ㄇㄧㄥˊ\n名 ㄇㄧㄥˊ\n";
+  lm.loadExcludedPhrases(kSomeExcluded, sizeof(kSomeExcluded));
+  EXPECT_TRUE(lm.hasUnigrams("ㄇㄧㄥˊ"));
+  auto unigrams = lm.getUnigrams("ㄇㄧㄥˊ");
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].value(), "銘");
+
+  constexpr char kAllExcluded[] = "明 ㄇㄧㄥˊ\n名 ㄇㄧㄥˊ\n銘 ㄇㄧㄥˊ\n";
+  lm.loadExcludedPhrases(kAllExcluded, sizeof(kAllExcluded));
+  EXPECT_FALSE(lm.hasUnigrams("ㄇㄧㄥˊ"));
+  EXPECT_TRUE(lm.getUnigrams("ㄇㄧㄥˊ").empty());
+
+  // A user phrase brings the reading back.
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  EXPECT_TRUE(lm.hasUnigrams("ㄇㄧㄥˊ"));
+  unigrams = lm.getUnigrams("ㄇㄧㄥˊ");
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].value(), "茗");
+
+  // Other readings are not affected.
+  EXPECT_TRUE(lm.hasUnigrams("ㄇㄧㄥˊ-ㄘˊ"));
+}
+
+TEST(McBopomofoLMTest, AddAndRemoveUserPhrases) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  lm.loadExcludedPhrases(kExcludedPhrasesData, sizeof(kExcludedPhrasesData));
+  lm.resetUnigramCacheStats();
+
+  // Fill the cache, so that the edits must not be hidden by it.
+  EXPECT_EQ(lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ").size(), 0);
+  EXPECT_FALSE(lm.hasUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ"));
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "茗");
+
+  lm.addUserPhrase("ㄉㄨㄥˋ-ㄗㄨㄛˋ", "動作");
+  EXPECT_TRUE(lm.hasUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ"));
+  auto unigrams = lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ");
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].value(), "動作");
+  EXPECT_EQ(unigrams[0].score(), UserPhrasesLM::kUserUnigramScore);
+
+  lm.removeUserPhrase("ㄇㄧㄥˊ", "茗");
+  unigrams = lm.getUnigrams("ㄇㄧㄥˊ");
+  ASSERT_FALSE(unigrams.empty());
+  EXPECT_EQ(unigrams[0].value(), "明");
+
+  // Removing a phrase of the primary language model excludes it.
+  lm.removeUserPhrase("ㄇㄧㄥˊ", "明");
+  unigrams = lm.getUnigrams("ㄇㄧㄥˊ");
+  ASSERT_FALSE(unigrams.empty());
+  EXPECT_EQ(unigrams[0].value(), "名");
+
+  // Only the edited readings are dropped from the cache.
+  EXPECT_EQ(lm.unigramCacheStats().clears, 0);
+  lm.resetUnigramCacheStats();
+  lm.getUnigrams("ㄔㄥˊ-ㄕˋ");
+  EXPECT_EQ(lm.unigramCacheStats().misses, 1);
+}
+
+TEST(McBopomofoLMTest, UserPhraseEditsLastUntilUserPhrasesReload) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  lm.addUserPhrase("ㄉㄨㄥˋ", "凍");
+  lm.removeUserPhrase("ㄔㄥˊ-ㄕˋ", "程式");
+
+  // Rebuilding the overlay for another file keeps the edits.
+  lm.loadPhraseReplacementMap(kPhreaseReplacementMapData,
+                              sizeof(kPhreaseReplacementMapData));
+  auto unigrams = lm.getUnigrams("ㄉㄨㄥˋ");
+  ASSERT_GE(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[0].value(), "丼");
+  EXPECT_EQ(unigrams[1].value(), "凍");
+  unigrams = lm.getUnigrams("ㄔㄥˊ-ㄕˋ");
+  ASSERT_FALSE(unigrams.empty());
+  EXPECT_EQ(unigrams[0].value(), "城市");
+
+  // Reloading the user phrases drops the edits, which by then are expected to
+  // have been written to the files.
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  unigrams = lm.getUnigrams("ㄉㄨㄥˋ");
+  ASSERT_FALSE(unigrams.empty());
+  EXPECT_EQ(unigrams[0].value(), "丼");
+  EXPECT_NE(unigrams[1].value(), "凍");
+  unigrams = lm.getUnigrams("ㄔㄥˊ-ㄕˋ");
+  ASSERT_FALSE(unigrams.empty());
+  EXPECT_EQ(unigrams[0].value(), "程式");
+}
+
 TEST(McBopomofoLMTest, PhraseReplacementMap) {
   McBopomofoLM lm;
   auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
@@ -256,6 +380,147 @@ TEST(McBopomofoLMTest, ExternalConverterConversionResultsAreDeduplicated) {
   EXPECT_EQ(unigrams[0].value(), "!");
 }
 
+TEST(McBopomofoLMTest, ExternalConversionsAreCached) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.setUnigramCacheCapacity(0);
+
+  std::vector<std::string> inputs;
+  lm.setExternalConverterEnabled(true);
+  lm.setExternalConverter([&inputs](const std::string& value) {
+    inputs.push_back(value);
+    return value == "動" ? "动" : value;
+  });
+
+  auto unigrams = lm.getUnigrams("ㄉㄨㄥˋ");
+  ASSERT_EQ(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[0].value(), "动");
+  EXPECT_EQ(unigrams[0].rawValue(), "動");
+  EXPECT_EQ(inputs.size(), 2);
+
+  unigrams = lm.getUnigrams("ㄉㄨㄥˋ");
+  EXPECT_EQ(unigrams[0].value(), "动");
+  EXPECT_EQ(inputs.size(), 2);
+
+  // Replacing the converter clears the cache.
+  lm.setExternalConverter([&inputs](const std::string& value) {
+    inputs.push_back(value);
+    return value;
+  });
+  unigrams = lm.getUnigrams("ㄉㄨㄥˋ");
+  EXPECT_EQ(unigrams[0].value(), "動");
+  EXPECT_EQ(inputs.size(), 4);
+}
+
+TEST(McBopomofoLMTest, ExternalBatchConverterConvertsMissesInOneCall) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.setUnigramCacheCapacity(0);
+
+  std::vector<std::vector<std::string>> batches;
+  lm.setExternalConverterEnabled(true);
+  lm.setExternalBatchConverter(
+      [&batches](const std::vector<std::string>& values) {
+        batches.push_back(values);
+        std::vector<std::string> results;
+        for (const auto& value : values) {
+          results.push_back(value == "城市" ? "城巿" : value);
+        }
+        return results;
+      });
+
+  auto unigrams = lm.getUnigrams("ㄔㄥˊ-ㄕˋ");
+  ASSERT_EQ(unigrams.size(), 3);
+  EXPECT_EQ(unigrams[0].value(), "城巿");
+  ASSERT_EQ(batches.size(), 1);
+  std::vector<std::string> expected = {"城市", "程式", "成事"};
+  EXPECT_EQ(batches[0], expected);
+
+  // Nothing is left to convert for the same reading.
+  lm.getUnigrams("ㄔㄥˊ-ㄕˋ");
+  EXPECT_EQ(batches.size(), 1);
+}
+
+TEST(McBopomofoLMTest, LongListsAreDeduplicatedInOrder) {
+  constexpr char kData[] = R"(
+# format org.openvanilla.mcbopomofo.sorted
+ㄧˋ 一 -1
+ㄧˋ 乙 -2
+ㄧˋ 亦 -3
+ㄧˋ 伊 -4
+ㄧˋ 衣 -5
+ㄧˋ 依 -6
+ㄧˋ 醫 -7
+ㄧˋ 意 -8
+ㄧˋ 義 -9
+ㄧˋ 易 -10
+)";
+  McBopomofoLM lm;
+  lm.loadLanguageModel(
+      std::make_unique<ParselessPhraseDB>(kData, sizeof(kData)));
+  ASSERT_EQ(lm.getUnigrams("ㄧˋ").size(), 10);
+
+  lm.setExternalConverterEnabled(true);
+  lm.setExternalConverter([](const std::string& value) {
+    return value == "一" || value == "意" ? "1" : value == "亦" ? "3" : value;
+  });
+  auto unigrams = lm.getUnigrams("ㄧˋ");
+  std::vector<std::string> values;
+  for (const auto& unigram : unigrams) {
+    values.push_back(unigram.value());
+  }
+  EXPECT_EQ(values, (std::vector<std::string>{"1", "乙", "3", "伊", "衣", "依",
+                                              "醫", "義", "易"}));
+  EXPECT_EQ(unigrams[0].rawValue(), "一");
+}
+
+TEST(McBopomofoLMTest, UserFilesApplyInAnyLoadOrder) {
+  constexpr char kReplacementData[] = R"(
+茗 茶
+動作 动作
+)";
+  McBopomofoLM lm;
+  lm.setPhraseReplacementEnabled(true);
+  lm.loadPhraseReplacementMap(kReplacementData, sizeof(kReplacementData));
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  lm.loadLanguageModel(std::make_unique<ParselessPhraseDB>(
+      kPrimaryLMData, sizeof(kPrimaryLMData)));
+
+  // Only the primary language model has the replaced value.
+  auto unigrams = lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ");
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].value(), "动作");
+  EXPECT_EQ(unigrams[0].rawValue(), "動作");
+
+  // A replaced user phrase.
+  unigrams = lm.getUnigrams("ㄇㄧㄥˊ");
+  ASSERT_FALSE(unigrams.empty());
+  EXPECT_EQ(unigrams[0].value(), "茶");
+
+  // A reading that no user file changes.
+  unigrams = lm.getUnigrams("ㄙㄜˋ-ㄍㄨˇ");
+  ASSERT_EQ(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[0].value(), "澀谷");
+
+  // Excluding the replaced value.
+  lm.loadExcludedPhrases(kExcludedPhrasesData, sizeof(kExcludedPhrasesData));
+  EXPECT_TRUE(lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ").empty());
+  EXPECT_FALSE(lm.hasUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ"));
+  lm.loadExcludedPhrases(nullptr, 0);
+
+  // Unloading the map, then reloading the primary language model.
+  lm.loadPhraseReplacementMap(nullptr);
+  lm.loadLanguageModel(std::make_unique<ParselessPhraseDB>(
+      kPrimaryLMData, sizeof(kPrimaryLMData)));
+  unigrams = lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ");
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].value(), "動作");
+}
+
 TEST(McBopomofoLMTest, DefaultMacroConverterIsNoOp) {
   McBopomofoLM lm;
   auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
@@ -285,4 +550,151 @@ TEST(McBopomofoLMTest, MacroValueNotRecognizedByMacroConverterIsFiltered) {
   EXPECT_EQ(unigrams[1].value(), "6/10/21");
 }
 
+TEST(McBopomofoLMTest, MacroConverterOnlySeesMacros) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+
+  std::vector<std::string> inputs;
+  lm.setMacroConverter([&inputs](const std::string& macro) {
+    inputs.push_back(macro);
+    return macro;
+  });
+
+  lm.getUnigrams("ㄇㄧㄥˊ");
+  lm.getUnigrams("ㄔㄥˊ-ㄕˋ");
+  EXPECT_TRUE(inputs.empty());
+
+  lm.getUnigrams("ㄐㄧㄣ-ㄊㄧㄢ");
+  std::vector<std::string> expected = {"MACRO@DATE_TODAY_SHORT",
+                                       "MACRO@DATE_TODAY_MEDIUM"};
+  EXPECT_EQ(inputs, expected);
+}
+
+TEST(McBopomofoLMTest, UnigramCache) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.resetUnigramCacheStats();
+
+  auto unigrams = lm.getUnigrams("ㄔㄥˊ-ㄕˋ");
+  ASSERT_FALSE(unigrams.empty());
+  EXPECT_EQ(unigrams[0].value(), "城市");
+  EXPECT_EQ(lm.unigramCacheStats().misses, 1);
+  EXPECT_EQ(lm.unigramCacheStats().hits, 0);
+
+  auto cachedUnigrams = lm.getUnigrams("ㄔㄥˊ-ㄕˋ");
+  ASSERT_EQ(cachedUnigrams.size(), unigrams.size());
+  for (size_t i = 0; i < unigrams.size(); ++i) {
+    EXPECT_EQ(cachedUnigrams[i].value(), unigrams[i].value());
+    EXPECT_EQ(cachedUnigrams[i].score(), unigrams[i].score());
+  }
+  EXPECT_EQ(lm.unigramCacheStats().misses, 1);
+  EXPECT_EQ(lm.unigramCacheStats().hits, 1);
+  EXPECT_EQ(lm.unigramCacheStats().hitRate(), 0.5);
+
+  // Reloading the user phrases clears the cache.
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  EXPECT_EQ(lm.unigramCacheStats().clears, 1);
+  unigrams = lm.getUnigrams("ㄔㄥˊ-ㄕˋ");
+  ASSERT_FALSE(unigrams.empty());
+  EXPECT_EQ(unigrams[0].value(), "程式");
+  EXPECT_EQ(lm.unigramCacheStats().misses, 2);
+}
+
+TEST(McBopomofoLMTest, UnigramCacheEvictsLeastRecentlyUsed) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.setUnigramCacheCapacity(2);
+  lm.resetUnigramCacheStats();
+
+  lm.getUnigrams("ㄇㄧㄥˊ");
+  lm.getUnigrams("ㄉㄨㄥˋ");
+  lm.getUnigrams("ㄇㄧㄥˊ");
+  lm.getUnigrams("ㄔㄥˊ-ㄕˋ");
+  EXPECT_EQ(lm.unigramCacheStats().evictions, 1);
+
+  // ㄉㄨㄥˋ was the least recently used.
+  lm.getUnigrams("ㄇㄧㄥˊ");
+  EXPECT_EQ(lm.unigramCacheStats().hits, 2);
+  lm.getUnigrams("ㄉㄨㄥˋ");
+  EXPECT_EQ(lm.unigramCacheStats().hits, 2);
+  EXPECT_EQ(lm.unigramCacheStats().misses, 4);
+
+  lm.setUnigramCacheCapacity(0);
+  lm.getUnigrams("ㄉㄨㄥˋ");
+  lm.getUnigrams("ㄉㄨㄥˋ");
+  EXPECT_EQ(lm.unigramCacheStats().hits, 2);
+  EXPECT_EQ(lm.unigramCacheStats().misses, 4);
+}
+
+TEST(McBopomofoLMTest, UnigramCacheDoesNotKeepMacros) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+
+  int today = 10;
+  lm.setMacroConverter([&today](const std::string& macro) {
+    if (macro == "MACRO@DATE_TODAY_SHORT") {
+      return "6/" + std::to_string(today) + "/21";
+    }
+    return macro;
+  });
+
+  auto unigrams = lm.getUnigrams("ㄐㄧㄣ-ㄊㄧㄢ");
+  ASSERT_EQ(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[1].value(), "6/10/21");
+
+  today = 11;
+  unigrams = lm.getUnigrams("ㄐㄧㄣ-ㄊㄧㄢ");
+  ASSERT_EQ(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[1].value(), "6/11/21");
+  EXPECT_EQ(lm.unigramCacheStats().hits, 0);
+}
+
+TEST(McBopomofoLMTest, MacroExpansionsAreKeptUntilTheyExpire) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+
+  int calls = 0;
+  std::time_t expiry = std::time(nullptr) + 3600;
+  auto expander = [&calls, &expiry](const std::string& macro) {
+    ++calls;
+    McBopomofoLM::MacroExpansion expansion{macro, expiry};
+    if (macro == "MACRO@DATE_TODAY_SHORT") {
+      expansion.value = "6/10/21";
+    }
+    return expansion;
+  };
+  lm.setMacroExpander(expander);
+
+  auto unigrams = lm.getUnigrams("ㄐㄧㄣ-ㄊㄧㄢ");
+  ASSERT_EQ(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[1].value(), "6/10/21");
+  EXPECT_EQ(calls, 2);
+
+  // The lookup itself is not cached, but the values of its macros are.
+  unigrams = lm.getUnigrams("ㄐㄧㄣ-ㄊㄧㄢ");
+  ASSERT_EQ(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[1].value(), "6/10/21");
+  EXPECT_EQ(calls, 2);
+  EXPECT_EQ(lm.convertMacro("MACRO@DATE_TODAY_SHORT"), "6/10/21");
+  EXPECT_EQ(calls, 2);
+  EXPECT_EQ(lm.unigramCacheStats().hits, 0);
+
+  // Values that have already expired are not kept.
+  expiry = std::time(nullptr) - 1;
+  lm.setMacroExpander(expander);
+  lm.getUnigrams("ㄐㄧㄣ-ㄊㄧㄢ");
+  lm.getUnigrams("ㄐㄧㄣ-ㄊㄧㄢ");
+  EXPECT_EQ(calls, 6);
+}
+
 }  // namespace McBopomofo
@@ -28,6 +28,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <string_view>
@@ -61,51 +64,67 @@ bool ParselessLM::open(std::unique_ptr<ParselessPhraseDB> db) {
   return true;
 }
 
+// Parses a score without making a string for std::stod(). The text is not
+// null-terminated, so it is copied to a buffer on the stack first; anything
+// that strtod() cannot handle is left to std::stod(), which throws as before.
+static double ParseScore(std::string_view text) {
+  char buffer[64];
+  if (text.size() < sizeof(buffer)) {
+    memcpy(buffer, text.data(), text.size());
+    buffer[text.size()] = '\0';
+    char* end = nullptr;
+    errno = 0;
+    double score = strtod(buffer, &end);
+    if (end != buffer && errno != ERANGE) {
+      return score;
+    }
+  }
+  return std::stod(std::string(text));
+}
+
+// Returns the key followed by a space, so that only the rows with the exact
+// key match. The grid looks up many keys on every keystroke, so the string is
+// a buffer that the thread reuses, valid until the next call.
+static const std::string& SearchKey(const std::string& key) {
+  thread_local std::string searchKey;
+  searchKey.assign(key);
+  searchKey += ' ';
+  return searchKey;
+}
+
 std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
 ParselessLM::getUnigrams(const std::string& key) {
   if (db_ == nullptr) {
     return {};
   }
 
+  // The rows found are also kept in a buffer that the thread reuses.
+  thread_local std::vector<std::string_view> rows;
+  rows.clear();
+  db_->findRows(SearchKey(key), rows);
+
   std::vector<Formosa::Gramambular2::LanguageModel::Unigram> results;
-  for (const auto& row : db_->findRows(key + " ")) {
-    std::string value;
+  results.reserve(rows.size());
+  for (std::string_view row : rows) {
+    std::string_view value;
     double score = 0;
 
-    // Move ahead until we encounter the first space. This is the key.
-    const auto* it = row.begin();
-    while (it != row.end() && *it != ' ') {
-      ++it;
-    }
-
-    // The key is std::string(row.begin(), it), which we don't need.
-
-    // Read past the space.
-    if (it != row.end()) {
-      ++it;
-    }
-
-    if (it != row.end()) {
-      // Now it is the start of the value portion.
-      const auto* value_begin = it;
-
-      // Move ahead until we encounter the second space. This is the
-      // value.
-      while (it != row.end() && *it != ' ') {
-        ++it;
+    // Move ahead until we encounter the first space. This is the key, which
+    // we don't need.
+    size_t valueBegin = row.find(' ');
+    if (valueBegin != std::string_view::npos) {
+      // Read past the space. Now it is the start of the value portion. Move
+      // ahead until we encounter the second space. This is the value.
+      ++valueBegin;
+      size_t valueEnd = row.find(' ', valueBegin);
+      value = row.substr(valueBegin, valueEnd - valueBegin);
+
+      // Read past the space. The remainder, if it exists, is the score.
+      if (valueEnd != std::string_view::npos && valueEnd + 1 < row.size()) {
+        score = ParseScore(row.substr(valueEnd + 1));
       }
-      value = std::string(value_begin, it);
-    }
-
-    // Read past the space. The remainder, if it exists, is the score.
-    if (it != row.end()) {
-      ++it;
-    }
-
-    if (it != row.end()) {
-      score = std::stod(std::string(it, row.end()));
     }
-    results.emplace_back(std::move(value), score);
+    results.emplace_back(std::string(value), score);
   }
   return results;
 }
@@ -115,7 +134,7 @@ bool ParselessLM::hasUnigrams(const std::string& key) {
     return false;
   }
 
-  return db_->findFirstMatchingLine(key + " ") != nullptr;
+  return db_->findFirstMatchingLine(SearchKey(key)) != nullptr;
 }
 
 std::vector<ParselessLM::FoundReading> ParselessLM::getReadings(
@@ -169,4 +188,27 @@ std::vector<ParselessLM::FoundReading> ParselessLM::getReadings(
   return results;
 }
 
+std::vector<std::pair<std::string, std::string>>
+ParselessLM::getReadingsOfValues(
+    const std::unordered_set<std::string_view>& values) const {
+  if (db_ == nullptr || values.empty()) {
+    return {};
+  }
+
+  std::vector<std::pair<std::string, std::string>> results;
+  for (const auto& row : db_->findRows("")) {
+    size_t keyEnd = row.find(' ');
+    if (row.empty() || row[0] == '#' || keyEnd == std::string_view::npos) {
+      continue;
+    }
+    size_t valueEnd = row.find(' ', keyEnd + 1);
+    std::string_view value = row.substr(keyEnd + 1, valueEnd - keyEnd - 1);
+    if (values.find(value) != values.end()) {
+      results.emplace_back(std::string(row.substr(0, keyEnd)),
+                           std::string(value));
+    }
+  }
+  return results;
+}
+
 }  // namespace McBopomofo
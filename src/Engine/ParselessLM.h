@@ -26,6 +26,9 @@
 
 #include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "MemoryMappedFile.h"
@@ -61,6 +64,12 @@ class ParselessLM : public Formosa::Gramambular2::LanguageModel {
   // Look up reading by value. This is specific to ParselessLM only.
   std::vector<FoundReading> getReadings(const std::string& value) const;
 
+  // Look up the readings of several values with one pass over the data,
+  // instead of one pass per value with getReadings(). Returns the (reading,
+  // value) pairs found.
+  std::vector<std::pair<std::string, std::string>> getReadingsOfValues(
+      const std::unordered_set<std::string_view>& values) const;
+
  private:
   MemoryMappedFile mmapedFile_;
   std::unique_ptr<ParselessPhraseDB> db_;
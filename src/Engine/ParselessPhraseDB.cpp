@@ -72,10 +72,15 @@ ParselessPhraseDB::ParselessPhraseDB(const char* buf, size_t length,
 std::vector<std::string_view> ParselessPhraseDB::findRows(
     const std::string_view& key) const {
   std::vector<std::string_view> rows;
+  findRows(key, rows);
+  return rows;
+}
 
+void ParselessPhraseDB::findRows(const std::string_view& key,
+                                 std::vector<std::string_view>& rows) const {
   const char* ptr = findFirstMatchingLine(key);
   if (ptr == nullptr) {
-    return rows;
+    return;
   }
 
   while (ptr + key.length() <= end_ &&
@@ -93,8 +98,6 @@ std::vector<std::string_view> ParselessPhraseDB::findRows(
 
     ptr = ++eol;
   }
-
-  return rows;
 }
 
 // Implements a binary search that returns the pointer to the first matching
@@ -55,6 +55,11 @@ class ParselessPhraseDB {
   // at the end.
   std::vector<std::string_view> findRows(const std::string_view& key) const;
 
+  // Same as above, but appends the rows to a vector that the caller can reuse
+  // across lookups.
+  void findRows(const std::string_view& key,
+                std::vector<std::string_view>& rows) const;
+
   const char* findFirstMatchingLine(const std::string_view& key) const;
 
   // Find the rows whose text past the key column plus the field separator
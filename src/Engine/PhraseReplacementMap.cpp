@@ -62,6 +62,10 @@ std::string PhraseReplacementMap::valueForKey(const std::string& key) const {
   return {};
 }
 
+std::vector<std::string_view> PhraseReplacementMap::keys() const {
+  return dictionary_.keys();
+}
+
 std::vector<ByteBlockBackedDictionary::Issue>
 PhraseReplacementMap::getParsingIssues() const {
   return dictionary_.issues();
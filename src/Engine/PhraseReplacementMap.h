@@ -26,6 +26,8 @@
 
 #include <map>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "ByteBlockBackedDictionary.h"
 #include "MemoryMappedFile.h"
@@ -49,6 +51,10 @@ class PhraseReplacementMap {
 
   std::string valueForKey(const std::string& key) const;
 
+  // Returns all the keys, that is, the values to be replaced, in no particular
+  // order.
+  std::vector<std::string_view> keys() const;
+
   std::vector<ByteBlockBackedDictionary::Issue> getParsingIssues() const;
 
  protected:
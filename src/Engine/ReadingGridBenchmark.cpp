@@ -0,0 +1,488 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "McBopomofoLM.h"
+#include "gramambular2/reading_grid.h"
+
+// Count every heap allocation, so that the benchmarks can report the
+// allocations per iteration along with the latency.
+static std::atomic<size_t> gAllocationCount{0};
+
+void* operator new(size_t size) {
+  gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  auto align = static_cast<size_t>(alignment);
+  size = (size + align - 1) / align * align;
+  if (void* ptr = std::aligned_alloc(align, size ? size : align)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+namespace {
+
+using ReadingGrid = Formosa::Gramambular2::ReadingGrid;
+
+static const char* kDataPath = "data.txt";
+
+// 這是一個測試的句子我們想要轉換成中文
+static const char* kSampleReadings[] = {
+    "ㄓㄜˋ", "ㄕˋ", "ㄧ", "ㄍㄜ˙", "ㄘㄜˋ", "ㄕˋ", "ㄉㄜ˙", "ㄐㄩˋ", "ㄗ˙",
+    "ㄨㄛˇ", "ㄇㄣ˙", "ㄒㄧㄤˇ", "ㄧㄠˋ", "ㄓㄨㄢˇ", "ㄏㄨㄢˋ", "ㄔㄥˊ",
+    "ㄓㄨㄥ", "ㄨㄣˊ",
+};
+
+std::shared_ptr<McBopomofo::McBopomofoLM> GetLM() {
+  static std::shared_ptr<McBopomofo::McBopomofoLM> lm = []() {
+    assert(std::filesystem::exists(kDataPath));
+    auto lm = std::make_shared<McBopomofo::McBopomofoLM>();
+    lm->loadLanguageModel(kDataPath);
+    return lm;
+  }();
+  return lm;
+}
+
+std::vector<std::string> GetReadings(size_t count) {
+  constexpr size_t kSampleSize = std::size(kSampleReadings);
+  std::vector<std::string> readings;
+  readings.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    readings.emplace_back(kSampleReadings[i % kSampleSize]);
+  }
+  return readings;
+}
+
+// Reports the throughput, the latency of each operation, and the allocations
+// of each iteration and of each operation, given the number of operations in
+// an iteration. Create it right before the benchmark loop.
+class OpsReporter {
+ public:
+  OpsReporter(benchmark::State& state, int64_t opsPerIteration)
+      : state_(state),
+        opsPerIteration_(opsPerIteration),
+        allocationsAtStart_(gAllocationCount.load()) {}
+
+  ~OpsReporter() {
+    auto ops = static_cast<double>(opsPerIteration_);
+    state_.SetItemsProcessed(state_.iterations() * opsPerIteration_);
+    state_.counters["latency_per_op"] = benchmark::Counter(
+        ops, benchmark::Counter::kIsIterationInvariantRate |
+                 benchmark::Counter::kInvert);
+    auto allocations =
+        static_cast<double>(gAllocationCount.load() - allocationsAtStart_);
+    state_.counters["allocs_per_iter"] =
+        benchmark::Counter(allocations, benchmark::Counter::kAvgIterations);
+    // For the typing benchmarks, an operation is a keystroke.
+    state_.counters["allocs_per_op"] = benchmark::Counter(
+        allocations / ops, benchmark::Counter::kAvgIterations);
+  }
+
+ private:
+  benchmark::State& state_;
+  int64_t opsPerIteration_;
+  size_t allocationsAtStart_;
+};
+
+// Reports the LM lookups and the combined readings built for each edit, given
+// the update stats before the benchmark loop and the edits in an iteration.
+void ReportUpdateStats(benchmark::State& state, const ReadingGrid& grid,
+                       const ReadingGrid::UpdateStats& before,
+                       int64_t editsPerIteration) {
+  const ReadingGrid::UpdateStats& after = grid.updateStats();
+  auto edits = static_cast<double>(state.iterations() * editsPerIteration);
+  state.counters["lookups_per_edit"] =
+      static_cast<double>(after.lookups - before.lookups) / edits;
+  state.counters["readings_built_per_edit"] =
+      static_cast<double>(after.combinedReadings - before.combinedReadings) /
+      edits;
+}
+
+static void BM_ReadingGridInsertReadingOneByOne(benchmark::State& state) {
+  auto lm = GetLM();
+  std::vector<std::string> readings =
+      GetReadings(static_cast<size_t>(state.range(0)));
+  OpsReporter reporter(state, state.range(0));
+  for (auto _ : state) {
+    ReadingGrid grid(lm);
+    for (const auto& reading : readings) {
+      grid.insertReading(reading);
+    }
+    benchmark::DoNotOptimize(grid.length());
+  }
+}
+BENCHMARK(BM_ReadingGridInsertReadingOneByOne)
+    ->RangeMultiplier(10)
+    ->Range(10, 1000);
+
+static void BM_ReadingGridInsertReadings(benchmark::State& state) {
+  auto lm = GetLM();
+  std::vector<std::string> readings =
+      GetReadings(static_cast<size_t>(state.range(0)));
+  OpsReporter reporter(state, state.range(0));
+  for (auto _ : state) {
+    ReadingGrid grid(lm);
+    grid.insertReadings(readings);
+    benchmark::DoNotOptimize(grid.length());
+  }
+}
+BENCHMARK(BM_ReadingGridInsertReadings)->RangeMultiplier(10)->Range(10, 1000);
+
+// Types the sample sentence again and again, walking after every syllable,
+// with the unigram cache of the LM disabled (0) or enabled (1).
+static void BM_ReadingGridTypeSameSentence(benchmark::State& state) {
+  auto lm = GetLM();
+  lm->setUnigramCacheCapacity(
+      state.range(0) ? McBopomofo::McBopomofoLM::kDefaultUnigramCacheCapacity
+                     : 0);
+  lm->resetUnigramCacheStats();
+  OpsReporter reporter(state, std::size(kSampleReadings));
+  for (auto _ : state) {
+    ReadingGrid grid(lm);
+    for (const char* reading : kSampleReadings) {
+      grid.insertReading(reading);
+      ReadingGrid::WalkResult result = grid.walk();
+      benchmark::DoNotOptimize(result.nodes.data());
+    }
+  }
+  state.counters["hit_rate"] = lm->unigramCacheStats().hitRate();
+  lm->setUnigramCacheCapacity(
+      McBopomofo::McBopomofoLM::kDefaultUnigramCacheCapacity);
+}
+BENCHMARK(BM_ReadingGridTypeSameSentence)->Arg(0)->Arg(1);
+
+// Stands in for a Traditional to Simplified Chinese converter, such as the one
+// of chttrans, by looking up every character of the value in a table.
+std::string ConvertToSimplified(const std::string& value) {
+  static const std::unordered_map<std::string, std::string> kTable = {
+      {"這", "这"}, {"個", "个"}, {"測", "测"}, {"試", "试"}, {"們", "们"},
+      {"換", "换"}, {"轉", "转"}, {"說", "说"}, {"會", "会"}, {"時", "时"},
+      {"間", "间"}, {"現", "现"}, {"學", "学"}, {"語", "语"},
+  };
+  std::string result;
+  result.reserve(value.size());
+  size_t i = 0;
+  while (i < value.size()) {
+    auto c = static_cast<unsigned char>(value[i]);
+    size_t length = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+    std::string character = value.substr(i, length);
+    auto it = kTable.find(character);
+    result += it != kTable.end() ? it->second : character;
+    i += length;
+  }
+  return result;
+}
+
+// The same as BM_ReadingGridTypeSameSentence without the unigram cache, with
+// Simplified Chinese output and the cache of the converted values disabled (0)
+// or enabled (1).
+static void BM_ReadingGridTypeSameSentenceSimplified(benchmark::State& state) {
+  auto lm = GetLM();
+  lm->setUnigramCacheCapacity(0);
+  lm->setExternalConversionCacheCapacity(
+      state.range(0)
+          ? McBopomofo::McBopomofoLM::kDefaultExternalConversionCacheCapacity
+          : 0);
+  lm->setExternalConverter(ConvertToSimplified);
+  lm->setExternalConverterEnabled(true);
+  {
+    OpsReporter reporter(state, std::size(kSampleReadings));
+    for (auto _ : state) {
+      ReadingGrid grid(lm);
+      for (const char* reading : kSampleReadings) {
+        grid.insertReading(reading);
+        ReadingGrid::WalkResult result = grid.walk();
+        benchmark::DoNotOptimize(result.nodes.data());
+      }
+    }
+  }
+  lm->setExternalConverterEnabled(false);
+  lm->setExternalConverter(nullptr);
+  lm->setExternalConversionCacheCapacity(
+      McBopomofo::McBopomofoLM::kDefaultExternalConversionCacheCapacity);
+  lm->setUnigramCacheCapacity(
+      McBopomofo::McBopomofoLM::kDefaultUnigramCacheCapacity);
+}
+BENCHMARK(BM_ReadingGridTypeSameSentenceSimplified)->Arg(0)->Arg(1);
+
+// What the user does most: type one more syllable at the end and walk, then
+// backspace and walk again.
+static void BM_ReadingGridInsertReadingAndWalk(benchmark::State& state) {
+  auto lm = GetLM();
+  size_t length = static_cast<size_t>(state.range(0));
+  ReadingGrid grid(lm);
+  grid.insertReadings(GetReadings(length));
+  ReadingGrid::UpdateStats before = grid.updateStats();
+  OpsReporter reporter(state, 2);
+  for (auto _ : state) {
+    grid.insertReading(kSampleReadings[length % std::size(kSampleReadings)]);
+    ReadingGrid::WalkResult result = grid.walk();
+    benchmark::DoNotOptimize(result.nodes.data());
+    grid.deleteReadingBeforeCursor();
+    result = grid.walk();
+    benchmark::DoNotOptimize(result.nodes.data());
+  }
+  ReportUpdateStats(state, grid, before, 2);
+}
+BENCHMARK(BM_ReadingGridInsertReadingAndWalk)
+    ->RangeMultiplier(10)
+    ->Range(10, 1000);
+
+// Type and then delete a syllable in the middle of a long composing buffer.
+static void BM_ReadingGridEditInMiddle(benchmark::State& state) {
+  auto lm = GetLM();
+  size_t length = static_cast<size_t>(state.range(0));
+  ReadingGrid grid(lm);
+  grid.insertReadings(GetReadings(length));
+  grid.setCursor(length / 2);
+  ReadingGrid::UpdateStats before = grid.updateStats();
+  OpsReporter reporter(state, 2);
+  for (auto _ : state) {
+    grid.insertReading(kSampleReadings[0]);
+    grid.deleteReadingBeforeCursor();
+  }
+  ReportUpdateStats(state, grid, before, 2);
+}
+BENCHMARK(BM_ReadingGridEditInMiddle)->Arg(50)->Arg(500)->Arg(5000);
+
+static void BM_ReadingGridWalk(benchmark::State& state) {
+  auto lm = GetLM();
+  ReadingGrid grid(lm);
+  grid.insertReadings(GetReadings(static_cast<size_t>(state.range(0))));
+  OpsReporter reporter(state, state.range(0));
+  for (auto _ : state) {
+    ReadingGrid::WalkResult result = grid.walk();
+    benchmark::DoNotOptimize(result.nodes.data());
+  }
+}
+BENCHMARK(BM_ReadingGridWalk)->RangeMultiplier(10)->Range(10, 10000);
+
+// The share of the readings that the walk puts in the same node as the exact
+// walk does.
+double PathAgreement(const ReadingGrid::WalkResult& result,
+                     const ReadingGrid::WalkResult& exact) {
+  size_t agreed = 0;
+  size_t pos = 0;
+  size_t exactPos = 0;
+  auto exactIt = exact.nodes.begin();
+  for (const auto& node : result.nodes) {
+    while (exactPos < pos) {
+      exactPos += (*exactIt++)->spanningLength();
+    }
+    if (exactPos == pos && *exactIt == node) {
+      agreed += node->spanningLength();
+    }
+    pos += node->spanningLength();
+  }
+  return pos ? static_cast<double>(agreed) / static_cast<double>(pos) : 1.0;
+}
+
+// Walks a very long grid with a deadline, given in microseconds, against the
+// same grid without one. Reports how many walks had to be completed greedily,
+// and the share of the readings where the path of the last walk agrees with
+// that of the walk without a deadline.
+static void BM_ReadingGridWalkWithDeadline(benchmark::State& state) {
+  auto lm = GetLM();
+  ReadingGrid grid(lm);
+  grid.insertReadings(GetReadings(static_cast<size_t>(state.range(0))));
+  ReadingGrid::WalkLimits limits;
+  limits.deadlineMicroseconds = state.range(1);
+  ReadingGrid::WalkResult exact = grid.walk();
+  ReadingGrid::WalkResult result;
+  int64_t partialWalks = 0;
+  {
+    OpsReporter reporter(state, 1);
+    for (auto _ : state) {
+      result = grid.walk(limits);
+      partialWalks += result.partial;
+      benchmark::DoNotOptimize(result.nodes.data());
+    }
+  }
+  state.counters["partial"] = benchmark::Counter(
+      static_cast<double>(partialWalks), benchmark::Counter::kAvgIterations);
+  state.counters["agreement"] = PathAgreement(result, exact);
+}
+BENCHMARK(BM_ReadingGridWalkWithDeadline)
+    ->Args({100000, 0})
+    ->Args({100000, 500})
+    ->Args({100000, 100});
+
+// Building the candidate list at every position of the buffer.
+static void BM_ReadingGridCandidatesAt(benchmark::State& state) {
+  auto lm = GetLM();
+  size_t length = static_cast<size_t>(state.range(0));
+  ReadingGrid grid(lm);
+  grid.insertReadings(GetReadings(length));
+  OpsReporter reporter(state, state.range(0));
+  for (auto _ : state) {
+    for (size_t i = 0; i < length; ++i) {
+      auto candidates = grid.candidatesAt(i);
+      benchmark::DoNotOptimize(candidates.data());
+    }
+  }
+}
+BENCHMARK(BM_ReadingGridCandidatesAt)->Arg(18)->Arg(180);
+
+// The same, but with the cached views and without copying the candidates, as
+// when the candidate panel is opened again at a location.
+static void BM_ReadingGridCandidateViewsAt(benchmark::State& state) {
+  auto lm = GetLM();
+  size_t length = static_cast<size_t>(state.range(0));
+  ReadingGrid grid(lm);
+  grid.insertReadings(GetReadings(length));
+  OpsReporter reporter(state, state.range(0));
+  for (auto _ : state) {
+    for (size_t i = 0; i < length; ++i) {
+      const auto& views = grid.candidateViewsAt(i);
+      benchmark::DoNotOptimize(views.data());
+    }
+  }
+}
+BENCHMARK(BM_ReadingGridCandidateViewsAt)->Arg(18)->Arg(180);
+
+// Choosing a candidate: override the second candidate at a position, then walk
+// again. The positions cycle through the buffer so that the overrides pile up
+// as they do in a real session.
+static void BM_ReadingGridOverrideAndWalk(benchmark::State& state) {
+  auto lm = GetLM();
+  size_t length = static_cast<size_t>(state.range(0));
+  ReadingGrid grid(lm);
+  grid.insertReadings(GetReadings(length));
+  std::vector<ReadingGrid::Candidate> candidates;
+  for (size_t i = 0; i < length; ++i) {
+    auto c = grid.candidatesAt(i);
+    candidates.push_back(c.size() > 1 ? c[1] : c[0]);
+  }
+
+  size_t loc = 0;
+  OpsReporter reporter(state, 1);
+  for (auto _ : state) {
+    grid.overrideCandidate(loc, candidates[loc]);
+    ReadingGrid::WalkResult result = grid.walk();
+    benchmark::DoNotOptimize(result.nodes.data());
+    loc = (loc + 1) % length;
+  }
+}
+BENCHMARK(BM_ReadingGridOverrideAndWalk)->Arg(18)->Arg(180)->Arg(1800);
+
+// Taking a snapshot and restoring it, which does not depend on the length.
+static void BM_ReadingGridSnapshotAndRestore(benchmark::State& state) {
+  auto lm = GetLM();
+  ReadingGrid grid(lm);
+  grid.insertReadings(GetReadings(static_cast<size_t>(state.range(0))));
+  OpsReporter reporter(state, 2);
+  for (auto _ : state) {
+    ReadingGrid::Snapshot snapshot = grid.snapshot();
+    grid.restore(snapshot);
+  }
+}
+BENCHMARK(BM_ReadingGridSnapshotAndRestore)
+    ->RangeMultiplier(10)
+    ->Range(10, 10000);
+
+// A speculative edit that is then undone: take a snapshot, override a
+// candidate and insert a reading, then restore. The first edit after the
+// snapshot pays for copying the spans and the readings.
+static void BM_ReadingGridSpeculativeEditAndUndo(benchmark::State& state) {
+  auto lm = GetLM();
+  size_t length = static_cast<size_t>(state.range(0));
+  ReadingGrid grid(lm);
+  grid.insertReadings(GetReadings(length));
+  grid.setCursor(length / 2);
+  ReadingGrid::Candidate candidate = grid.candidatesAt(length / 2).back();
+  OpsReporter reporter(state, 1);
+  for (auto _ : state) {
+    ReadingGrid::Snapshot snapshot = grid.snapshot();
+    grid.overrideCandidate(length / 2, candidate);
+    grid.insertReading(kSampleReadings[0]);
+    grid.restore(snapshot);
+  }
+}
+BENCHMARK(BM_ReadingGridSpeculativeEditAndUndo)
+    ->RangeMultiplier(10)
+    ->Range(10, 10000);
+
+// The same as BM_ReadingGridInsertReadings and BM_ReadingGridWalk, but with
+// different maximum span lengths.
+template <size_t MaxSpanLength>
+static void BM_BasicReadingGridInsertReadings(benchmark::State& state) {
+  auto lm = GetLM();
+  std::vector<std::string> readings =
+      GetReadings(static_cast<size_t>(state.range(0)));
+  OpsReporter reporter(state, state.range(0));
+  for (auto _ : state) {
+    Formosa::Gramambular2::BasicReadingGrid<MaxSpanLength> grid(lm);
+    grid.insertReadings(readings);
+    benchmark::DoNotOptimize(grid.length());
+  }
+}
+BENCHMARK_TEMPLATE(BM_BasicReadingGridInsertReadings, 4)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_BasicReadingGridInsertReadings, 8)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_BasicReadingGridInsertReadings, 12)->Arg(1000);
+
+template <size_t MaxSpanLength>
+static void BM_BasicReadingGridWalk(benchmark::State& state) {
+  auto lm = GetLM();
+  Formosa::Gramambular2::BasicReadingGrid<MaxSpanLength> grid(lm);
+  grid.insertReadings(GetReadings(static_cast<size_t>(state.range(0))));
+  OpsReporter reporter(state, state.range(0));
+  for (auto _ : state) {
+    ReadingGrid::WalkResult result = grid.walk();
+    benchmark::DoNotOptimize(result.nodes.data());
+  }
+}
+BENCHMARK_TEMPLATE(BM_BasicReadingGridWalk, 4)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_BasicReadingGridWalk, 8)->Arg(1000);
+BENCHMARK_TEMPLATE(BM_BasicReadingGridWalk, 12)->Arg(1000);
+
+};  // namespace
+
+BENCHMARK_MAIN();
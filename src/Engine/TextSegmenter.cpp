@@ -0,0 +1,237 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "TextSegmenter.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "UTF8Helper.h"
+
+namespace McBopomofo {
+
+namespace {
+
+using Formosa::Gramambular2::LanguageModel;
+using Formosa::Gramambular2::ReadingGrid;
+
+constexpr std::string_view kMacroPrefix = "MACRO@";
+
+// Same as the KeyHandler's.
+constexpr char kJoinSeparator = '-';
+
+std::vector<std::string> SplitReadings(const std::string& readings) {
+  std::vector<std::string> result;
+  size_t start = 0;
+  size_t end;
+  while ((end = readings.find(kJoinSeparator, start)) != std::string::npos) {
+    result.emplace_back(readings, start, end - start);
+    start = end + 1;
+  }
+  result.emplace_back(readings, start);
+  return result;
+}
+
+}  // namespace
+
+// Maps values to their readings, as unigrams whose values are the readings.
+class TextSegmenter::ReverseLM : public LanguageModel {
+ public:
+  explicit ReverseLM(const ParselessPhraseDB& db) {
+    for (std::string_view row : db.findRows("")) {
+      // A well-formed row is "key value score".
+      size_t keyEnd = row.find(' ');
+      if (keyEnd == std::string_view::npos || keyEnd == 0) {
+        continue;
+      }
+      size_t valueEnd = row.find(' ', keyEnd + 1);
+      if (valueEnd == std::string_view::npos || valueEnd == keyEnd + 1) {
+        continue;
+      }
+      std::string_view key = row.substr(0, keyEnd);
+      std::string_view value = row.substr(keyEnd + 1, valueEnd - keyEnd - 1);
+
+      // Skip the comments, the punctuation and symbol keys such as
+      // "_punctuation_，", which are not readings, and the macros.
+      if (key[0] == '#' || key[0] == '_' ||
+          value.compare(0, kMacroPrefix.size(), kMacroPrefix) == 0) {
+        continue;
+      }
+
+      double score = 0;
+      try {
+        score = std::stod(std::string(row.substr(valueEnd + 1)));
+      } catch (...) {
+        continue;
+      }
+      index_[value].push_back({key, score});
+    }
+
+    // Most likely readings first, and each reading only once.
+    for (auto& [value, readings] : index_) {
+      std::stable_sort(readings.begin(), readings.end(),
+                       [](const Reading& a, const Reading& b) {
+                         return a.score > b.score;
+                       });
+      std::vector<Reading> unique;
+      for (const Reading& r : readings) {
+        if (std::none_of(unique.begin(), unique.end(),
+                         [&r](const Reading& u) {
+                           return u.reading == r.reading;
+                         })) {
+          unique.push_back(r);
+        }
+      }
+      readings = std::move(unique);
+    }
+  }
+
+  std::vector<Unigram> getUnigrams(const std::string& key) override {
+    std::vector<Unigram> unigrams;
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      return unigrams;
+    }
+    unigrams.reserve(it->second.size());
+    for (const Reading& r : it->second) {
+      unigrams.emplace_back(std::string(r.reading), r.score);
+    }
+    return unigrams;
+  }
+
+  bool hasUnigrams(const std::string& key) override {
+    return index_.find(key) != index_.end();
+  }
+
+ private:
+  struct Reading {
+    std::string_view reading;
+    double score;
+  };
+  std::unordered_map<std::string_view, std::vector<Reading>> index_;
+};
+
+TextSegmenter::TextSegmenter() = default;
+
+TextSegmenter::~TextSegmenter() = default;
+
+bool TextSegmenter::isLoaded() const { return lm_ != nullptr; }
+
+bool TextSegmenter::open(const char* path) {
+  if (lm_ != nullptr) {
+    return false;
+  }
+  if (!mmapedFile_.open(path)) {
+    return false;
+  }
+  db_ = std::make_unique<ParselessPhraseDB>(
+      mmapedFile_.data(), mmapedFile_.length(), /*validate_pragma=*/true);
+  lm_ = std::make_shared<ReverseLM>(*db_);
+  return true;
+}
+
+void TextSegmenter::close() {
+  lm_ = nullptr;
+  db_ = nullptr;
+  mmapedFile_.close();
+}
+
+bool TextSegmenter::open(std::unique_ptr<ParselessPhraseDB> db) {
+  if (lm_ != nullptr || db == nullptr) {
+    return false;
+  }
+  db_ = std::move(db);
+  lm_ = std::make_shared<ReverseLM>(*db_);
+  return true;
+}
+
+std::vector<TextSegmenter::Segment> TextSegmenter::segment(
+    const std::string& text) const {
+  std::vector<Segment> segments;
+  if (lm_ == nullptr) {
+    return segments;
+  }
+  ReadingGrid grid(lm_);
+  grid.setReadingSeparator("");
+  segment(text, grid, segments);
+  return segments;
+}
+
+std::vector<std::vector<TextSegmenter::Segment>> TextSegmenter::segment(
+    const std::vector<std::string>& texts) const {
+  std::vector<std::vector<Segment>> results(texts.size());
+  if (lm_ == nullptr) {
+    return results;
+  }
+  ReadingGrid grid(lm_);
+  grid.setReadingSeparator("");
+  for (size_t i = 0; i < texts.size(); ++i) {
+    segment(texts[i], grid, results[i]);
+  }
+  return results;
+}
+
+void TextSegmenter::segment(const std::string& text, ReadingGrid& grid,
+                            std::vector<Segment>& segments) const {
+  std::vector<std::string> characters = Split(text);
+  std::vector<std::string> run;
+
+  auto walkRun = [&]() {
+    if (run.empty()) {
+      return;
+    }
+    grid.clear();
+    grid.insertReadings(run);
+    for (const ReadingGrid::NodePtr& node : grid.walk().nodes) {
+      segments.push_back({node->reading(), SplitReadings(node->value())});
+    }
+    run.clear();
+  };
+
+  size_t consumed = 0;
+  for (std::string& character : characters) {
+    consumed += character.size();
+    if (lm_->hasUnigrams(character)) {
+      run.push_back(std::move(character));
+      if (run.size() == kMaximumRunLength) {
+        walkRun();
+      }
+      continue;
+    }
+    walkRun();
+    segments.push_back({std::move(character), {}});
+  }
+  walkRun();
+
+  // Split() stops at an invalid UTF-8 sequence; the rest is kept as is.
+  if (consumed < text.size()) {
+    segments.push_back({text.substr(consumed), {}});
+  }
+}
+
+}  // namespace McBopomofo
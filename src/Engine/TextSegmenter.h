@@ -0,0 +1,106 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_ENGINE_TEXTSEGMENTER_H_
+#define SRC_ENGINE_TEXTSEGMENTER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MemoryMappedFile.h"
+#include "ParselessPhraseDB.h"
+#include "gramambular2/reading_grid.h"
+
+namespace McBopomofo {
+
+// TextSegmenter segments existing text into words and infers their readings,
+// for example to reconvert committed text or to build user phrase files.
+//
+// It uses the reading grid in reverse: the observations are the characters of
+// the text, and the "unigrams" of a run of characters are the readings of the
+// word that the run spells, with the word's score in the language model. The
+// walk then finds the most likely segmentation, and with it the most likely
+// readings of characters that have more than one.
+//
+// The value-to-reading index is built once, when the language model is opened.
+// A character that is not in the language model, such as a punctuation mark,
+// becomes a segment of its own without readings. Since no word can span such
+// a character, the text is walked in runs between them.
+//
+// Once opened, a TextSegmenter is read-only, and segment() may be called from
+// several threads at once.
+class TextSegmenter {
+ public:
+  TextSegmenter();
+  ~TextSegmenter();
+
+  TextSegmenter(const TextSegmenter&) = delete;
+  TextSegmenter(TextSegmenter&&) = delete;
+  TextSegmenter& operator=(const TextSegmenter&) = delete;
+  TextSegmenter& operator=(TextSegmenter&&) = delete;
+
+  bool isLoaded() const;
+
+  // Opens the primary language model data file and builds the index.
+  bool open(const char* path);
+  void close();
+
+  // Allows the use of existing in-memory db.
+  bool open(std::unique_ptr<ParselessPhraseDB> db);
+
+  struct Segment {
+    std::string value;
+    // The readings of the characters of the value, or empty if the value is
+    // not in the language model.
+    std::vector<std::string> readings;
+  };
+
+  // Segments the text. The values of the segments add up to the text.
+  std::vector<Segment> segment(const std::string& text) const;
+
+  // Segments each of the texts. Same as calling segment() on each of them, but
+  // faster for many short texts.
+  std::vector<std::vector<Segment>> segment(
+      const std::vector<std::string>& texts) const;
+
+  // Runs longer than this many characters are walked in pieces, which keeps
+  // the memory of a walk bounded at the cost of exactness at the cuts.
+  static constexpr size_t kMaximumRunLength = 1024;
+
+ private:
+  class ReverseLM;
+
+  // Segments the text with the grid, appending to the segments.
+  void segment(const std::string& text,
+               Formosa::Gramambular2::ReadingGrid& grid,
+               std::vector<Segment>& segments) const;
+
+  MemoryMappedFile mmapedFile_;
+  std::unique_ptr<ParselessPhraseDB> db_;
+  std::shared_ptr<ReverseLM> lm_;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_ENGINE_TEXTSEGMENTER_H_
@@ -0,0 +1,149 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TextSegmenter.h"
+
+namespace {
+
+using TextSegmenter = McBopomofo::TextSegmenter;
+
+static const char* kDataPath = "data.txt";
+
+// An optional large text file to segment. When it does not exist, the
+// benchmarks use a text made by repeating the sample lines below.
+static const char* kTextPath = "text.txt";
+
+static const char* kSampleLines[] = {
+    "這是一個測試的句子，我們想要轉換成注音。",
+    "今天天氣很好，我們一起去公園散步吧！",
+    "長度與重量都是物理量，單位分別是公尺和公斤。",
+    "McBopomofo 是一套開放原始碼的注音輸入法。",
+};
+
+static constexpr size_t kSyntheticLineCount = 10000;
+
+const TextSegmenter& GetSegmenter() {
+  static std::unique_ptr<TextSegmenter> segmenter = []() {
+    assert(std::filesystem::exists(kDataPath));
+    auto s = std::make_unique<TextSegmenter>();
+    s->open(kDataPath);
+    return s;
+  }();
+  return *segmenter;
+}
+
+const std::vector<std::string>& GetLines() {
+  static std::vector<std::string> lines = []() {
+    std::vector<std::string> result;
+    std::ifstream file(kTextPath);
+    if (file) {
+      std::string line;
+      while (std::getline(file, line)) {
+        result.push_back(line);
+      }
+      return result;
+    }
+    constexpr size_t kSampleSize = std::size(kSampleLines);
+    for (size_t i = 0; i < kSyntheticLineCount; ++i) {
+      result.emplace_back(kSampleLines[i % kSampleSize]);
+    }
+    return result;
+  }();
+  return lines;
+}
+
+size_t TotalBytes(const std::vector<std::string>& lines) {
+  size_t bytes = 0;
+  for (const auto& line : lines) {
+    bytes += line.size();
+  }
+  return bytes;
+}
+
+static void BM_TextSegmenterOpenClose(benchmark::State& state) {
+  assert(std::filesystem::exists(kDataPath));
+  for (auto _ : state) {
+    TextSegmenter segmenter;
+    segmenter.open(kDataPath);
+    segmenter.close();
+  }
+}
+BENCHMARK(BM_TextSegmenterOpenClose)->Unit(benchmark::kMillisecond);
+
+static void BM_TextSegmenterSegmentLines(benchmark::State& state) {
+  const auto& segmenter = GetSegmenter();
+  const auto& lines = GetLines();
+  for (auto _ : state) {
+    for (const auto& line : lines) {
+      benchmark::DoNotOptimize(segmenter.segment(line));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<int64_t>(lines.size()));
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(TotalBytes(lines)));
+}
+BENCHMARK(BM_TextSegmenterSegmentLines)->Unit(benchmark::kMillisecond);
+
+static void BM_TextSegmenterSegmentBatch(benchmark::State& state) {
+  const auto& segmenter = GetSegmenter();
+  const auto& lines = GetLines();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(segmenter.segment(lines));
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<int64_t>(lines.size()));
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(TotalBytes(lines)));
+}
+BENCHMARK(BM_TextSegmenterSegmentBatch)->Unit(benchmark::kMillisecond);
+
+// The whole text as one string, so that runs are only split at unknown
+// characters and at the maximum run length.
+static void BM_TextSegmenterSegmentWholeText(benchmark::State& state) {
+  const auto& segmenter = GetSegmenter();
+  std::string text;
+  for (const auto& line : GetLines()) {
+    text += line;
+    text += "\n";
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(segmenter.segment(text));
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(text.size()));
+}
+BENCHMARK(BM_TextSegmenterSegmentWholeText)->Unit(benchmark::kMillisecond);
+
+};  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,160 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "TextSegmenter.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+constexpr char kTextSegmenterLMData[] = R"(
+# format org.openvanilla.mcbopomofo.sorted
+_punctuation_， ， 0.0
+ㄉㄨˋ 度 -3.5
+ㄊㄧㄢ 天 -3.2
+ㄐㄧㄣ 今 -3.6
+ㄐㄧㄣ-ㄊㄧㄢ 今天 -3.28959497
+ㄐㄧㄣ-ㄊㄧㄢ MACRO@DATE_TODAY_SHORT -8
+ㄓㄤˇ 長 -3.1
+ㄓㄨㄥ 中 -2.9
+ㄓㄨㄥ-ㄨㄣˊ 中文 -4.2
+ㄔㄤˊ 長 -3.4
+ㄔㄤˊ-ㄉㄨˋ 長度 -4.5
+ㄨㄣˊ 文 -3.3
+)";
+
+static TextSegmenter::Segment MakeSegment(
+    std::string value, std::vector<std::string> readings) {
+  return {std::move(value), std::move(readings)};
+}
+
+static bool operator==(const TextSegmenter::Segment& a,
+                       const TextSegmenter::Segment& b) {
+  return a.value == b.value && a.readings == b.readings;
+}
+
+static std::unique_ptr<ParselessPhraseDB> CreateDB() {
+  return std::make_unique<ParselessPhraseDB>(kTextSegmenterLMData,
+                                             sizeof(kTextSegmenterLMData));
+}
+
+TEST(TextSegmenterTest, NotLoaded) {
+  TextSegmenter segmenter;
+  EXPECT_FALSE(segmenter.isLoaded());
+  EXPECT_TRUE(segmenter.segment("中文").empty());
+}
+
+TEST(TextSegmenterTest, SegmentsWords) {
+  TextSegmenter segmenter;
+  ASSERT_TRUE(segmenter.open(CreateDB()));
+  ASSERT_TRUE(segmenter.isLoaded());
+
+  auto segments = segmenter.segment("今天中文");
+  ASSERT_EQ(segments.size(), 2);
+  EXPECT_EQ(segments[0], MakeSegment("今天", {"ㄐㄧㄣ", "ㄊㄧㄢ"}));
+  EXPECT_EQ(segments[1], MakeSegment("中文", {"ㄓㄨㄥ", "ㄨㄣˊ"}));
+}
+
+TEST(TextSegmenterTest, ContextChoosesReading) {
+  TextSegmenter segmenter;
+  ASSERT_TRUE(segmenter.open(CreateDB()));
+
+  auto segments = segmenter.segment("長");
+  ASSERT_EQ(segments.size(), 1);
+  EXPECT_EQ(segments[0], MakeSegment("長", {"ㄓㄤˇ"}));
+
+  segments = segmenter.segment("長度");
+  ASSERT_EQ(segments.size(), 1);
+  EXPECT_EQ(segments[0], MakeSegment("長度", {"ㄔㄤˊ", "ㄉㄨˋ"}));
+}
+
+TEST(TextSegmenterTest, UnknownCharactersHaveNoReadings) {
+  TextSegmenter segmenter;
+  ASSERT_TRUE(segmenter.open(CreateDB()));
+
+  // The punctuation key is not a reading, so "，" is unknown.
+  std::string text = "中文，ok 今天";
+  auto segments = segmenter.segment(text);
+  std::vector<TextSegmenter::Segment> expected{
+      MakeSegment("中文", {"ㄓㄨㄥ", "ㄨㄣˊ"}),
+      MakeSegment("，", {}),
+      MakeSegment("o", {}),
+      MakeSegment("k", {}),
+      MakeSegment(" ", {}),
+      MakeSegment("今天", {"ㄐㄧㄣ", "ㄊㄧㄢ"}),
+  };
+  ASSERT_EQ(segments.size(), expected.size());
+  std::string joined;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    EXPECT_EQ(segments[i], expected[i]) << i;
+    joined += segments[i].value;
+  }
+  EXPECT_EQ(joined, text);
+}
+
+TEST(TextSegmenterTest, InvalidUTF8IsKept) {
+  TextSegmenter segmenter;
+  ASSERT_TRUE(segmenter.open(CreateDB()));
+
+  std::string text = "中文\xff\xfe";
+  auto segments = segmenter.segment(text);
+  ASSERT_EQ(segments.size(), 2);
+  EXPECT_EQ(segments[1], MakeSegment("\xff\xfe", {}));
+}
+
+TEST(TextSegmenterTest, LongRuns) {
+  TextSegmenter segmenter;
+  ASSERT_TRUE(segmenter.open(CreateDB()));
+
+  std::string text;
+  for (size_t i = 0; i < TextSegmenter::kMaximumRunLength; ++i) {
+    text += "中文";
+  }
+  auto segments = segmenter.segment(text);
+  ASSERT_EQ(segments.size(), TextSegmenter::kMaximumRunLength);
+  for (const auto& segment : segments) {
+    EXPECT_EQ(segment, MakeSegment("中文", {"ㄓㄨㄥ", "ㄨㄣˊ"}));
+  }
+}
+
+TEST(TextSegmenterTest, BatchSameAsOneByOne) {
+  TextSegmenter segmenter;
+  ASSERT_TRUE(segmenter.open(CreateDB()));
+
+  std::vector<std::string> texts{"今天", "", "長度，長", "中文ok"};
+  auto results = segmenter.segment(texts);
+  ASSERT_EQ(results.size(), texts.size());
+  for (size_t i = 0; i < texts.size(); ++i) {
+    auto segments = segmenter.segment(texts[i]);
+    ASSERT_EQ(results[i].size(), segments.size()) << i;
+    for (size_t j = 0; j < segments.size(); ++j) {
+      EXPECT_EQ(results[i][j], segments[j]) << i << " " << j;
+    }
+  }
+}
+
+}  // namespace McBopomofo
@@ -72,6 +72,10 @@ bool UserPhrasesLM::hasUnigrams(const std::string& key) {
   return dictionary_.hasKey(key);
 }
 
+std::vector<std::string_view> UserPhrasesLM::keys() const {
+  return dictionary_.keys();
+}
+
 std::vector<ByteBlockBackedDictionary::Issue> UserPhrasesLM::getParsingIssues()
     const {
   return dictionary_.issues();
@@ -26,6 +26,7 @@
 
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "ByteBlockBackedDictionary.h"
@@ -53,6 +54,9 @@ class UserPhrasesLM : public Formosa::Gramambular2::LanguageModel {
       const std::string& key) override;
   bool hasUnigrams(const std::string& key) override;
 
+  // Returns all the keys, in no particular order.
+  std::vector<std::string_view> keys() const;
+
   std::vector<ByteBlockBackedDictionary::Issue> getParsingIssues() const;
 
   static constexpr double kUserUnigramScore = 0;
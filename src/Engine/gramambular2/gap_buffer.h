@@ -0,0 +1,285 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_ENGINE_GRAMAMBULAR2_GAP_BUFFER_H_
+#define SRC_ENGINE_GRAMAMBULAR2_GAP_BUFFER_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Formosa::Gramambular2 {
+
+// A sequence container that keeps a gap of unused elements at the location
+// of the last edit. Insertions and deletions at or near the gap are O(1)
+// amortized, and only edits far away from the previous one need to move the
+// gap, which costs O(distance) instead of O(n). This fits the editing pattern
+// of a composing buffer, where nearly all edits happen at the cursor.
+//
+// Elements in the gap are default-constructed values. Erasing an element
+// resets it to a default value, so that resources such as shared pointers are
+// released right away.
+template <typename T>
+class GapBuffer {
+ public:
+  template <bool IsConst>
+  class Iterator {
+   public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<IsConst, const T*, T*>;
+    using reference = std::conditional_t<IsConst, const T&, T&>;
+    using BufferPtr =
+        std::conditional_t<IsConst, const GapBuffer*, GapBuffer*>;
+
+    Iterator() = default;
+    Iterator(BufferPtr buffer, size_t index) : buffer_(buffer), index_(index) {}
+
+    // Allows converting an iterator into a const_iterator.
+    template <bool C = IsConst, typename = std::enable_if_t<C>>
+    Iterator(const Iterator<false>& other)
+        : buffer_(other.buffer_), index_(other.index_) {}
+
+    reference operator*() const { return (*buffer_)[index_]; }
+    pointer operator->() const { return &(*buffer_)[index_]; }
+    reference operator[](difference_type n) const {
+      return (*buffer_)[static_cast<size_t>(
+          static_cast<difference_type>(index_) + n)];
+    }
+
+    Iterator& operator++() {
+      ++index_;
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator copy = *this;
+      ++index_;
+      return copy;
+    }
+    Iterator& operator--() {
+      --index_;
+      return *this;
+    }
+    Iterator operator--(int) {
+      Iterator copy = *this;
+      --index_;
+      return copy;
+    }
+    Iterator& operator+=(difference_type n) {
+      index_ = static_cast<size_t>(static_cast<difference_type>(index_) + n);
+      return *this;
+    }
+    Iterator& operator-=(difference_type n) { return *this += -n; }
+
+    friend Iterator operator+(Iterator it, difference_type n) {
+      return it += n;
+    }
+    friend Iterator operator+(difference_type n, Iterator it) {
+      return it += n;
+    }
+    friend Iterator operator-(Iterator it, difference_type n) {
+      return it -= n;
+    }
+    friend difference_type operator-(const Iterator& a, const Iterator& b) {
+      return static_cast<difference_type>(a.index_) -
+             static_cast<difference_type>(b.index_);
+    }
+
+    friend bool operator==(const Iterator& a, const Iterator& b) {
+      return a.index_ == b.index_;
+    }
+    friend bool operator!=(const Iterator& a, const Iterator& b) {
+      return a.index_ != b.index_;
+    }
+    friend bool operator<(const Iterator& a, const Iterator& b) {
+      return a.index_ < b.index_;
+    }
+    friend bool operator>(const Iterator& a, const Iterator& b) {
+      return a.index_ > b.index_;
+    }
+    friend bool operator<=(const Iterator& a, const Iterator& b) {
+      return a.index_ <= b.index_;
+    }
+    friend bool operator>=(const Iterator& a, const Iterator& b) {
+      return a.index_ >= b.index_;
+    }
+
+   private:
+    friend class Iterator<!IsConst>;
+    BufferPtr buffer_ = nullptr;
+    size_t index_ = 0;
+  };
+
+  using value_type = T;
+  using size_type = size_t;
+  using difference_type = std::ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  [[nodiscard]] size_t size() const { return buffer_.size() - gapLength(); }
+  [[nodiscard]] bool empty() const { return size() == 0; }
+
+  const T& operator[](size_t index) const {
+    assert(index < size());
+    return buffer_[index < gapBegin_ ? index : index + gapLength()];
+  }
+
+  T& operator[](size_t index) {
+    assert(index < size());
+    return buffer_[index < gapBegin_ ? index : index + gapLength()];
+  }
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size()); }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+
+  void clear() {
+    buffer_.clear();
+    gapBegin_ = 0;
+    gapEnd_ = 0;
+  }
+
+  void insert(size_t index, T value) {
+    assert(index <= size());
+    prepareGap(index, 1);
+    buffer_[gapBegin_++] = std::move(value);
+  }
+
+  void insert(size_t index, size_t count, const T& value) {
+    assert(index <= size());
+    prepareGap(index, count);
+    for (size_t i = 0; i < count; ++i) {
+      buffer_[gapBegin_++] = value;
+    }
+  }
+
+  template <typename InputIt>
+  void insert(size_t index, InputIt first, InputIt last) {
+    assert(index <= size());
+    prepareGap(index, static_cast<size_t>(std::distance(first, last)));
+    for (; first != last; ++first) {
+      buffer_[gapBegin_++] = *first;
+    }
+  }
+
+  // Erases the elements in [index, index + count).
+  void erase(size_t index, size_t count = 1) {
+    assert(index + count <= size());
+    moveGapTo(index);
+    for (size_t i = 0; i < count; ++i) {
+      buffer_[gapEnd_++] = T();
+    }
+  }
+
+  [[nodiscard]] std::vector<T> toVector() const {
+    return std::vector<T>(begin(), end());
+  }
+
+  friend bool operator==(const GapBuffer& a, const GapBuffer& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+  }
+
+  friend bool operator!=(const GapBuffer& a, const GapBuffer& b) {
+    return !(a == b);
+  }
+
+ private:
+  static constexpr size_t kMinimumGapLength = 16;
+
+  [[nodiscard]] size_t gapLength() const { return gapEnd_ - gapBegin_; }
+
+  void moveGapTo(size_t index) {
+    if (gapBegin_ == gapEnd_) {
+      gapBegin_ = index;
+      gapEnd_ = index;
+      return;
+    }
+
+    if (index < gapBegin_) {
+      // Move the elements in [index, gapBegin_) to the end of the gap.
+      std::move_backward(buffer_.begin() + static_cast<ptrdiff_t>(index),
+                         buffer_.begin() + static_cast<ptrdiff_t>(gapBegin_),
+                         buffer_.begin() + static_cast<ptrdiff_t>(gapEnd_));
+      size_t moved = gapBegin_ - index;
+      gapBegin_ = index;
+      gapEnd_ -= moved;
+      std::fill(buffer_.begin() + static_cast<ptrdiff_t>(gapBegin_),
+                buffer_.begin() + static_cast<ptrdiff_t>(
+                                      std::min(gapEnd_, gapBegin_ + moved)),
+                T());
+    } else if (index > gapBegin_) {
+      // Move the elements right after the gap to the beginning of the gap.
+      size_t moved = index - gapBegin_;
+      std::move(buffer_.begin() + static_cast<ptrdiff_t>(gapEnd_),
+                buffer_.begin() + static_cast<ptrdiff_t>(gapEnd_ + moved),
+                buffer_.begin() + static_cast<ptrdiff_t>(gapBegin_));
+      size_t clearBegin = std::max(gapEnd_, index);
+      gapBegin_ += moved;
+      gapEnd_ += moved;
+      std::fill(buffer_.begin() + static_cast<ptrdiff_t>(clearBegin),
+                buffer_.begin() + static_cast<ptrdiff_t>(gapEnd_), T());
+    }
+  }
+
+  // Moves the gap to index and makes sure it can hold at least count
+  // elements.
+  void prepareGap(size_t index, size_t count) {
+    if (gapLength() >= count) {
+      moveGapTo(index);
+      return;
+    }
+
+    // Reallocate with the gap placed at index right away, so that the
+    // elements only need to be moved once.
+    size_t oldSize = size();
+    size_t newGapLength = std::max({count, oldSize, kMinimumGapLength});
+    std::vector<T> newBuffer(oldSize + newGapLength);
+    for (size_t i = 0; i < index; ++i) {
+      newBuffer[i] = std::move((*this)[i]);
+    }
+    for (size_t i = index; i < oldSize; ++i) {
+      newBuffer[i + newGapLength] = std::move((*this)[i]);
+    }
+    buffer_ = std::move(newBuffer);
+    gapBegin_ = index;
+    gapEnd_ = index + newGapLength;
+  }
+
+  std::vector<T> buffer_;
+  size_t gapBegin_ = 0;
+  size_t gapEnd_ = 0;
+};
+
+}  // namespace Formosa::Gramambular2
+
+#endif  // SRC_ENGINE_GRAMAMBULAR2_GAP_BUFFER_H_
@@ -0,0 +1,110 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "gap_buffer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace Formosa::Gramambular2 {
+
+TEST(GapBufferTest, BasicOperations) {
+  GapBuffer<std::string> buffer;
+  ASSERT_TRUE(buffer.empty());
+  ASSERT_EQ(buffer.begin(), buffer.end());
+
+  buffer.insert(0, "b");
+  buffer.insert(0, "a");
+  buffer.insert(2, "d");
+  buffer.insert(2, "c");
+  ASSERT_EQ(buffer.size(), 4);
+  ASSERT_EQ(buffer.toVector(), (std::vector<std::string>{"a", "b", "c", "d"}));
+  ASSERT_EQ(buffer[0], "a");
+  ASSERT_EQ(buffer[3], "d");
+  ASSERT_EQ(*(buffer.begin() + 2), "c");
+  ASSERT_EQ(buffer.end() - buffer.begin(), 4);
+
+  buffer.erase(1);
+  ASSERT_EQ(buffer.toVector(), (std::vector<std::string>{"a", "c", "d"}));
+  buffer.erase(0, 2);
+  ASSERT_EQ(buffer.toVector(), (std::vector<std::string>{"d"}));
+
+  buffer.clear();
+  ASSERT_TRUE(buffer.empty());
+}
+
+TEST(GapBufferTest, RangeInsertion) {
+  GapBuffer<std::string> buffer;
+  std::vector<std::string> values{"a", "b", "c"};
+  buffer.insert(0, values.begin(), values.end());
+  buffer.insert(1, 2, "x");
+  ASSERT_EQ(buffer.toVector(),
+            (std::vector<std::string>{"a", "x", "x", "b", "c"}));
+
+  std::vector<std::string> copied(buffer.begin() + 1, buffer.end() - 1);
+  ASSERT_EQ(copied, (std::vector<std::string>{"x", "x", "b"}));
+}
+
+TEST(GapBufferTest, ErasingReleasesElements) {
+  GapBuffer<std::shared_ptr<int>> buffer;
+  auto value = std::make_shared<int>(42);
+  buffer.insert(0, value);
+  buffer.insert(1, value);
+  buffer.insert(2, value);
+  ASSERT_EQ(value.use_count(), 4);
+
+  // Move the gap around; this must not create extra references.
+  buffer.insert(0, nullptr);
+  buffer.insert(4, nullptr);
+  ASSERT_EQ(value.use_count(), 4);
+
+  buffer.erase(1, 3);
+  ASSERT_EQ(value.use_count(), 1);
+  ASSERT_EQ(buffer.size(), 2);
+}
+
+TEST(GapBufferTest, SameAsVector) {
+  GapBuffer<int> buffer;
+  std::vector<int> expected;
+  std::srand(1);
+  for (int i = 0; i < 5000; ++i) {
+    size_t loc = expected.empty() ? 0 : std::rand() % (expected.size() + 1);
+    if (!expected.empty() && std::rand() % 3 == 0) {
+      loc = std::min(loc, expected.size() - 1);
+      expected.erase(expected.begin() + static_cast<ptrdiff_t>(loc));
+      buffer.erase(loc);
+    } else {
+      expected.insert(expected.begin() + static_cast<ptrdiff_t>(loc), i);
+      buffer.insert(loc, i);
+    }
+    ASSERT_EQ(buffer.size(), expected.size());
+  }
+  ASSERT_EQ(buffer.toVector(), expected);
+}
+
+}  // namespace Formosa::Gramambular2
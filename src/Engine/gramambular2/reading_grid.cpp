@@ -29,27 +29,47 @@
 #include <memory>
 #include <stack>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 namespace Formosa::Gramambular2 {
 
-void ReadingGrid::clear() {
+template <size_t N>
+void BasicReadingGrid<N>::clear() {
   cursor_ = 0;
-  readings_.clear();
-  spans_.clear();
+  contents_ = std::make_shared<Contents>();
+  candidateCache_.clear();
 }
 
-void ReadingGrid::setCursor(size_t cursor) {
-  assert(cursor <= readings_.size());
+template <size_t N>
+typename BasicReadingGrid<N>::Snapshot BasicReadingGrid<N>::snapshot() const {
+  return Snapshot(contents_, cursor_);
+}
+
+template <size_t N>
+void BasicReadingGrid<N>::restore(const Snapshot& snapshot) {
+  assert(snapshot.contents_ != nullptr);
+  contents_ = snapshot.contents_;
+  cursor_ = snapshot.cursor_;
+  candidateCache_.clear();
+}
+
+template <size_t N>
+void BasicReadingGrid<N>::setCursor(size_t cursor) {
+  assert(cursor <= contents_->readings.size());
   cursor_ = cursor;
 }
 
-void ReadingGrid::setReadingSeparator(const std::string& separator) {
+template <size_t N>
+void BasicReadingGrid<N>::setReadingSeparator(const std::string& separator) {
   separator_ = separator;
 }
 
-bool ReadingGrid::insertReading(const std::string& reading) {
+template <size_t N>
+bool BasicReadingGrid<N>::insertReading(const std::string& reading) {
   if (reading.empty() || reading == separator_) {
     return false;
   }
@@ -58,47 +78,106 @@ bool ReadingGrid::insertReading(const std::string& reading) {
     return false;
   }
 
-  readings_.insert(readings_.begin() + static_cast<ptrdiff_t>(cursor_),
-                   reading);
+  copyContentsIfShared();
+  contents_->readings.insert(cursor_, reading);
   expandGridAt(cursor_);
-  update();
+  update(cursor_, 1);
 
   // Cursor must only move after update().
   ++cursor_;
   return true;
 }
 
-bool ReadingGrid::deleteReadingBeforeCursor() {
+template <size_t N>
+bool BasicReadingGrid<N>::insertReadings(
+    const std::vector<std::string>& readings) {
+  if (readings.empty()) {
+    return false;
+  }
+
+  // Validate everything first so that the grid is untouched on failure. A
+  // pasted text usually has many repeated readings, so each distinct reading
+  // is only checked once.
+  std::unordered_set<std::string> validated;
+  for (const std::string& reading : readings) {
+    if (reading.empty() || reading == separator_) {
+      return false;
+    }
+    if (validated.find(reading) != validated.end()) {
+      continue;
+    }
+    if (!lm_.hasUnigrams(reading)) {
+      return false;
+    }
+    validated.insert(reading);
+  }
+
+  copyContentsIfShared();
+  contents_->readings.insert(cursor_, readings.begin(), readings.end());
+  bool inMiddle = cursor_ && cursor_ != contents_->spans.size();
+  contents_->spans.insert(cursor_, readings.size(), Span());
+  contents_->spanScores.insert(cursor_, readings.size(), SpanScores());
+  if (inMiddle) {
+    removeAffectedNodes(cursor_);
+  }
+  update(cursor_, readings.size());
+
+  // Cursor must only move after update().
+  cursor_ += readings.size();
+  return true;
+}
+
+template <size_t N>
+bool BasicReadingGrid<N>::deleteReadingBeforeCursor() {
   if (!cursor_) {
     return false;
   }
 
-  readings_.erase(readings_.begin() + static_cast<ptrdiff_t>(cursor_ - 1),
-                  readings_.begin() + static_cast<ptrdiff_t>(cursor_));
+  copyContentsIfShared();
+  contents_->readings.erase(cursor_ - 1);
   // Cursor must decrement for grid-shrinking and update to work.
   --cursor_;
   shrinkGridAt(cursor_);
-  update();
+  update(cursor_, 0);
   return true;
 }
 
-bool ReadingGrid::deleteReadingAfterCursor() {
-  if (cursor_ == readings_.size()) {
+template <size_t N>
+bool BasicReadingGrid<N>::deleteReadingAfterCursor() {
+  if (cursor_ == contents_->readings.size()) {
     return false;
   }
 
-  readings_.erase(readings_.begin() + static_cast<ptrdiff_t>(cursor_),
-                  readings_.begin() + static_cast<ptrdiff_t>(cursor_ + 1));
+  copyContentsIfShared();
+  contents_->readings.erase(cursor_);
   shrinkGridAt(cursor_);
-  update();
+  update(cursor_, 0);
   return true;
 }
 
-std::optional<ReadingGrid::NodePtr> ReadingGrid::findInSpan(
+template <size_t N>
+void BasicReadingGrid<N>::dropReadingsBefore(size_t loc) {
+  assert(loc <= contents_->readings.size());
+  if (!loc) {
+    return;
+  }
+
+  // The nodes that cross loc start before it, so they go with their spans.
+  copyContentsIfShared();
+  contents_->readings.erase(0, loc);
+  contents_->spans.erase(0, loc);
+  contents_->spanScores.erase(0, loc);
+  cursor_ = cursor_ > loc ? cursor_ - loc : 0;
+  candidateCache_.clear();
+}
+
+template <size_t N>
+std::optional<ReadingGridTypes::NodePtr> BasicReadingGrid<N>::findInSpan(
     size_t cursor, const std::function<bool(const NodePtr&)>& predicate) const {
-  assert(cursor <= readings_.size());
-  std::vector<ReadingGrid::NodeInSpan> nodes =
-      overlappingNodesAt(cursor == readings_.size() ? cursor - 1 : cursor);
+  size_t length = contents_->readings.size();
+  assert(cursor <= length);
+  std::vector<NodeInSpan> nodes =
+      overlappingNodesAt(cursor == length ? cursor - 1 : cursor);
 
   auto nodesIt = std::find_if(
       nodes.cbegin(), nodes.cend(),
@@ -106,7 +185,7 @@ std::optional<ReadingGrid::NodePtr> ReadingGrid::findInSpan(
 
   return nodesIt == nodes.end()
              ? std::nullopt
-             : std::optional<ReadingGrid::NodePtr>(nodesIt->node);
+             : std::optional<NodePtr>(nodesIt->node);
 }
 
 namespace {
@@ -120,6 +199,12 @@ int64_t GetEpochNowInMicroseconds() {
   return timestamp;
 }
 
+ReadingGridTypes::NodePtr CopyWithoutOverride(
+    const ReadingGridTypes::NodePtr& node) {
+  return std::make_shared<ReadingGridTypes::Node>(
+      node->reading(), node->spanningLength(), node->unigrams());
+}
+
 }  // namespace
 
 // Find the weightiest path in the grid graph. The path represents the most
@@ -130,25 +215,41 @@ int64_t GetEpochNowInMicroseconds() {
 // probability a larger value means a larger probability. The algorithm runs in
 // O(|V| + |E|) time for G = (V, E) where G is a DAG. This means the walk is
 // fairly economical even when the grid is large.
-ReadingGrid::WalkResult ReadingGrid::walk() {
+template <size_t N>
+ReadingGridTypes::WalkResult BasicReadingGrid<N>::walk() {
+  return walk(WalkLimits());
+}
+
+template <size_t N>
+ReadingGridTypes::WalkResult BasicReadingGrid<N>::walk(
+    const WalkLimits& limits) {
   WalkResult result;
-  if (spans_.empty()) {
+  if (contents_->spans.empty()) {
     return result;
   }
   int64_t start = GetEpochNowInMicroseconds();
 
-  // Defines a state in the DP table. This structure tracks the maximum
-  // accumulated score and the back-pointer required for path reconstruction in
-  // the Viterbi algorithm.
-  struct State {
-    size_t fromIndex = 0;
-    ReadingGrid::NodePtr fromNode = nullptr;
-    double maxScore = -std::numeric_limits<double>::infinity();
-  };
-
-  const size_t readingLen = readings_.size();
-  std::vector<State> viterbi(readingLen + 1);
-  viterbi[0].maxScore = 0.0;
+  // The clock is only read every so many positions, since reading it costs
+  // more than relaxing a few rows.
+  constexpr size_t kDeadlineCheckInterval = 64;
+  const bool timed = limits.deadlineMicroseconds > 0;
+  const auto deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::microseconds(std::max<int64_t>(limits.deadlineMicroseconds,
+                                                  0));
+
+  // The DP table, kept as two parallel arrays: the maximum accumulated score of
+  // each state, and the back-pointer required for path reconstruction in the
+  // Viterbi algorithm. Both are padded by kMaximumSpanLength so that the inner
+  // loop can always relax a full row of span scores without bounds checks.
+  // Missing nodes have the score of negative infinity and so never win.
+  const GapBuffer<SpanScores>& spanScores = contents_->spanScores;
+  const size_t readingLen = contents_->readings.size();
+  const size_t tableLen = readingLen + 1 + kMaximumSpanLength;
+  std::vector<double> maxScores(tableLen,
+                                -std::numeric_limits<double>::infinity());
+  std::vector<size_t> fromIndex(tableLen, 0);
+  maxScores[0] = 0.0;
 
   // Iterate through the grid and compute the maximum accumulated score for each
   // reachable position. Since the grid is a lattice where edges only point
@@ -156,30 +257,31 @@ ReadingGrid::WalkResult ReadingGrid::walk() {
   // in topological order.
   size_t reachableStates = 0;
   size_t evaluatedEdges = 0;
+  size_t walkedLen = readingLen;
   for (size_t i = 0; i < readingLen; ++i) {
+    if (timed && i % kDeadlineCheckInterval == 0 && i > 0 &&
+        std::chrono::steady_clock::now() >= deadline) {
+      walkedLen = i;
+      break;
+    }
     ++reachableStates;
 
-    const ReadingGrid::Span& span = spans_[i];
-    const size_t maxSpanLen = span.maxLength();
-
-    for (size_t spanLen = 1; spanLen <= maxSpanLen; ++spanLen) {
-      const ReadingGrid::NodePtr& node = span.nodeOf(spanLen);
-      if (node == nullptr) {
-        continue;
-      }
-      ++evaluatedEdges;
+    const double base = maxScores[i];
+    const double* scores = spanScores[i].scores.data();
+    double* targetScores = maxScores.data() + i + 1;
+    size_t* targetFromIndex = fromIndex.data() + i + 1;
 
+    for (size_t k = 0; k < kMaximumSpanLength; ++k) {
       // Performs a relaxation on a transition. This updates the destination
       // state if the path through the current node yields a higher score than
       // the previously known best path. This is the core operation of the
       // Viterbi algorithm, adapted for finding the maximum likelihood path.
-      double score = viterbi[i].maxScore + node->score();
-      State& target = viterbi[i + spanLen];
-      if (score > target.maxScore) {
-        target.maxScore = score;
-        target.fromNode = node;
-        target.fromIndex = i;
-      }
+      // The loop is written without branches so that it can be vectorized.
+      double score = base + scores[k];
+      bool better = score > targetScores[k];
+      targetScores[k] = better ? score : targetScores[k];
+      targetFromIndex[k] = better ? i : targetFromIndex[k];
+      evaluatedEdges += scores[k] != -std::numeric_limits<double>::infinity();
     }
   }
   // Vertices are the reachable states
@@ -187,15 +289,86 @@ ReadingGrid::WalkResult ReadingGrid::walk() {
   result.vertices = reachableStates;
   result.edges = evaluatedEdges;
 
-  // Reconstruct the most likely path by tracing back from the end of the grid
-  // to the root using the back-pointers
+  // Trace back from the end of the walked part of the grid to the root using
+  // the back-pointers. The positions where the nodes of the path start are
+  // collected first, so that the nodes can then be copied in order.
+  std::vector<size_t> pathStarts;
+  if (walkedLen < readingLen) {
+    // The walk ran out of time. The path ends at the last position that is
+    // known to be reached.
+    result.partial = true;
+    while (maxScores[walkedLen] == -std::numeric_limits<double>::infinity()) {
+      --walkedLen;
+    }
+  }
+  for (size_t curr = walkedLen; curr > 0; curr = fromIndex[curr]) {
+    assert(maxScores[curr] != -std::numeric_limits<double>::infinity());
+    pathStarts.push_back(fromIndex[curr]);
+  }
+  std::reverse(pathStarts.begin(), pathStarts.end());
+
+  // A node for a reading inserted later at the end starts at readingLen - N + 1
+  // or after, so a later walk goes through the best path to one of those
+  // positions. Follow the back-pointers from all of them, always moving the
+  // one furthest ahead, until they meet; the path before is then settled.
+  if (!result.partial) {
+    std::array<size_t, kMaximumSpanLength> heads;
+    size_t headCount = 0;
+    for (size_t p = readingLen + 1 > kMaximumSpanLength
+                        ? readingLen + 1 - kMaximumSpanLength
+                        : 0;
+         p <= readingLen; ++p) {
+      if (maxScores[p] != -std::numeric_limits<double>::infinity()) {
+        heads[headCount++] = p;
+      }
+    }
+    while (headCount > 1) {
+      auto headsEnd = heads.begin() + headCount;
+      auto furthest = std::max_element(heads.begin(), headsEnd);
+      size_t prev = fromIndex[*furthest];
+      if (std::find(heads.begin(), headsEnd, prev) != headsEnd) {
+        *furthest = heads[--headCount];
+      } else {
+        *furthest = prev;
+      }
+    }
+    result.stableReadings = headCount ? heads[0] : 0;
+  }
+
+  // The rest of a partial walk is completed greedily with the node that has
+  // the best score per reading at each position.
+  if (walkedLen < readingLen) {
+    std::array<double, kMaximumSpanLength> perReading;
+    for (size_t k = 0; k < kMaximumSpanLength; ++k) {
+      perReading[k] = 1.0 / static_cast<double>(k + 1);
+    }
+    for (size_t pos = walkedLen; pos < readingLen;) {
+      pathStarts.push_back(pos);
+      const double* scores = spanScores[pos].scores.data();
+      size_t bestLen = 1;
+      double bestScore = -std::numeric_limits<double>::infinity();
+      for (size_t k = 0; k < kMaximumSpanLength; ++k) {
+        double score = scores[k] * perReading[k];
+        if (score > bestScore) {
+          bestScore = score;
+          bestLen = k + 1;
+        }
+      }
+      pos += bestLen;
+    }
+  }
+
   size_t totalReadingLen = 0;
-  for (size_t curr = readingLen; curr > 0; curr = viterbi[curr].fromIndex) {
-    assert(viterbi[curr].fromNode != nullptr);
-    totalReadingLen += viterbi[curr].fromNode->spanningLength();
-    result.nodes.emplace_back(std::move(viterbi[curr].fromNode));
+  result.nodes.reserve(pathStarts.size());
+  for (size_t i = 0; i < pathStarts.size(); ++i) {
+    const size_t from = pathStarts[i];
+    const size_t to =
+        i + 1 < pathStarts.size() ? pathStarts[i + 1] : readingLen;
+    const NodePtr& node = contents_->spans[from].nodeOf(to - from);
+    assert(node != nullptr);
+    totalReadingLen += node->spanningLength();
+    result.nodes.emplace_back(node);
   }
-  std::reverse(result.nodes.begin(), result.nodes.end());
   assert(totalReadingLen == readingLen);
   result.totalReadings = totalReadingLen;
 
@@ -203,18 +376,66 @@ ReadingGrid::WalkResult ReadingGrid::walk() {
   return result;
 }
 
-std::vector<ReadingGrid::Candidate> ReadingGrid::candidatesAt(size_t loc) {
-  std::vector<ReadingGrid::Candidate> result;
-  if (readings_.empty()) {
-    return result;
+template <size_t N>
+std::vector<ReadingGridTypes::Candidate> BasicReadingGrid<N>::candidatesAt(
+    size_t loc) {
+  std::vector<Candidate> result;
+  const std::vector<CandidateView>& views = candidateViewsAt(loc);
+  result.reserve(views.size());
+  for (const CandidateView& view : views) {
+    result.emplace_back(view.reading(), view.value(), view.rawValue());
   }
+  return result;
+}
 
-  if (loc > readings_.size()) {
-    return result;
+template <size_t N>
+const std::vector<ReadingGridTypes::CandidateView>&
+BasicReadingGrid<N>::candidateViewsAt(size_t loc) {
+  static const std::vector<CandidateView> kEmpty;
+  CandidateList* list = candidateListAt(loc);
+  return list == nullptr ? kEmpty : list->all;
+}
+
+template <size_t N>
+const std::vector<ReadingGridTypes::CandidateView>&
+BasicReadingGrid<N>::uniqueCandidateViewsAt(size_t loc) {
+  static const std::vector<CandidateView> kEmpty;
+  CandidateList* list = candidateListAt(loc);
+  if (list == nullptr) {
+    return kEmpty;
   }
 
-  std::vector<NodeInSpan> nodes =
-      overlappingNodesAt(loc == readings_.size() ? loc - 1 : loc);
+  if (!list->unique.has_value()) {
+    std::vector<CandidateView> unique;
+    std::unordered_set<std::string_view> seen;
+    for (const CandidateView& view : list->all) {
+      if (seen.insert(view.value()).second) {
+        unique.push_back(view);
+      }
+    }
+    list->unique = std::move(unique);
+  }
+  return *list->unique;
+}
+
+template <size_t N>
+typename BasicReadingGrid<N>::CandidateList*
+BasicReadingGrid<N>::candidateListAt(size_t loc) {
+  if (contents_->readings.empty()) {
+    return nullptr;
+  }
+
+  if (loc > contents_->readings.size()) {
+    return nullptr;
+  }
+
+  size_t actualLoc = loc == contents_->readings.size() ? loc - 1 : loc;
+  auto it = candidateCache_.find(actualLoc);
+  if (it != candidateCache_.end()) {
+    return &it->second;
+  }
+
+  std::vector<NodeInSpan> nodes = overlappingNodesAt(actualLoc);
 
   // Sort nodes by reading length.
   std::stable_sort(
@@ -222,46 +443,66 @@ std::vector<ReadingGrid::Candidate> ReadingGrid::candidatesAt(size_t loc) {
         return n1.node->spanningLength() > n2.node->spanningLength();
       });
 
+  CandidateList list;
   for (const NodeInSpan& nodeInSpan : nodes) {
     for (const LanguageModel::Unigram& unigram : nodeInSpan.node->unigrams()) {
-      result.emplace_back(nodeInSpan.node->reading(), unigram.value(),
-                          unigram.rawValue());
+      list.all.emplace_back(&nodeInSpan.node->reading(), &unigram);
     }
   }
-  return result;
+  return &candidateCache_.emplace(actualLoc, std::move(list)).first->second;
 }
 
-bool ReadingGrid::overrideCandidate(
-    size_t loc, const ReadingGrid::Candidate& candidate,
-    ReadingGrid::Node::OverrideType overrideType) {
+template <size_t N>
+bool BasicReadingGrid<N>::overrideCandidate(
+    size_t loc, const Candidate& candidate,
+    Node::OverrideType overrideType) {
   return overrideCandidate(loc, &candidate.reading, candidate.value,
                            overrideType);
 }
 
-bool ReadingGrid::overrideCandidate(
+template <size_t N>
+bool BasicReadingGrid<N>::overrideCandidate(
     size_t loc, const std::string& candidate,
-    ReadingGrid::Node::OverrideType overrideType) {
+    Node::OverrideType overrideType) {
   return overrideCandidate(loc, nullptr, candidate, overrideType);
 }
 
-void ReadingGrid::expandGridAt(size_t loc) {
-  if (!loc || loc == spans_.size()) {
-    spans_.insert(spans_.begin() + static_cast<ptrdiff_t>(loc), Span());
+template <size_t N>
+void BasicReadingGrid<N>::copyContentsIfShared() {
+  if (contents_.use_count() > 1) {
+    contents_ = std::make_shared<Contents>(*contents_);
+  }
+}
+
+template <size_t N>
+bool BasicReadingGrid<N>::mayShareNodes() const {
+  return contents_.use_count() > 1 || contents_->nodeOwners.use_count() > 1;
+}
+
+template <size_t N>
+void BasicReadingGrid<N>::expandGridAt(size_t loc) {
+  if (!loc || loc == contents_->spans.size()) {
+    contents_->spans.insert(loc, Span());
+    contents_->spanScores.insert(loc, SpanScores());
     return;
   }
-  spans_.insert(spans_.begin() + static_cast<ptrdiff_t>(loc), Span());
+  contents_->spans.insert(loc, Span());
+  contents_->spanScores.insert(loc, SpanScores());
   removeAffectedNodes(loc);
 }
 
-void ReadingGrid::shrinkGridAt(size_t loc) {
-  if (loc == spans_.size()) {
+template <size_t N>
+void BasicReadingGrid<N>::shrinkGridAt(size_t loc) {
+  if (loc == contents_->spans.size()) {
     return;
   }
-  spans_.erase(spans_.begin() + static_cast<ptrdiff_t>(loc));
+  contents_->spans.erase(loc);
+  contents_->spanScores.erase(loc);
   removeAffectedNodes(loc);
 }
 
-void ReadingGrid::removeAffectedNodes(size_t loc) {
+template <size_t N>
+void BasicReadingGrid<N>::removeAffectedNodes(size_t loc) {
   // Because of the expansion, certain spans now have "broken" nodes. We need
   // to remove those. For example, before:
   //
@@ -291,25 +532,42 @@ void ReadingGrid::removeAffectedNodes(size_t loc) {
   //                XXXXX
   //            XXXXXXXXX
   //
-  if (spans_.empty()) {
+  // No node starts before the first span, so nothing is affected at 0.
+  if (contents_->spans.empty() || loc == 0) {
     return;
   }
   size_t affectedLength = kMaximumSpanLength - 1;
   size_t begin = loc <= affectedLength ? 0 : loc - affectedLength;
-  size_t end = loc >= 1 ? loc - 1 : 0;
+  size_t end = loc - 1;
   for (size_t i = begin; i <= end; ++i) {
-    spans_[i].removeNodesOfOrLongerThan(loc - i + 1);
+    contents_->spans[i].removeNodesOfOrLongerThan(loc - i + 1);
+    syncSpanScores(i);
   }
 }
 
-void ReadingGrid::insert(size_t loc, const ReadingGrid::NodePtr& node) {
-  assert(loc < spans_.size());
-  spans_[loc].add(node);
+template <size_t N>
+void BasicReadingGrid<N>::insert(size_t loc, const NodePtr& node) {
+  assert(loc < contents_->spans.size());
+  contents_->spans[loc].add(node);
+  contents_->spanScores[loc].scores[node->spanningLength() - 1] = node->score();
+}
+
+template <size_t N>
+void BasicReadingGrid<N>::syncSpanScores(size_t loc) {
+  assert(loc < contents_->spans.size());
+  const Span& span = contents_->spans[loc];
+  SpanScores& row = contents_->spanScores[loc];
+  for (size_t i = 0; i < kMaximumSpanLength; ++i) {
+    const NodePtr& node = span.nodeOf(i + 1);
+    row.scores[i] = node == nullptr ? -std::numeric_limits<double>::infinity()
+                                    : node->score();
+  }
 }
 
-std::string ReadingGrid::combineReading(
-    std::vector<std::string>::const_iterator begin,
-    std::vector<std::string>::const_iterator end) {
+template <size_t N>
+std::string BasicReadingGrid<N>::combineReading(
+    GapBuffer<std::string>::const_iterator begin,
+    GapBuffer<std::string>::const_iterator end) {
   std::string result;
   for (auto iter = begin; iter != end;) {
     result += *iter;
@@ -321,57 +579,95 @@ std::string ReadingGrid::combineReading(
   return result;
 }
 
-bool ReadingGrid::hasNodeAt(size_t loc, size_t readingLen,
-                            const std::string& reading) {
-  if (loc > spans_.size()) {
-    return false;
-  }
-  const NodePtr& n = spans_[loc].nodeOf(readingLen);
-  if (n == nullptr) {
-    return false;
-  }
-  return reading == n->reading();
-}
+template <size_t N>
+void BasicReadingGrid<N>::update(size_t loc, size_t length) {
+  // Every edit shifts or replaces nodes, so the cached candidates are stale.
+  candidateCache_.clear();
+
+  const GapBuffer<std::string>& readings = contents_->readings;
+  const size_t readingLen = readings.size();
+  size_t begin = loc < kMaximumSpanLength ? 0 : loc - kMaximumSpanLength + 1;
+  size_t end = std::min(loc + length, readingLen);
 
-void ReadingGrid::update() {
-  size_t begin =
-      (cursor_ <= kMaximumSpanLength) ? 0 : cursor_ - kMaximumSpanLength;
-  size_t end = cursor_ + kMaximumSpanLength;
-  end = std::min(end, readings_.size());
+  // With a bulk insertion, the same combined readings are likely to recur, so
+  // the lookups are memoized for the duration of this update.
+  bool memoize = length > 1;
+  std::unordered_map<std::string, std::vector<LanguageModel::Unigram>> lookups;
 
   for (size_t pos = begin; pos < end; pos++) {
-    for (size_t len = 1; len <= kMaximumSpanLength && pos + len <= end; len++) {
-      std::string combinedReading =
-          combineReading(readings_.begin() + static_cast<ptrdiff_t>(pos),
-                         readings_.begin() + static_cast<ptrdiff_t>(pos + len));
-
-      if (!hasNodeAt(pos, len, combinedReading)) {
-        auto unigrams = lm_.getUnigrams(combinedReading);
-        if (unigrams.empty()) {
-          continue;
+    // The shortest node at pos that overlaps the changed readings (or, after a
+    // deletion, straddles loc). Each longer node's reading is built from the
+    // previous one.
+    size_t minLen = pos < loc ? loc - pos + 1 : 1;
+    size_t maxLen = std::min(kMaximumSpanLength, readingLen - pos);
+    if (minLen > maxLen) {
+      continue;
+    }
+    auto readingIter = readings.begin() + static_cast<ptrdiff_t>(pos);
+    std::string combinedReading = combineReading(
+        readingIter, readingIter + static_cast<ptrdiff_t>(minLen));
+    for (size_t len = minLen; len <= maxLen; len++) {
+      if (len > minLen) {
+        combinedReading += separator_;
+        combinedReading += readings[pos + len - 1];
+      }
+      ++updateStats_.combinedReadings;
+      assert(contents_->spans[pos].nodeOf(len) == nullptr);
+
+      std::vector<LanguageModel::Unigram> unigrams;
+      if (memoize) {
+        auto it = lookups.find(combinedReading);
+        if (it == lookups.end()) {
+          ++updateStats_.lookups;
+          it = lookups
+                   .emplace(combinedReading, lm_.getUnigrams(combinedReading))
+                   .first;
         }
+        unigrams = it->second;
+      } else {
+        ++updateStats_.lookups;
+        unigrams = lm_.getUnigrams(combinedReading);
+      }
 
-        insert(pos, std::make_shared<Node>(combinedReading, len, unigrams));
+      if (unigrams.empty()) {
+        continue;
       }
+
+      insert(pos, std::make_shared<Node>(combinedReading, len,
+                                         std::move(unigrams)));
     }
   }
 }
 
-bool ReadingGrid::overrideCandidate(
+template <size_t N>
+bool BasicReadingGrid<N>::overrideCandidate(
     size_t loc, const std::string* reading, const std::string& value,
-    ReadingGrid::Node::OverrideType overrideType) {
-  if (loc > readings_.size()) {
+    Node::OverrideType overrideType) {
+  if (loc > contents_->readings.size()) {
     return false;
   }
 
+  // A node that may be shared with a snapshot must not be changed in place, so
+  // it is replaced by a copy without the override, which is then changed.
+  bool replaceNodes = mayShareNodes();
+
   std::vector<NodeInSpan> overlappingNodes =
-      overlappingNodesAt(loc == readings_.size() ? loc - 1 : loc);
+      overlappingNodesAt(loc == contents_->readings.size() ? loc - 1 : loc);
   NodeInSpan overridden;
   for (NodeInSpan& nis : overlappingNodes) {
     if (reading != nullptr && nis.node->reading() != *reading) {
       continue;
     }
 
+    if (replaceNodes) {
+      const auto& unigrams = nis.node->unigrams();
+      if (std::none_of(unigrams.cbegin(), unigrams.cend(),
+                       [&](const auto& u) { return u.value() == value; })) {
+        continue;
+      }
+      nis.node = CopyWithoutOverride(nis.node);
+    }
+
     if (nis.node->selectOverrideUnigram(value, overrideType)) {
       overridden = nis;
       break;
@@ -383,9 +679,16 @@ bool ReadingGrid::overrideCandidate(
     return false;
   }
 
+  copyContentsIfShared();
+  if (replaceNodes) {
+    contents_->spans[overridden.spanIndex].add(overridden.node);
+    // The cached views may refer to the replaced node.
+    candidateCache_.clear();
+  }
+
   for (size_t i = overridden.spanIndex;
        i < overridden.spanIndex + overridden.node->spanningLength() &&
-       i < spans_.size();
+       i < contents_->spans.size();
        ++i) {
     // We also need to reset *all* nodes that share the same location in the
     // span. For example, if previously the two walked nodes are "A BC" where
@@ -394,27 +697,43 @@ bool ReadingGrid::overrideCandidate(
     // will be reset as it's part of the overlapping node, but A is not.
     std::vector<NodeInSpan> nodes = overlappingNodesAt(i);
     for (NodeInSpan& nis : nodes) {
-      if (nis.node != overridden.node) {
+      if (nis.node == overridden.node) {
+        continue;
+      }
+      if (!replaceNodes) {
         nis.node->reset();
+      } else if (nis.node->isOverridden()) {
+        contents_->spans[nis.spanIndex].add(CopyWithoutOverride(nis.node));
       }
     }
   }
+
+  // Sync the scores of every span that may hold the nodes touched above.
+  size_t begin = overridden.spanIndex -
+                 std::min(overridden.spanIndex, kMaximumSpanLength - 1);
+  size_t end = std::min(
+      overridden.spanIndex + overridden.node->spanningLength(),
+      contents_->spans.size());
+  for (size_t i = begin; i < end; ++i) {
+    syncSpanScores(i);
+  }
   return true;
 }
 
-std::vector<ReadingGrid::NodeInSpan> ReadingGrid::overlappingNodesAt(
-    size_t loc) const {
-  std::vector<ReadingGrid::NodeInSpan> results;
+template <size_t N>
+std::vector<ReadingGridTypes::NodeInSpan>
+BasicReadingGrid<N>::overlappingNodesAt(size_t loc) const {
+  std::vector<NodeInSpan> results;
 
-  if (spans_.empty() || loc >= spans_.size()) {
+  if (contents_->spans.empty() || loc >= contents_->spans.size()) {
     return results;
   }
 
   // First, get all nodes from the span at location.
-  for (size_t i = 1, len = spans_[loc].maxLength(); i <= len; ++i) {
-    NodePtr ptr = spans_[loc].nodeOf(i);
+  for (size_t i = 1, len = contents_->spans[loc].maxLength(); i <= len; ++i) {
+    NodePtr ptr = contents_->spans[loc].nodeOf(i);
     if (ptr != nullptr) {
-      ReadingGrid::NodeInSpan element{std::move(ptr), loc};
+      NodeInSpan element{std::move(ptr), loc};
       results.emplace_back(std::move(element));
     }
   }
@@ -422,11 +741,11 @@ std::vector<ReadingGrid::NodeInSpan> ReadingGrid::overlappingNodesAt(
   size_t begin = loc - std::min(loc, kMaximumSpanLength - 1);
   for (size_t i = begin; i < loc; ++i) {
     size_t beginLen = loc - i + 1;
-    size_t endLen = spans_[i].maxLength();
+    size_t endLen = contents_->spans[i].maxLength();
     for (size_t j = beginLen; j <= endLen; ++j) {
-      NodePtr ptr = spans_[i].nodeOf(j);
+      NodePtr ptr = contents_->spans[i].nodeOf(j);
       if (ptr != nullptr) {
-        ReadingGrid::NodeInSpan element{std::move(ptr), i};
+        NodeInSpan element{std::move(ptr), i};
         results.emplace_back(std::move(element));
       }
     }
@@ -435,15 +754,15 @@ std::vector<ReadingGrid::NodeInSpan> ReadingGrid::overlappingNodesAt(
   return results;
 }
 
-LanguageModel::Unigram ReadingGrid::Node::currentUnigram() const {
+LanguageModel::Unigram ReadingGridTypes::Node::currentUnigram() const {
   return unigrams_.empty() ? LanguageModel::Unigram{} : *unigramIter_;
 }
 
-std::string ReadingGrid::Node::value() const {
+std::string ReadingGridTypes::Node::value() const {
   return unigrams_.empty() ? "" : unigramIter_->value();
 }
 
-double ReadingGrid::Node::score() const {
+double ReadingGridTypes::Node::score() const {
   if (unigrams_.empty()) {
     return 0;
   }
@@ -459,18 +778,18 @@ double ReadingGrid::Node::score() const {
   }
 }
 
-bool ReadingGrid::Node::isOverridden() const {
+bool ReadingGridTypes::Node::isOverridden() const {
   return overrideType_ != OverrideType::kNone;
 }
 
-void ReadingGrid::Node::reset() {
+void ReadingGridTypes::Node::reset() {
   unigramIter_ = unigrams_.begin();
   overrideType_ = OverrideType::kNone;
 }
 
-bool ReadingGrid::Node::selectOverrideUnigram(
-    const std::string& value, ReadingGrid::Node::OverrideType type) {
-  assert(type != ReadingGrid::Node::OverrideType::kNone);
+bool ReadingGridTypes::Node::selectOverrideUnigram(
+    const std::string& value, OverrideType type) {
+  assert(type != OverrideType::kNone);
   for (auto it = unigrams_.begin(), end = unigrams_.end(); it != end; ++it) {
     if (value == it->value()) {
       unigramIter_ = it;
@@ -481,8 +800,8 @@ bool ReadingGrid::Node::selectOverrideUnigram(
   return false;
 }
 
-std::vector<ReadingGrid::NodePtr>::const_iterator
-ReadingGrid::WalkResult::findNodeAt(size_t cursor,
+std::vector<ReadingGridTypes::NodePtr>::const_iterator
+ReadingGridTypes::WalkResult::findNodeAt(size_t cursor,
                                     size_t* outCursorPastNode) const {
   if (nodes.empty()) {
     return nodes.cend();
@@ -524,7 +843,7 @@ ReadingGrid::WalkResult::findNodeAt(size_t cursor,
   return nodes.cend();
 }
 
-std::vector<std::string> ReadingGrid::WalkResult::valuesAsStrings() const {
+std::vector<std::string> ReadingGridTypes::WalkResult::valuesAsStrings() const {
   std::vector<std::string> result;
   for (const NodePtr& node : nodes) {
     result.emplace_back(node->value());
@@ -532,7 +851,8 @@ std::vector<std::string> ReadingGrid::WalkResult::valuesAsStrings() const {
   return result;
 }
 
-std::vector<std::string> ReadingGrid::WalkResult::readingsAsStrings() const {
+std::vector<std::string> ReadingGridTypes::WalkResult::readingsAsStrings()
+    const {
   std::vector<std::string> result;
   for (const NodePtr& node : nodes) {
     result.emplace_back(node->reading());
@@ -540,19 +860,22 @@ std::vector<std::string> ReadingGrid::WalkResult::readingsAsStrings() const {
   return result;
 }
 
-void ReadingGrid::Span::clear() {
+template <size_t N>
+void BasicReadingGrid<N>::Span::clear() {
   nodes_.fill(nullptr);
   maxLength_ = 0;
 }
 
-void ReadingGrid::Span::add(const ReadingGrid::NodePtr& node) {
+template <size_t N>
+void BasicReadingGrid<N>::Span::add(const NodePtr& node) {
   assert(node->spanningLength() > 0 &&
          node->spanningLength() <= kMaximumSpanLength);
   nodes_[node->spanningLength() - 1] = node;
   maxLength_ = std::max(maxLength_, node->spanningLength());
 }
 
-void ReadingGrid::Span::removeNodesOfOrLongerThan(size_t length) {
+template <size_t N>
+void BasicReadingGrid<N>::Span::removeNodesOfOrLongerThan(size_t length) {
   assert(length > 0 && length <= kMaximumSpanLength);
   for (size_t i = length - 1; i < kMaximumSpanLength; ++i) {
     nodes_[i] = nullptr;
@@ -577,13 +900,16 @@ void ReadingGrid::Span::removeNodesOfOrLongerThan(size_t length) {
   }
 }
 
-ReadingGrid::NodePtr ReadingGrid::Span::nodeOf(size_t length) const {
+template <size_t N>
+const ReadingGridTypes::NodePtr& BasicReadingGrid<N>::Span::nodeOf(
+    size_t length) const {
   assert(length > 0 && length <= kMaximumSpanLength);
   return nodes_[length - 1];
 }
 
 std::vector<LanguageModel::Unigram>
-ReadingGrid::ScoreRankedLanguageModel::getUnigrams(const std::string& reading) {
+ReadingGridTypes::ScoreRankedLanguageModel::getUnigrams(
+    const std::string& reading) {
   auto unigrams = lm_->getUnigrams(reading);
   std::stable_sort(
       unigrams.begin(), unigrams.end(),
@@ -591,9 +917,13 @@ ReadingGrid::ScoreRankedLanguageModel::getUnigrams(const std::string& reading) {
   return unigrams;
 }
 
-bool ReadingGrid::ScoreRankedLanguageModel::hasUnigrams(
+bool ReadingGridTypes::ScoreRankedLanguageModel::hasUnigrams(
     const std::string& reading) {
   return lm_->hasUnigrams(reading);
 }
 
+template class BasicReadingGrid<4>;
+template class BasicReadingGrid<8>;
+template class BasicReadingGrid<12>;
+
 }  // namespace Formosa::Gramambular2
@@ -28,54 +28,23 @@
 #include <cassert>
 #include <cstdint>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "gap_buffer.h"
 #include "language_model.h"
 
 namespace Formosa::Gramambular2 {
 
-// A grid for deriving the most likely hidden values from a series of
-// observations. For our purpose, the observations are Bopomofo readings, and
-// the hidden values are the actual Mandarin words. This can also be used for
-// segmentation: in that case, the observations are Mandarin words, and the
-// hidden values are the most likely groupings.
-//
-// While we use the terminology from hidden Markov model (HMM), the actual
-// implementation is a much simpler Bayesian inference, since the underlying
-// language model consists of only unigrams. Once we have put all plausible
-// unigrams as nodes on the grid, a simple DAG shortest-path walk will give us
-// the maximum likelihood estimation (MLE) for the hidden values.
-class ReadingGrid {
+// The types shared by all instantiations of BasicReadingGrid, so that the
+// nodes and the walk results do not depend on the maximum span length.
+class ReadingGridTypes {
  public:
-  explicit ReadingGrid(std::shared_ptr<LanguageModel> lm)
-      : lm_(std::move(lm)) {}
-
-  void clear();
-
-  [[nodiscard]] size_t length() const { return readings_.size(); }
-
-  [[nodiscard]] size_t cursor() const { return cursor_; }
-
-  void setCursor(size_t cursor);
-
-  [[nodiscard]] std::string readingSeparator() const { return separator_; }
-
-  void setReadingSeparator(const std::string& separator);
-
-  bool insertReading(const std::string& reading);
-
-  // Delete the reading before the cursor, like Backspace. Cursor will decrement
-  // by one.
-  bool deleteReadingBeforeCursor();
-
-  // Delete the reading after the cursor, like Del. Cursor is unmoved.
-  bool deleteReadingAfterCursor();
-
-  static constexpr size_t kMaximumSpanLength = 8;
   static constexpr char kDefaultSeparator[] = "-";
 
   // A Node consists of a set of unigrams, a reading, and a spanning length.
@@ -128,6 +97,8 @@ class ReadingGrid {
 
     [[nodiscard]] bool isOverridden() const;
 
+    // These change the node's score. Use ReadingGrid::overrideCandidate() for
+    // the nodes in a grid, so that the grid's walk sees the new scores.
     void reset();
 
     bool selectOverrideUnigram(const std::string& value, OverrideType type);
@@ -155,12 +126,6 @@ class ReadingGrid {
 
   using NodePtr = std::shared_ptr<Node>;
 
-  // Find, in a span at the cursor, the first node satisfying the predicate.
-  // Returns std::nullopt if not found.
-  std::optional<NodePtr> findInSpan(
-      size_t cursor,
-      const std::function<bool(const NodePtr&)>& predicate) const;
-
   struct WalkResult {
     std::vector<NodePtr> nodes;
     size_t totalReadings = 0;
@@ -168,6 +133,18 @@ class ReadingGrid {
     size_t edges = 0;
     uint64_t elapsedMicroseconds = 0;
 
+    // Whether a walk with limits ran out of time. If so, only the path up to
+    // where the walk stopped is the most likely one, and the rest of the path
+    // is a greedy completion. A full walk should follow when time allows.
+    bool partial = false;
+
+    // The number of readings at the beginning of the grid that a walk would
+    // still begin with if more readings were inserted at the end: the best
+    // paths to every position where a node for a later reading could start go
+    // through the same nodes up to there. Only computed by walks that are not
+    // partial; otherwise 0. See dropReadingsBefore().
+    size_t stableReadings = 0;
+
     // Convenient method for finding the node at the cursor. Returns
     // nodes.cend() if the value of cursor argument doesn't make sense. An
     // optional ourCursorPastNode argument can be used to obtain the cursor
@@ -180,7 +157,24 @@ class ReadingGrid {
     std::vector<std::string> readingsAsStrings() const;
   };
 
-  WalkResult walk();
+  // Limits that bound the work of a walk on very long grids. The default limits
+  // are none, which is the same as walk().
+  struct WalkLimits {
+    // If positive, the walk stops after about this many microseconds and
+    // completes the path greedily. See WalkResult::partial. This bounds the
+    // search only; building the resulting path is still linear in its length.
+    // The nodes are populated by the edits of the grid, not by the walk, so a
+    // long insertReadings() is not bounded by this.
+    int64_t deadlineMicroseconds = 0;
+  };
+
+  // The work done by the edits of a grid to populate its nodes, for measuring.
+  struct UpdateStats {
+    // The language model lookups.
+    uint64_t lookups = 0;
+    // The combined readings that were built for the lookups.
+    uint64_t combinedReadings = 0;
+  };
 
   struct Candidate {
     Candidate(std::string r, std::string v, std::string rv = "")
@@ -190,11 +184,138 @@ class ReadingGrid {
     const std::string rawValue;
   };
 
+  // A candidate that refers to the reading and the unigram of a node in the
+  // grid instead of copying them. See BasicReadingGrid::candidateViewsAt().
+  class CandidateView {
+   public:
+    CandidateView(const std::string* reading,
+                  const LanguageModel::Unigram* unigram)
+        : reading_(reading), unigram_(unigram) {}
+
+    [[nodiscard]] const std::string& reading() const { return *reading_; }
+    [[nodiscard]] const std::string& value() const { return unigram_->value(); }
+    [[nodiscard]] const std::string& rawValue() const {
+      return unigram_->rawValue();
+    }
+
+    [[nodiscard]] Candidate candidate() const {
+      return Candidate(reading(), value(), rawValue());
+    }
+
+   private:
+    const std::string* reading_;
+    const LanguageModel::Unigram* unigram_;
+  };
+
+  // A language model wrapper that always returns score-ranked unigrams.
+  class ScoreRankedLanguageModel : public LanguageModel {
+   public:
+    explicit ScoreRankedLanguageModel(std::shared_ptr<LanguageModel> lm)
+        : lm_(std::move(lm)) {
+      assert(lm_ != nullptr);
+    }
+    std::vector<Unigram> getUnigrams(const std::string& reading) override;
+    bool hasUnigrams(const std::string& reading) override;
+
+   protected:
+    std::shared_ptr<LanguageModel> lm_;
+  };
+
+ protected:
+  struct NodeInSpan {
+    NodePtr node;
+    size_t spanIndex = 0;
+  };
+};
+
+// A grid for deriving the most likely hidden values from a series of
+// observations. For our purpose, the observations are Bopomofo readings, and
+// the hidden values are the actual Mandarin words. This can also be used for
+// segmentation: in that case, the observations are Mandarin words, and the
+// hidden values are the most likely groupings.
+//
+// While we use the terminology from hidden Markov model (HMM), the actual
+// implementation is a much simpler Bayesian inference, since the underlying
+// language model consists of only unigrams. Once we have put all plausible
+// unigrams as nodes on the grid, a simple DAG shortest-path walk will give us
+// the maximum likelihood estimation (MLE) for the hidden values.
+//
+// The grid is a template on the maximum number of readings a node can span,
+// which bounds the length of the phrases the grid can find. A longer maximum
+// finds longer phrases at the cost of more lookups and a slower walk. Use the
+// ReadingGrid alias unless a different maximum is needed; only the
+// instantiations declared below are available.
+template <size_t MaxSpanLength>
+class BasicReadingGrid : public ReadingGridTypes {
+  static_assert(MaxSpanLength > 0, "A span must hold at least one node");
+
+ public:
+  explicit BasicReadingGrid(std::shared_ptr<LanguageModel> lm)
+      : lm_(std::move(lm)) {}
+
+  void clear();
+
+  [[nodiscard]] size_t length() const { return contents_->readings.size(); }
+
+  [[nodiscard]] size_t cursor() const { return cursor_; }
+
+  void setCursor(size_t cursor);
+
+  [[nodiscard]] std::string readingSeparator() const { return separator_; }
+
+  void setReadingSeparator(const std::string& separator);
+
+  bool insertReading(const std::string& reading);
+
+  // Insert a series of readings at the cursor, like calling insertReading()
+  // for each reading, but the grid is only updated once at the end. This is
+  // used for pasting or replaying a long input. If any of the readings is
+  // invalid, the grid is left untouched and false is returned. Cursor will
+  // move past the inserted readings.
+  bool insertReadings(const std::vector<std::string>& readings);
+
+  // Delete the reading before the cursor, like Backspace. Cursor will decrement
+  // by one.
+  bool deleteReadingBeforeCursor();
+
+  // Delete the reading after the cursor, like Del. Cursor is unmoved.
+  bool deleteReadingAfterCursor();
+
+  // Remove the readings before loc, along with the nodes that start there, for
+  // committing the beginning of a long grid. The nodes after loc are kept as
+  // they are, so if loc is at most the stableReadings of the latest walk, the
+  // next walk is the rest of that walk. Cursor moves back by loc, or to 0.
+  void dropReadingsBefore(size_t loc);
+
+  static constexpr size_t kMaximumSpanLength = MaxSpanLength;
+
+  // Find, in a span at the cursor, the first node satisfying the predicate.
+  // Returns std::nullopt if not found.
+  std::optional<NodePtr> findInSpan(
+      size_t cursor,
+      const std::function<bool(const NodePtr&)>& predicate) const;
+
+  WalkResult walk();
+
+  // Same as walk(), but within the limits.
+  WalkResult walk(const WalkLimits& limits);
+
   // Returns all candidate values at the location. If spans are not empty and
   // loc is at the end of the spans, (loc - 1) is used, so that the caller does
   // not have to care about this boundary condition.
   std::vector<Candidate> candidatesAt(size_t loc);
 
+  // Same as candidatesAt(), but returns views into the nodes of the grid, and
+  // the list is cached per location. The list and the views remain valid until
+  // the next insertion, deletion, clear, or restore; overriding a candidate
+  // does not change the list and so does not invalidate them, unless the
+  // override has to replace nodes shared with a snapshot (see snapshot()).
+  const std::vector<CandidateView>& candidateViewsAt(size_t loc);
+
+  // Same as candidateViewsAt(), but a value found in several overlapping nodes
+  // is only listed once, at its first (that is, longest node's) position.
+  const std::vector<CandidateView>& uniqueCandidateViewsAt(size_t loc);
+
   // Adds weight to the node with the unigram that has the designated candidate
   // value and applies the desired override type, essentially resulting in user
   // override. An overridden node would influence the grid walk to favor walking
@@ -216,7 +337,7 @@ class ReadingGrid {
     void clear();
     void add(const NodePtr& node);
     void removeNodesOfOrLongerThan(size_t length);
-    [[nodiscard]] NodePtr nodeOf(size_t length) const;
+    [[nodiscard]] const NodePtr& nodeOf(size_t length) const;
     [[nodiscard]] size_t maxLength() const { return maxLength_; }
 
    protected:
@@ -224,59 +345,136 @@ class ReadingGrid {
     size_t maxLength_ = 0;
   };
 
-  // A language model wrapper that always returns score-ranked unigrams.
-  class ScoreRankedLanguageModel : public LanguageModel {
-   public:
-    explicit ScoreRankedLanguageModel(std::shared_ptr<LanguageModel> lm)
-        : lm_(std::move(lm)) {
-      assert(lm_ != nullptr);
-    }
-    std::vector<Unigram> getUnigrams(const std::string& reading) override;
-    bool hasUnigrams(const std::string& reading) override;
-
-   protected:
-    std::shared_ptr<LanguageModel> lm_;
-  };
-
-  [[nodiscard]] const std::vector<Span>& spans() const { return spans_; }
+  // The spans and the readings are kept in gap buffers, so that edits at the
+  // cursor do not have to shift the rest of a long composing buffer.
+  [[nodiscard]] const GapBuffer<Span>& spans() const {
+    return contents_->spans;
+  }
 
-  [[nodiscard]] const std::vector<std::string>& readings() const {
-    return readings_;
+  [[nodiscard]] const GapBuffer<std::string>& readings() const {
+    return contents_->readings;
   }
 
+  class Snapshot;
+
+  // Captures the readings, the nodes with their overrides, and the cursor, so
+  // that restore() can bring the grid back to this point, for example to undo
+  // an override or a speculative insertion. Both are O(1): the grid and its
+  // snapshots share their contents, and the grid only copies them on its
+  // first edit after a snapshot is taken (or restored). The copy is shallow:
+  // the nodes themselves stay shared, and an override replaces the nodes it
+  // changes instead of changing them in place.
+  //
+  // Memory: a snapshot keeps one version of the readings, the spans (one
+  // array of kMaximumSpanLength node pointers per reading) and the span score
+  // rows (64 bytes or more per reading) alive, and that version is only
+  // duplicated once the grid is edited; the nodes are only duplicated when
+  // they are replaced by an edit or an override. Holding k snapshots that the
+  // grid has since diverged from costs at most k such copies of
+  // O(length()) size. Dropping a snapshot frees whatever only it still uses.
+  [[nodiscard]] Snapshot snapshot() const;
+
+  void restore(const Snapshot& snapshot);
+
+  // The work done by all the edits since the grid was created.
+  [[nodiscard]] const UpdateStats& updateStats() const { return updateStats_; }
+
  protected:
   size_t cursor_ = 0;
   std::string separator_ = kDefaultSeparator;
-  std::vector<std::string> readings_;
-  std::vector<Span> spans_;
   ScoreRankedLanguageModel lm_;
 
+  // The scores of the nodes in a span, indexed by (spanning length - 1). A
+  // missing node has the score of negative infinity.
+  struct alignas(64) SpanScores {
+    std::array<double, kMaximumSpanLength> scores;
+    SpanScores() { scores.fill(-std::numeric_limits<double>::infinity()); }
+  };
+
+  // What a snapshot shares with the grid.
+  struct Contents {
+    GapBuffer<std::string> readings;
+    GapBuffer<Span> spans;
+
+    // A table that mirrors spans, so that the walk reads packed doubles
+    // instead of following node pointers and computing each node's score. It
+    // must be synced whenever a node in a span is added, removed, or
+    // overridden.
+    GapBuffer<SpanScores> spanScores;
+
+    // Shared by every copy of the contents, so that its use count tells
+    // whether the nodes may also be in another copy.
+    std::shared_ptr<const void> nodeOwners = std::make_shared<char>();
+  };
+
+  std::shared_ptr<Contents> contents_ = std::make_shared<Contents>();
+
+  // Must be called before changing the contents.
+  void copyContentsIfShared();
+
+  // Whether a node must be replaced instead of changed in place.
+  [[nodiscard]] bool mayShareNodes() const;
+
+  // The candidates at a location, and the deduplicated ones once asked for.
+  struct CandidateList {
+    std::vector<CandidateView> all;
+    std::optional<std::vector<CandidateView>> unique;
+  };
+
+  // The cached candidates, keyed by the location used for looking up the
+  // overlapping nodes. Cleared whenever the grid is edited.
+  std::unordered_map<size_t, CandidateList> candidateCache_;
+
+  CandidateList* candidateListAt(size_t loc);
+
   // Internal methods for maintaining the grid.
 
   void expandGridAt(size_t loc);
   void shrinkGridAt(size_t loc);
   void removeAffectedNodes(size_t loc);
   void insert(size_t loc, const NodePtr& node);
-  std::string combineReading(std::vector<std::string>::const_iterator begin,
-                             std::vector<std::string>::const_iterator end);
-  bool hasNodeAt(size_t loc, size_t readingLen, const std::string& reading);
-  void update();
+  void syncSpanScores(size_t loc);
+  std::string combineReading(GapBuffer<std::string>::const_iterator begin,
+                             GapBuffer<std::string>::const_iterator end);
+
+  // Populates the nodes that overlap the readings in [loc, loc + length), which
+  // were just inserted. With a length of 0, populates the nodes that straddle
+  // loc, where a reading was just deleted. The nodes that overlapped the
+  // changed readings must have been removed by removeAffectedNodes(); all
+  // other nodes are still valid and are left alone.
+  void update(size_t loc, size_t length);
+
+  UpdateStats updateStats_;
 
   // Internal implementation of overrideCandidate, with an optional reading.
   bool overrideCandidate(size_t loc, const std::string* reading,
                          const std::string& value,
                          Node::OverrideType overrideType);
 
-  struct NodeInSpan {
-    NodePtr node;
-    size_t spanIndex = 0;
-  };
-
   // Find all nodes that overlap with the location. The return value is a list
   // of nodes along with their starting location in the grid.
   std::vector<NodeInSpan> overlappingNodesAt(size_t loc) const;
 };
 
+template <size_t MaxSpanLength>
+class BasicReadingGrid<MaxSpanLength>::Snapshot {
+ private:
+  Snapshot(std::shared_ptr<Contents> contents, size_t cursor)
+      : contents_(std::move(contents)), cursor_(cursor) {}
+
+  std::shared_ptr<Contents> contents_;
+  size_t cursor_;
+
+  friend class BasicReadingGrid;
+};
+
+// The grid used by the input method.
+using ReadingGrid = BasicReadingGrid<8>;
+
+extern template class BasicReadingGrid<4>;
+extern template class BasicReadingGrid<8>;
+extern template class BasicReadingGrid<12>;
+
 }  // namespace Formosa::Gramambular2
 
 #endif  // SRC_ENGINE_GRAMAMBULAR2_READING_GRID_H_
@@ -25,8 +25,11 @@
 
 #include <algorithm>
 #include <iostream>
+#include <iterator>
 #include <map>
+#include <limits>
 #include <memory>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -172,6 +175,26 @@ static bool Contains(const std::vector<ReadingGrid::Candidate>& candidates,
                      [&str](const auto& v) { return v.value == str; });
 }
 
+// The readings of kSampleData, for the tests that build long or random grids.
+constexpr const char* kSampleReadings[] = {"ㄍㄠ", "ㄎㄜ", "ㄐㄧˋ", "ㄍㄨㄥ",
+                                           "ㄙ", "ㄉㄜ˙", "ㄋㄧㄢˊ", "ㄓㄨㄥ",
+                                           "ㄐㄧㄤˇ", "ㄐㄧㄣ"};
+
+// Returns the i-th reading of kSampleReadings, wrapping around.
+static std::string SampleReading(size_t i) {
+  return kSampleReadings[i % std::size(kSampleReadings)];
+}
+
+// Returns an empty grid of kSampleData, whose readings are not separated. The
+// grids that a test compares are given the same LM.
+template <typename Grid = ReadingGrid>
+static Grid MakeSampleGrid(std::shared_ptr<LanguageModel> lm =
+                               std::make_shared<SimpleLM>(kSampleData)) {
+  Grid grid(std::move(lm));
+  grid.setReadingSeparator("");
+  return grid;
+}
+
 TEST(ReadingGridTest, Span) {
   SimpleLM lm(kSampleData);
   ReadingGrid::Span span;
@@ -586,6 +609,402 @@ TEST(ReadingGridTest, LongGridInsertion) {
   ASSERT_EQ(grid.spans()[8].nodeOf(6)->reading(), "hijklm");
 }
 
+TEST(ReadingGridTest, InsertReadings) {
+  ReadingGrid grid(std::make_shared<MockLM>());
+  grid.setReadingSeparator(";");
+  ASSERT_FALSE(grid.insertReadings({}));
+  ASSERT_TRUE(grid.insertReadings({"a", "b", "c"}));
+
+  ASSERT_EQ(grid.cursor(), 3);
+  ASSERT_EQ(grid.length(), 3);
+  ASSERT_EQ(grid.spans().size(), 3);
+  ASSERT_EQ(grid.spans()[0].maxLength(), 3);
+  ASSERT_EQ(grid.spans()[0].nodeOf(1)->reading(), "a");
+  ASSERT_EQ(grid.spans()[0].nodeOf(2)->reading(), "a;b");
+  ASSERT_EQ(grid.spans()[0].nodeOf(3)->reading(), "a;b;c");
+  ASSERT_EQ(grid.spans()[1].maxLength(), 2);
+  ASSERT_EQ(grid.spans()[1].nodeOf(1)->reading(), "b");
+  ASSERT_EQ(grid.spans()[1].nodeOf(2)->reading(), "b;c");
+  ASSERT_EQ(grid.spans()[2].maxLength(), 1);
+  ASSERT_EQ(grid.spans()[2].nodeOf(1)->reading(), "c");
+}
+
+TEST(ReadingGridTest, InsertReadingsWithInvalidReading) {
+  ReadingGrid grid(std::make_shared<SimpleLM>(kSampleData));
+  grid.setReadingSeparator("");
+  ASSERT_TRUE(grid.insertReading("ㄍㄠ"));
+  ASSERT_FALSE(grid.insertReadings({"ㄎㄜ", "ㄅㄚ", "ㄐㄧˋ"}));
+  ASSERT_FALSE(grid.insertReadings({"ㄎㄜ", ""}));
+  ASSERT_EQ(grid.cursor(), 1);
+  ASSERT_EQ(grid.length(), 1);
+  ASSERT_EQ(grid.spans().size(), 1);
+  ASSERT_EQ(grid.spans()[0].maxLength(), 1);
+}
+
+TEST(ReadingGridTest, InsertReadingsSameAsInsertReading) {
+  std::vector<std::string> readings;
+  for (size_t i = 0; i < 15; ++i) {
+    readings.push_back(SampleReading(i));
+  }
+  auto lm = std::make_shared<SimpleLM>(kSampleData);
+
+  ReadingGrid expected = MakeSampleGrid(lm);
+  for (const auto& reading : readings) {
+    ASSERT_TRUE(expected.insertReading(reading));
+  }
+
+  // Insert the first and the last three readings, then fill the middle.
+  ReadingGrid grid = MakeSampleGrid(lm);
+  ASSERT_TRUE(grid.insertReadings({readings.begin(), readings.begin() + 3}));
+  ASSERT_TRUE(grid.insertReadings({readings.end() - 3, readings.end()}));
+  grid.setCursor(3);
+  ASSERT_TRUE(grid.insertReadings({readings.begin() + 3, readings.end() - 3}));
+
+  ASSERT_EQ(grid.cursor(), readings.size() - 3);
+  ASSERT_EQ(grid.readings(), expected.readings());
+  ASSERT_EQ(grid.spans().size(), expected.spans().size());
+  for (size_t i = 0; i < grid.spans().size(); ++i) {
+    ASSERT_EQ(grid.spans()[i].maxLength(), expected.spans()[i].maxLength());
+    for (size_t j = 1; j <= ReadingGrid::kMaximumSpanLength; ++j) {
+      auto node = grid.spans()[i].nodeOf(j);
+      auto expectedNode = expected.spans()[i].nodeOf(j);
+      ASSERT_EQ(node == nullptr, expectedNode == nullptr);
+      if (node != nullptr) {
+        ASSERT_EQ(node->reading(), expectedNode->reading());
+      }
+    }
+  }
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            expected.walk().valuesAsStrings());
+}
+
+// Each edit only looks up the combined readings that overlap what changed.
+TEST(ReadingGridTest, UpdateOnlyLooksUpChangedReadings) {
+  auto lm = std::make_shared<SimpleLM>(kSampleData);
+  ReadingGrid grid = MakeSampleGrid(lm);
+  for (size_t i = 0; i < 20; ++i) {
+    ASSERT_TRUE(grid.insertReading(SampleReading(i)));
+  }
+
+  auto checkSameAsNewGrid = [&]() {
+    ReadingGrid expected = MakeSampleGrid(lm);
+    for (const auto& reading : grid.readings()) {
+      ASSERT_TRUE(expected.insertReading(reading));
+    }
+    ASSERT_EQ(grid.spans().size(), expected.spans().size());
+    for (size_t i = 0; i < grid.spans().size(); ++i) {
+      for (size_t j = 1; j <= ReadingGrid::kMaximumSpanLength; ++j) {
+        auto node = grid.spans()[i].nodeOf(j);
+        auto expectedNode = expected.spans()[i].nodeOf(j);
+        ASSERT_EQ(node == nullptr, expectedNode == nullptr) << i << " " << j;
+        if (node != nullptr) {
+          ASSERT_EQ(node->reading(), expectedNode->reading());
+        }
+      }
+    }
+  };
+
+  // At the end, only the nodes ending at the new reading.
+  uint64_t lookups = grid.updateStats().lookups;
+  ASSERT_TRUE(grid.insertReading("ㄙ"));
+  ASSERT_EQ(grid.updateStats().lookups - lookups,
+            ReadingGrid::kMaximumSpanLength);
+  checkSameAsNewGrid();
+
+  // In the middle, the nodes that overlap the new reading: 8 + 7 + ... + 1.
+  grid.setCursor(10);
+  lookups = grid.updateStats().lookups;
+  ASSERT_TRUE(grid.insertReading("ㄎㄜ"));
+  ASSERT_EQ(grid.updateStats().lookups - lookups, 36);
+  checkSameAsNewGrid();
+
+  // After a deletion, the nodes that straddle it: 7 + 6 + ... + 1.
+  lookups = grid.updateStats().lookups;
+  ASSERT_TRUE(grid.deleteReadingBeforeCursor());
+  ASSERT_EQ(grid.updateStats().lookups - lookups, 28);
+  ASSERT_EQ(grid.updateStats().combinedReadings,
+            grid.updateStats().lookups);
+  checkSameAsNewGrid();
+
+  // Nothing straddles the start.
+  grid.setCursor(0);
+  lookups = grid.updateStats().lookups;
+  ASSERT_TRUE(grid.deleteReadingAfterCursor());
+  ASSERT_EQ(grid.updateStats().lookups, lookups);
+  checkSameAsNewGrid();
+}
+
+// The node-based walk that ReadingGrid::walk() used before the span scores
+// were kept in a packed table. Used as the reference in the differential test.
+template <typename Grid>
+static std::vector<ReadingGrid::NodePtr> ReferenceWalk(const Grid& grid) {
+  struct State {
+    size_t fromIndex = 0;
+    ReadingGrid::NodePtr fromNode = nullptr;
+    double maxScore = -std::numeric_limits<double>::infinity();
+  };
+
+  const size_t readingLen = grid.readings().size();
+  std::vector<State> viterbi(readingLen + 1);
+  viterbi[0].maxScore = 0.0;
+  for (size_t i = 0; i < readingLen; ++i) {
+    const typename Grid::Span& span = grid.spans()[i];
+    for (size_t spanLen = 1; spanLen <= span.maxLength(); ++spanLen) {
+      const ReadingGrid::NodePtr& node = span.nodeOf(spanLen);
+      if (node == nullptr) {
+        continue;
+      }
+      double score = viterbi[i].maxScore + node->score();
+      State& target = viterbi[i + spanLen];
+      if (score > target.maxScore) {
+        target = {i, node, score};
+      }
+    }
+  }
+
+  std::vector<ReadingGrid::NodePtr> nodes;
+  for (size_t curr = readingLen; curr > 0; curr = viterbi[curr].fromIndex) {
+    nodes.push_back(viterbi[curr].fromNode);
+  }
+  std::reverse(nodes.begin(), nodes.end());
+  return nodes;
+}
+
+// Applies random edits and overrides to the grid, and checks the walk against
+// the reference walk after each of them.
+template <typename Grid>
+static void CheckWalkAgainstReferenceWalk() {
+  Grid grid = MakeSampleGrid<Grid>();
+  std::mt19937 rng(42);
+
+  for (int round = 0; round < 2000; ++round) {
+    size_t size = grid.readings().size();
+    grid.setCursor(size ? rng() % (size + 1) : 0);
+    int op = static_cast<int>(rng() % 10);
+    if (op < 5 || size < 4) {
+      ASSERT_TRUE(grid.insertReading(SampleReading(rng())));
+    } else if (op < 7) {
+      if (!grid.deleteReadingBeforeCursor()) {
+        grid.deleteReadingAfterCursor();
+      }
+    } else {
+      size_t loc = rng() % size;
+      auto candidates = grid.candidatesAt(loc);
+      ASSERT_FALSE(candidates.empty());
+      using OverrideType = ReadingGrid::Node::OverrideType;
+      auto type = (rng() % 2)
+                      ? OverrideType::kOverrideValueWithHighScore
+                      : OverrideType::kOverrideValueWithScoreFromTopUnigram;
+      ASSERT_TRUE(grid.overrideCandidate(
+          loc, candidates[rng() % candidates.size()], type));
+    }
+
+    ReadingGrid::WalkResult result = grid.walk();
+    ASSERT_EQ(result.nodes, ReferenceWalk(grid)) << "round " << round;
+    ASSERT_EQ(result.totalReadings, grid.readings().size());
+  }
+}
+
+TEST(ReadingGridTest, WalkSameAsReferenceWalk) {
+  CheckWalkAgainstReferenceWalk<BasicReadingGrid<4>>();
+  CheckWalkAgainstReferenceWalk<BasicReadingGrid<8>>();
+  CheckWalkAgainstReferenceWalk<BasicReadingGrid<12>>();
+}
+
+static void CheckPathCoversGrid(const ReadingGrid& grid,
+                                const ReadingGrid::WalkResult& result) {
+  size_t pos = 0;
+  for (const auto& node : result.nodes) {
+    ASSERT_EQ(grid.spans()[pos].nodeOf(node->spanningLength()), node);
+    pos += node->spanningLength();
+  }
+  ASSERT_EQ(pos, grid.length());
+  ASSERT_EQ(result.totalReadings, grid.length());
+}
+
+TEST(ReadingGridTest, WalkWithoutLimitsSameAsWalk) {
+  ReadingGrid grid = MakeSampleGrid();
+  for (const char* reading : kSampleReadings) {
+    grid.insertReading(reading);
+  }
+  auto result = grid.walk(ReadingGrid::WalkLimits());
+  ASSERT_FALSE(result.partial);
+  ASSERT_EQ(result.nodes, grid.walk().nodes);
+}
+
+TEST(ReadingGridTest, WalkWithDeadline) {
+  ReadingGrid grid = MakeSampleGrid();
+  std::vector<std::string> readings;
+  for (size_t i = 0; i < 20000; ++i) {
+    readings.push_back(SampleReading(i));
+  }
+  ASSERT_TRUE(grid.insertReadings(readings));
+
+  ReadingGrid::WalkLimits limits;
+  limits.deadlineMicroseconds = 1;
+  auto result = grid.walk(limits);
+  ASSERT_TRUE(result.partial);
+  ASSERT_LT(result.vertices, grid.length());
+  CheckPathCoversGrid(grid, result);
+
+  // A generous deadline is the same as no deadline.
+  limits.deadlineMicroseconds = 60 * 1000 * 1000;
+  result = grid.walk(limits);
+  ASSERT_FALSE(result.partial);
+  ASSERT_EQ(result.nodes, grid.walk().nodes);
+}
+
+TEST(ReadingGridTest, StableReadingsDoNotChange) {
+  auto lm = std::make_shared<SimpleLM>(kSampleData);
+  std::mt19937 rng(39);
+
+  for (int round = 0; round < 50; ++round) {
+    ReadingGrid grid = MakeSampleGrid(lm);
+    std::vector<ReadingGrid::WalkResult> walks;
+    size_t length = 1 + rng() % 100;
+    for (size_t i = 0; i < length; ++i) {
+      ASSERT_TRUE(grid.insertReading(SampleReading(rng())));
+      walks.push_back(grid.walk());
+    }
+
+    // Every walk so far begins with the stable nodes of each earlier walk.
+    size_t stableWalks = 0;
+    for (size_t i = 0; i < walks.size(); ++i) {
+      const auto& earlier = walks[i];
+      ASSERT_LE(earlier.stableReadings, i + 1);
+      stableWalks += earlier.stableReadings > 0;
+      for (size_t j = i; j < walks.size(); ++j) {
+        size_t readings = 0;
+        for (size_t k = 0; readings < earlier.stableReadings; ++k) {
+          ASSERT_LT(k, walks[j].nodes.size());
+          ASSERT_EQ(walks[j].nodes[k], earlier.nodes[k]) << i << " " << j;
+          readings += earlier.nodes[k]->spanningLength();
+        }
+        ASSERT_EQ(readings, earlier.stableReadings);
+      }
+    }
+    if (length > 2 * ReadingGrid::kMaximumSpanLength) {
+      ASSERT_GT(stableWalks, 0);
+    }
+  }
+}
+
+TEST(ReadingGridTest, DropStableReadingsWhileTyping) {
+  auto lm = std::make_shared<SimpleLM>(kSampleData);
+  std::mt19937 rng(139);
+
+  for (int round = 0; round < 50; ++round) {
+    ReadingGrid full = MakeSampleGrid(lm);
+    ReadingGrid window = MakeSampleGrid(lm);
+    constexpr size_t kWindowLength = 10;
+
+    std::vector<std::string> committed;
+    size_t maxLength = 0;
+    size_t length = 1 + rng() % 300;
+    for (size_t i = 0; i < length; ++i) {
+      std::string reading = SampleReading(rng());
+      ASSERT_TRUE(full.insertReading(reading));
+      ASSERT_TRUE(window.insertReading(reading));
+      auto result = window.walk();
+      if (window.length() > kWindowLength && result.stableReadings > 0) {
+        size_t readings = 0;
+        for (const auto& node : result.nodes) {
+          if (readings == result.stableReadings) {
+            break;
+          }
+          committed.push_back(node->value());
+          readings += node->spanningLength();
+        }
+        window.dropReadingsBefore(result.stableReadings);
+        ASSERT_EQ(window.cursor(), window.length());
+      }
+      maxLength = std::max(maxLength, window.length());
+    }
+    for (const auto& value : window.walk().valuesAsStrings()) {
+      committed.push_back(value);
+    }
+
+    ASSERT_EQ(committed, full.walk().valuesAsStrings()) << round;
+    if (length > 100) {
+      ASSERT_LT(maxLength, length / 2);
+    }
+  }
+}
+
+TEST(ReadingGridTest, DropReadingsBefore) {
+  ReadingGrid grid = MakeSampleGrid();
+  for (const char* reading : kSampleReadings) {
+    grid.insertReading(reading);
+  }
+  grid.setCursor(7);
+  auto snapshot = grid.snapshot();
+
+  // 公司 goes with its first reading, leaving ㄙ on its own.
+  grid.dropReadingsBefore(4);
+  ASSERT_EQ(grid.length(), 6);
+  ASSERT_EQ(grid.cursor(), 3);
+  ASSERT_EQ(grid.readings()[0], "ㄙ");
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            (std::vector<std::string>{"斯", "的", "年中", "獎金"}));
+
+  grid.dropReadingsBefore(4);
+  ASSERT_EQ(grid.cursor(), 0);
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            (std::vector<std::string>{"獎金"}));
+
+  // The snapshot still has everything.
+  grid.restore(snapshot);
+  ASSERT_EQ(grid.length(), 10);
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            (std::vector<std::string>{"高科技", "公司", "的", "年中", "獎金"}));
+}
+
+TEST(ReadingGridTest, MaximumSpanLength) {
+  constexpr char kLongPhraseData[] = R"(
+a A -1
+b B -1
+c C -1
+d D -1
+e E -1
+f F -1
+g G -1
+h H -1
+i I -1
+j J -1
+abcde ABCDE -2
+abcdefghij ABCDEFGHIJ -3
+)";
+  auto lm = std::make_shared<SimpleLM>(kLongPhraseData);
+  std::vector<std::string> readings{"a", "b", "c", "d", "e",
+                                    "f", "g", "h", "i", "j"};
+
+  BasicReadingGrid<4> grid4(lm);
+  grid4.setReadingSeparator("");
+  ASSERT_TRUE(grid4.insertReadings(readings));
+  ASSERT_EQ(grid4.walk().valuesAsStrings(),
+            (std::vector<std::string>{"A", "B", "C", "D", "E", "F", "G", "H",
+                                      "I", "J"}));
+
+  ReadingGrid grid8(lm);
+  grid8.setReadingSeparator("");
+  ASSERT_TRUE(grid8.insertReadings(readings));
+  ASSERT_EQ(grid8.walk().valuesAsStrings(),
+            (std::vector<std::string>{"ABCDE", "F", "G", "H", "I", "J"}));
+
+  BasicReadingGrid<12> grid12(lm);
+  grid12.setReadingSeparator("");
+  ASSERT_TRUE(grid12.insertReadings(readings));
+  ASSERT_EQ(grid12.walk().valuesAsStrings(),
+            std::vector<std::string>{"ABCDEFGHIJ"});
+
+  // Deleting from the middle breaks the long phrase.
+  grid12.setCursor(5);
+  ASSERT_TRUE(grid12.deleteReadingBeforeCursor());
+  ASSERT_EQ(grid12.walk().valuesAsStrings(),
+            (std::vector<std::string>{"A", "B", "C", "D", "F", "G", "H", "I",
+                                      "J"}));
+}
+
 TEST(ReadingGridTest, WordSegmentationTest) {
   ReadingGrid grid(
       std::make_shared<SimpleLM>(kSampleData, /*readingIsFirstColumn=*/false));
@@ -751,6 +1170,191 @@ TEST(ReadingGridTest, DisambiguateCandidates) {
             (std::vector<std::string>{"高熱", "🔥", "危險"}));
 }
 
+TEST(ReadingGridTest, CandidateViews) {
+  ReadingGrid grid(std::make_shared<SimpleLM>(kSampleData));
+  grid.setReadingSeparator("");
+  grid.insertReading("ㄍㄠ");
+  grid.insertReading("ㄎㄜ");
+  grid.insertReading("ㄐㄧˋ");
+
+  for (size_t loc = 0; loc <= grid.length(); ++loc) {
+    auto candidates = grid.candidatesAt(loc);
+    const auto& views = grid.candidateViewsAt(loc);
+    ASSERT_EQ(candidates.size(), views.size());
+    for (size_t i = 0; i < views.size(); ++i) {
+      ASSERT_EQ(candidates[i].reading, views[i].reading());
+      ASSERT_EQ(candidates[i].value, views[i].value());
+      ASSERT_EQ(candidates[i].rawValue, views[i].rawValue());
+    }
+  }
+
+  // The list is cached, and overriding a candidate does not invalidate it.
+  const auto* views = &grid.candidateViewsAt(1);
+  ASSERT_EQ(views, &grid.candidateViewsAt(1));
+  ASSERT_TRUE(grid.overrideCandidate(1, "柯"));
+  ASSERT_EQ(views, &grid.candidateViewsAt(1));
+  ASSERT_EQ(views->front().value(), "高科技");
+
+  // An edit invalidates the list.
+  grid.setCursor(3);
+  grid.deleteReadingBeforeCursor();
+  const auto& newViews = grid.candidateViewsAt(1);
+  for (const auto& view : newViews) {
+    ASSERT_EQ(view.reading(), "ㄎㄜ");
+  }
+  ASSERT_EQ(newViews.size(), grid.candidatesAt(1).size());
+
+  grid.clear();
+  ASSERT_TRUE(grid.candidateViewsAt(0).empty());
+  ASSERT_TRUE(grid.uniqueCandidateViewsAt(0).empty());
+}
+
+TEST(ReadingGridTest, UniqueCandidateViews) {
+  std::string sampleData(kSampleData);
+  sampleData += R"(
+ㄏㄨㄛˇ 火 -3.6966
+ㄏㄨㄛˇ 🔥 -8
+ㄧㄢˋ 焰 -5.4466
+ㄏㄨㄛˇㄧㄢˋ 火焰 -5.6231
+ㄏㄨㄛˇㄧㄢˋ 🔥 -8
+)";
+
+  ReadingGrid grid(std::make_shared<SimpleLM>(sampleData.c_str()));
+  grid.setReadingSeparator("");
+  grid.insertReading("ㄏㄨㄛˇ");
+  grid.insertReading("ㄧㄢˋ");
+
+  std::vector<std::string> values;
+  for (const auto& view : grid.candidateViewsAt(0)) {
+    values.push_back(view.value());
+  }
+  ASSERT_EQ(values, (std::vector<std::string>{"火焰", "🔥", "火", "🔥"}));
+
+  const auto& unique = grid.uniqueCandidateViewsAt(0);
+  values.clear();
+  for (const auto& view : unique) {
+    values.push_back(view.value());
+  }
+  ASSERT_EQ(values, (std::vector<std::string>{"火焰", "🔥", "火"}));
+
+  // The first occurrence, from the longest node, is the one kept.
+  ASSERT_EQ(unique[1].reading(), "ㄏㄨㄛˇㄧㄢˋ");
+  ASSERT_TRUE(grid.overrideCandidate(0, unique[1].candidate()));
+  ASSERT_EQ(grid.walk().valuesAsStrings(), std::vector<std::string>{"🔥"});
+}
+
+TEST(ReadingGridTest, SnapshotAndRestore) {
+  ReadingGrid grid(std::make_shared<SimpleLM>(kSampleData));
+  grid.setReadingSeparator("");
+  grid.insertReading("ㄍㄠ");
+  grid.insertReading("ㄎㄜ");
+  grid.insertReading("ㄐㄧˋ");
+  ASSERT_EQ(grid.walk().valuesAsStrings(), std::vector<std::string>{"高科技"});
+  auto s0 = grid.snapshot();
+
+  ASSERT_TRUE(grid.overrideCandidate(0, "膏"));
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            (std::vector<std::string>{"膏", "科技"}));
+  auto s1 = grid.snapshot();
+
+  ASSERT_TRUE(grid.overrideCandidate(1, "柯"));
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            (std::vector<std::string>{"膏", "柯", "際"}));
+  auto s2 = grid.snapshot();
+
+  grid.setCursor(0);
+  ASSERT_TRUE(grid.deleteReadingAfterCursor());
+  ASSERT_EQ(grid.length(), 2);
+
+  // Undo one level at a time.
+  grid.restore(s2);
+  ASSERT_EQ(grid.length(), 3);
+  ASSERT_EQ(grid.cursor(), 3);
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            (std::vector<std::string>{"膏", "柯", "際"}));
+  grid.restore(s1);
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            (std::vector<std::string>{"膏", "科技"}));
+  grid.restore(s0);
+  ASSERT_EQ(grid.walk().valuesAsStrings(), std::vector<std::string>{"高科技"});
+
+  // Overriding after a restore leaves the other snapshots as they were.
+  ASSERT_TRUE(grid.overrideCandidate(2, "暨"));
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            (std::vector<std::string>{"高", "科", "暨"}));
+  grid.restore(s1);
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            (std::vector<std::string>{"膏", "科技"}));
+  grid.restore(s2);
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            (std::vector<std::string>{"膏", "柯", "際"}));
+
+  // A copy of the grid is independent of the original.
+  ReadingGrid copy = grid;
+  ASSERT_TRUE(copy.overrideCandidate(0, "高科技"));
+  ASSERT_EQ(copy.walk().valuesAsStrings(), std::vector<std::string>{"高科技"});
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            (std::vector<std::string>{"膏", "柯", "際"}));
+}
+
+// Applies random edits, overrides, snapshots, and restores to the grid. A
+// restored grid must walk and list candidates as it did when the snapshot was
+// taken, no matter what happened in between.
+TEST(ReadingGridTest, RandomSnapshotsAndRestores) {
+  ReadingGrid grid = MakeSampleGrid();
+  std::mt19937 rng(34);
+
+  struct Expected {
+    ReadingGrid::Snapshot snapshot;
+    size_t cursor;
+    std::vector<std::string> values;
+    std::vector<std::string> candidates;
+  };
+  auto candidateValues = [&grid]() {
+    std::vector<std::string> values;
+    for (size_t i = 0; i <= grid.length(); ++i) {
+      for (const auto& view : grid.candidateViewsAt(i)) {
+        values.push_back(view.value());
+      }
+    }
+    return values;
+  };
+  std::vector<Expected> snapshots;
+
+  for (int round = 0; round < 2000; ++round) {
+    size_t size = grid.length();
+    grid.setCursor(size ? rng() % (size + 1) : 0);
+    int op = static_cast<int>(rng() % 12);
+    if (op < 4 || size < 4) {
+      ASSERT_TRUE(grid.insertReading(SampleReading(rng())));
+    } else if (op < 6) {
+      if (!grid.deleteReadingBeforeCursor()) {
+        grid.deleteReadingAfterCursor();
+      }
+    } else if (op < 9) {
+      size_t loc = rng() % size;
+      auto candidates = grid.candidatesAt(loc);
+      ASSERT_TRUE(grid.overrideCandidate(
+          loc, candidates[rng() % candidates.size()]));
+    } else if (op < 11 || snapshots.empty()) {
+      snapshots.push_back({grid.snapshot(), grid.cursor(),
+                           grid.walk().valuesAsStrings(), candidateValues()});
+      if (snapshots.size() > 8) {
+        snapshots.erase(snapshots.begin());
+      }
+    } else {
+      const Expected& expected = snapshots[rng() % snapshots.size()];
+      grid.restore(expected.snapshot);
+      ASSERT_EQ(grid.cursor(), expected.cursor) << "round " << round;
+      ASSERT_EQ(grid.walk().valuesAsStrings(), expected.values)
+          << "round " << round;
+      ASSERT_EQ(candidateValues(), expected.candidates) << "round " << round;
+    }
+
+    ASSERT_EQ(grid.walk().nodes, ReferenceWalk(grid)) << "round " << round;
+  }
+}
+
 TEST(ReadingGridTest, FindInSpan1) {
   std::string sampleData(kSampleData);
   sampleData += R"(
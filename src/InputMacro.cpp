@@ -23,13 +23,20 @@
 
 #include "InputMacro.h"
 
+#include <sys/stat.h>
 #include <unicode/gregocal.h>
 #include <unicode/smpdtfmt.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <memory>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -47,6 +54,8 @@ int GetCurrentYear();
 std::string GetGanzhi(int year);
 std::string GetChineseZodiac(int year);
 std::string ConvertWeekdayUnit(std::string original);
+std::time_t PeriodEnd(InputMacro::Period period, std::time_t now);
+bool RefreshTimeZone(std::time_t now);
 void AddMacro(std::unordered_map<std::string, std::unique_ptr<InputMacro>>& m,
               std::unique_ptr<InputMacro> p);
 }  // namespace
@@ -124,6 +133,11 @@ class InputMacroDateTime : public InputMacro {
   [[nodiscard]] std::string replacement() const override {
     return FormatTime(timeStyle_);
   }
+  // The short style has no seconds.
+  [[nodiscard]] Period period() const override {
+    return timeStyle_ == icu::DateFormat::EStyle::kShort ? Period::kMinute
+                                                          : Period::kSecond;
+  }
 
  private:
   std::string name_;
@@ -561,10 +575,33 @@ InputMacroController::InputMacroController() {
   AddMacro(macros_, std::make_unique<InputMacroNextYearChineseZodiac>());
 }
 
-std::string InputMacroController::handle(const std::string& input) const {
+std::string InputMacroController::handle(const std::string& input,
+                                         std::time_t* expiry) const {
+  std::time_t now = std::time(nullptr);
+  if (RefreshTimeZone(now)) {
+    cache_.clear();
+  }
+  if (expiry != nullptr) {
+    *expiry = 0;
+  }
+
+  const auto& cached = cache_.find(input);
+  if (cached != cache_.cend() && now < cached->second.expiry) {
+    if (expiry != nullptr) {
+      *expiry = std::min(cached->second.expiry, now + 1);
+    }
+    return cached->second.replacement;
+  }
+
   const auto& it = macros_.find(input);
   if (it != macros_.cend()) {
-    return it->second->replacement();
+    std::string replacement = it->second->replacement();
+    std::time_t end = PeriodEnd(it->second->period(), now);
+    cache_[input] = CachedReplacement{end, replacement};
+    if (expiry != nullptr) {
+      *expiry = std::min(end, now + 1);
+    }
+    return replacement;
   }
   return input;
 }
@@ -580,13 +617,113 @@ icu::Locale CreateLocale(const std::string& calendarName) {
   return icu::Locale::createCanonical(calendarNameBase.c_str());
 }
 
-std::unique_ptr<icu::Calendar> CreateCalendar(const icu::Locale& locale) {
-  UErrorCode status = U_ZERO_ERROR;
-  icu::TimeZone* timezone = icu::TimeZone::createDefault();
-  std::unique_ptr<icu::Calendar> calendar(
-      icu::Calendar::createInstance(timezone, locale, status));
-  calendar->setTime(icu::Calendar::getNow(), status);
-  return calendar;
+// Returns an identity of the host time zone, which changes when either the TZ
+// environment variable or the /etc/localtime link is changed.
+std::string HostTimeZoneId() {
+  const char* tz = getenv("TZ");
+  std::string id = tz != nullptr ? tz : "";
+  struct stat st {};
+  if (lstat("/etc/localtime", &st) == 0) {
+    id += ":" + std::to_string(st.st_ino) + ":" + std::to_string(st.st_mtime);
+  }
+  return id;
+}
+
+// Keeps the ICU calendars and formatters, which take tens of microseconds to
+// create, for reuse by the macros. All of them are created for the default
+// time zone, so the pool is emptied when the host time zone changes.
+class FormatterPool {
+ public:
+  static FormatterPool& shared() {
+    thread_local FormatterPool pool;
+    return pool;
+  }
+
+  FormatterPool() : timeZoneId_(HostTimeZoneId()) {}
+
+  // Updates ICU's default time zone if the host time zone has changed, and
+  // returns whether it has. The host is checked at most once a second.
+  bool refreshTimeZone(std::time_t now) {
+    if (now == lastTimeZoneCheck_) {
+      return false;
+    }
+    lastTimeZoneCheck_ = now;
+    std::string timeZoneId = HostTimeZoneId();
+    if (timeZoneId == timeZoneId_) {
+      return false;
+    }
+    timeZoneId_ = std::move(timeZoneId);
+    icu::TimeZone::adoptDefault(icu::TimeZone::detectHostTimeZone());
+    calendars_.clear();
+    styleFormats_.clear();
+    patternFormats_.clear();
+    gregorianCalendar_ = nullptr;
+    return true;
+  }
+
+  // Returns the calendar of the name, set to now.
+  icu::Calendar* calendar(const std::string& calendarName) {
+    auto& calendar = calendars_[calendarName];
+    if (calendar == nullptr) {
+      UErrorCode status = U_ZERO_ERROR;
+      calendar.reset(icu::Calendar::createInstance(
+          icu::TimeZone::createDefault(), CreateLocale(calendarName), status));
+    }
+    UErrorCode status = U_ZERO_ERROR;
+    calendar->setTime(icu::Calendar::getNow(), status);
+    return calendar.get();
+  }
+
+  icu::GregorianCalendar* gregorianCalendar() {
+    if (gregorianCalendar_ == nullptr) {
+      UErrorCode status = U_ZERO_ERROR;
+      gregorianCalendar_ = std::make_unique<icu::GregorianCalendar>(
+          icu::TimeZone::createDefault(), status);
+    }
+    UErrorCode status = U_ZERO_ERROR;
+    gregorianCalendar_->setTime(icu::Calendar::getNow(), status);
+    return gregorianCalendar_.get();
+  }
+
+  icu::DateFormat* styleFormat(const std::string& calendarName,
+                               icu::DateFormat::EStyle dateStyle,
+                               icu::DateFormat::EStyle timeStyle) {
+    auto& format = styleFormats_[std::make_tuple(calendarName, dateStyle,
+                                                 timeStyle)];
+    if (format == nullptr) {
+      format.reset(icu::DateFormat::createDateTimeInstance(
+          dateStyle, timeStyle, CreateLocale(calendarName)));
+    }
+    return format.get();
+  }
+
+  icu::SimpleDateFormat* patternFormat(const std::string& calendarName,
+                                       const icu::UnicodeString& pattern) {
+    auto& format = patternFormats_[std::make_pair(calendarName, pattern)];
+    if (format == nullptr) {
+      UErrorCode status = U_ZERO_ERROR;
+      format = std::make_unique<icu::SimpleDateFormat>(
+          pattern, CreateLocale(calendarName), status);
+    }
+    return format.get();
+  }
+
+ private:
+  std::string timeZoneId_;
+  std::time_t lastTimeZoneCheck_ = 0;
+  std::map<std::string, std::unique_ptr<icu::Calendar>> calendars_;
+  std::unique_ptr<icu::GregorianCalendar> gregorianCalendar_;
+  std::map<std::tuple<std::string, icu::DateFormat::EStyle,
+                      icu::DateFormat::EStyle>,
+           std::unique_ptr<icu::DateFormat>>
+      styleFormats_;
+  std::map<std::pair<std::string, icu::UnicodeString>,
+           std::unique_ptr<icu::SimpleDateFormat>>
+      patternFormats_;
+};
+
+bool RefreshTimeZone(std::time_t now) {
+  return FormatterPool::shared().refreshTimeZone(now);
 }
 
 std::string FormatWithStyle(const std::string& calendarName, int yearOffset,
@@ -594,14 +731,14 @@ std::string FormatWithStyle(const std::string& calendarName, int yearOffset,
                             icu::DateFormat::EStyle timeStyle) {
   UErrorCode status = U_ZERO_ERROR;
 
-  const icu::Locale locale = CreateLocale(calendarName);
-  std::unique_ptr<icu::Calendar> calendar = CreateCalendar(locale);
+  FormatterPool& pool = FormatterPool::shared();
+  icu::Calendar* calendar = pool.calendar(calendarName);
 
   calendar->add(icu::Calendar::YEAR, yearOffset, status);
   calendar->add(icu::Calendar::DATE, dayOffset, status);
 
-  std::unique_ptr<icu::DateFormat> dateFormatter(
-      icu::DateFormat::createDateTimeInstance(dateStyle, timeStyle, locale));
+  icu::DateFormat* dateFormatter =
+      pool.styleFormat(calendarName, dateStyle, timeStyle);
   icu::UnicodeString formattedDate;
   icu::FieldPosition fieldPosition;
   dateFormatter->format(*calendar, formattedDate, fieldPosition);
@@ -616,15 +753,16 @@ std::string FormatWithPattern(const std::string& calendarName, int yearOffset,
                               const icu::UnicodeString& pattern) {
   UErrorCode status = U_ZERO_ERROR;
 
-  const icu::Locale locale = CreateLocale(calendarName);
-  std::unique_ptr<icu::Calendar> calendar = CreateCalendar(locale);
+  FormatterPool& pool = FormatterPool::shared();
+  icu::Calendar* calendar = pool.calendar(calendarName);
 
   calendar->add(icu::Calendar::YEAR, yearOffset, status);
   calendar->add(icu::Calendar::DATE, dateOffset, status);
 
-  icu::SimpleDateFormat dateFormatter(pattern, locale, status);
+  icu::SimpleDateFormat* dateFormatter =
+      pool.patternFormat(calendarName, pattern);
   icu::UnicodeString formattedDate;
-  dateFormatter.format(calendar->getTime(status), formattedDate, status);
+  dateFormatter->format(calendar->getTime(status), formattedDate, status);
 
   std::string output;
   formattedDate.toUTF8String(output);
@@ -655,9 +793,9 @@ std::string FormatTimeZone(icu::TimeZone::EDisplayType type) {
 
 int GetCurrentYear() {
   UErrorCode status = U_ZERO_ERROR;
-  icu::GregorianCalendar calendar(icu::TimeZone::createDefault(), status);
-  calendar.setTime(icu::Calendar::getNow(), status);
-  int32_t year = calendar.get(UCalendarDateFields::UCAL_YEAR, status);
+  icu::GregorianCalendar* calendar =
+      FormatterPool::shared().gregorianCalendar();
+  int32_t year = calendar->get(UCalendarDateFields::UCAL_YEAR, status);
   return year;
 }
 
@@ -672,25 +810,25 @@ int getYearBase(int year) {
 // NOLINTEND(readability-magic-numbers)
 
 std::string GetGanzhi(int year) {
-  const std::vector<std::string> gan(
-      {"癸", "甲", "乙", "丙", "丁", "戊", "己", "庚", "辛", "壬"});
-  const std::vector<std::string> zhi(
-      {"亥", "子", "丑", "寅", "卯", "辰", "巳", "午", "未", "申", "酉", "戌"});
+  static const char* const kGan[] = {"癸", "甲", "乙", "丙", "丁",
+                                     "戊", "己", "庚", "辛", "壬"};
+  static const char* const kZhi[] = {"亥", "子", "丑", "寅", "卯", "辰",
+                                     "巳", "午", "未", "申", "酉", "戌"};
   size_t base = static_cast<size_t>(getYearBase(year));
-  size_t ganIndex = base % gan.size();
-  size_t zhiIndex = base % zhi.size();
-  return gan[ganIndex] + zhi[zhiIndex] + "年";
+  size_t ganIndex = base % std::size(kGan);
+  size_t zhiIndex = base % std::size(kZhi);
+  return std::string(kGan[ganIndex]) + kZhi[zhiIndex] + "年";
 }
 
 std::string GetChineseZodiac(int year) {
-  const std::vector<std::string> gan(
-      {"水", "木", "木", "火", "火", "土", "土", "金", "金", "水"});
-  const std::vector<std::string> zhi(
-      {"豬", "鼠", "牛", "虎", "兔", "龍", "蛇", "馬", "羊", "猴", "雞", "狗"});
+  static const char* const kGan[] = {"水", "木", "木", "火", "火",
+                                     "土", "土", "金", "金", "水"};
+  static const char* const kZhi[] = {"豬", "鼠", "牛", "虎", "兔", "龍",
+                                     "蛇", "馬", "羊", "猴", "雞", "狗"};
   size_t base = static_cast<size_t>(getYearBase(year));
-  size_t ganIndex = base % gan.size();
-  size_t zhiIndex = base % zhi.size();
-  return gan[ganIndex] + zhi[zhiIndex] + "年";
+  size_t ganIndex = base % std::size(kGan);
+  size_t zhiIndex = base % std::size(kZhi);
+  return std::string(kGan[ganIndex]) + kZhi[zhiIndex] + "年";
 }
 
 std::string ConvertWeekdayUnit(std::string original) {
@@ -700,6 +838,24 @@ std::string ConvertWeekdayUnit(std::string original) {
   return original.replace(original.find(src), src.length(), dst);
 }
 
+// Returns the time when the period that contains now ends, in local time.
+std::time_t PeriodEnd(InputMacro::Period period, std::time_t now) {
+  if (period == InputMacro::Period::kSecond) {
+    return now + 1;
+  }
+  std::tm local{};
+  localtime_r(&now, &local);
+  if (period == InputMacro::Period::kMinute) {
+    return now - local.tm_sec + 60;
+  }
+  local.tm_sec = 0;
+  local.tm_min = 0;
+  local.tm_hour = 0;
+  local.tm_mday += 1;
+  local.tm_isdst = -1;
+  return std::mktime(&local);
+}
+
 void AddMacro(std::unordered_map<std::string, std::unique_ptr<InputMacro>>& m,
               std::unique_ptr<InputMacro> p) {
   m.insert({p->name(), std::move(p)});
@@ -24,6 +24,7 @@
 #ifndef SRC_INPUTMACRO_H_
 #define SRC_INPUTMACRO_H_
 
+#include <ctime>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -31,19 +32,39 @@
 namespace McBopomofo {
 class InputMacro {
  public:
+  // The period of the local time in which a replacement stays the same.
+  enum class Period { kSecond, kMinute, kDay };
+
   virtual ~InputMacro() = default;
 
   [[nodiscard]] virtual std::string name() const = 0;
   [[nodiscard]] virtual std::string replacement() const = 0;
+  [[nodiscard]] virtual Period period() const { return Period::kDay; }
 };
 
+// Expands the macros. The language model asks for the macros on every lookup
+// of a reading that has them, so a replacement is kept until the end of the
+// period of its macro.
 class InputMacroController {
  public:
   InputMacroController();
-  std::string handle(const std::string& input) const;
+
+  // Returns the replacement of a macro, or the input if it is not a macro. If
+  // expiry is given, it is set to the time until which the replacement may be
+  // reused: the end of the period of the macro, but at most a second from now,
+  // since a change of the time zone is only noticed once a second. It is 0 if
+  // the input is not a macro.
+  std::string handle(const std::string& input,
+                     std::time_t* expiry = nullptr) const;
 
  private:
+  struct CachedReplacement {
+    std::time_t expiry;
+    std::string replacement;
+  };
+
   std::unordered_map<std::string, std::unique_ptr<InputMacro>> macros_;
+  mutable std::unordered_map<std::string, CachedReplacement> cache_;
 };
 
 }  // namespace McBopomofo
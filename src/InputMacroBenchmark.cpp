@@ -0,0 +1,129 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Engine/McBopomofoLM.h"
+#include "InputMacro.h"
+
+namespace {
+
+using InputMacroController = McBopomofo::InputMacroController;
+
+static const char* kMacroNames[] = {
+    "MACRO@DATE_TODAY_SHORT",
+    "MACRO@DATE_TODAY_MEDIUM",
+    "MACRO@DATE_TODAY_MEDIUM_ROC",
+    "MACRO@DATE_TODAY_MEDIUM_CHINESE",
+    "MACRO@DATE_TODAY_MEDIUM_JAPANESE",
+    "MACRO@DATE_TODAY_WEEKDAY",
+    "MACRO@DATE_YESTERDAY_SHORT",
+    "MACRO@DATE_TOMORROW_MEDIUM_JAPANESE",
+    "MACRO@THIS_YEAR_PLAIN",
+    "MACRO@THIS_YEAR_ROC",
+    "MACRO@THIS_YEAR_JAPANESE",
+    "MACRO@THIS_YEAR_GANZHI",
+    "MACRO@THIS_YEAR_CHINESE_ZODIAC",
+    "MACRO@TIME_NOW_SHORT",
+    "MACRO@TIME_NOW_MEDIUM",
+    "MACRO@TIMEZONE_STANDARD",
+};
+
+// A reading whose candidates are mostly macros, like ㄐㄧㄣ-ㄊㄧㄢ (今天).
+static const char* kMacroReading = "ㄐㄧㄣ-ㄊㄧㄢ";
+
+std::vector<std::string> GetMacroNames() {
+  return std::vector<std::string>(std::begin(kMacroNames),
+                                  std::end(kMacroNames));
+}
+
+std::string GetMacroHeavyData() {
+  std::string data = "# format org.openvanilla.mcbopomofo.sorted\n";
+  data += std::string(kMacroReading) + " 今天 -3.28959497\n";
+  for (const char* name : kMacroNames) {
+    data += std::string(kMacroReading) + " " + name + " -8\n";
+  }
+  return data;
+}
+
+// Every expansion misses the cache of a new controller, which measures the
+// formatting itself.
+static void BM_InputMacroExpandUncached(benchmark::State& state) {
+  std::vector<std::string> names = GetMacroNames();
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto controller = std::make_unique<InputMacroController>();
+    state.ResumeTiming();
+    for (const auto& name : names) {
+      benchmark::DoNotOptimize(controller->handle(name));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<int64_t>(names.size()));
+}
+BENCHMARK(BM_InputMacroExpandUncached);
+
+static void BM_InputMacroExpandCached(benchmark::State& state) {
+  std::vector<std::string> names = GetMacroNames();
+  InputMacroController controller;
+  for (auto _ : state) {
+    for (const auto& name : names) {
+      benchmark::DoNotOptimize(controller.handle(name));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          static_cast<int64_t>(names.size()));
+}
+BENCHMARK(BM_InputMacroExpandCached);
+
+// Looks up a reading with many macro candidates, which the LM never caches,
+// as the input method does on every keystroke that involves the reading. The
+// values of the macros are cached by the LM, as the input method sets it up.
+static void BM_InputMacroCandidates(benchmark::State& state) {
+  std::string data = GetMacroHeavyData();
+  McBopomofo::McBopomofoLM lm;
+  lm.loadLanguageModel(std::make_unique<McBopomofo::ParselessPhraseDB>(
+      data.c_str(), data.length()));
+  InputMacroController controller;
+  lm.setMacroExpander([&controller](const std::string& input) {
+    McBopomofo::McBopomofoLM::MacroExpansion expansion;
+    expansion.value = controller.handle(input, &expansion.expiry);
+    return expansion;
+  });
+
+  std::string reading = kMacroReading;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(lm.getUnigrams(reading));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_InputMacroCandidates);
+
+}  // namespace
+
+BENCHMARK_MAIN();
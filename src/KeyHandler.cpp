@@ -75,6 +75,18 @@ static const char* GetKeyboardLayoutName(
   // NOLINTEND(readability-else-after-return)
 }
 
+// Enters the Committing state for the text, if any, before the state.
+static std::unique_ptr<InputState> WithCommittedText(
+    const std::string& text, std::unique_ptr<InputState> state) {
+  if (text.empty()) {
+    return state;
+  }
+  auto seq = std::make_unique<InputStates::StateSequence>();
+  seq->push_back(std::make_unique<InputStates::Committing>(text));
+  seq->push_back(std::move(state));
+  return seq;
+}
+
 static bool MarkedPhraseExists(
     const std::shared_ptr<Formosa::Gramambular2::LanguageModel>& lm,
     const std::string& reading, const std::string& value) {
@@ -103,7 +115,8 @@ KeyHandler::KeyHandler(
     std::unique_ptr<LocalizedStrings> localizedStrings)
     : lm_(std::move(languageModel)),
       variantAnnotator_(std::move(variantAnnotator)),
-      grid_(lm_),
+      countingLM_(std::make_shared<LookupCountingLanguageModel>(lm_)),
+      grid_(countingLM_),
       userPhraseAdder_(std::move(userPhraseAdder)),
       localizedStrings_(std::move(localizedStrings)),
       userOverrideModel_(kUserOverrideModelCapacity, kObservedOverrideHalfLife),
@@ -115,6 +128,32 @@ KeyHandler::KeyHandler(
 bool KeyHandler::handle(Key key, McBopomofo::InputState* state,
                         StateCallback stateCallback,
                         ErrorCallback errorCallback) {
+  // The time includes the callbacks, since they are part of the latency that
+  // the user sees.
+  ScopedHistogramTimer timer(&telemetry_.keyMicroseconds);
+  uint64_t lookups = countingLM_->lookups();
+  // A walk that was cut short is only good for showing the composing buffer
+  // while typing. Any key other than one for the reading may commit the
+  // buffer, open the candidate panel, or move over the nodes, so the walk is
+  // completed first.
+  if (latestWalk_.partial) {
+    char simpleAscii =
+        (key.ctrlPressed || key.shiftPressed || key.isFromNumberPad)
+            ? '\0'
+            : key.ascii;
+    if (!reading_.isValidKey(simpleAscii)) {
+      walk(Formosa::Gramambular2::ReadingGrid::WalkLimits());
+    }
+  }
+  bool result = handleKey(key, state, std::move(stateCallback),
+                          std::move(errorCallback));
+  telemetry_.lmLookupsPerKey.record(countingLM_->lookups() - lookups);
+  return result;
+}
+
+bool KeyHandler::handleKey(Key key, McBopomofo::InputState* state,
+                           StateCallback stateCallback,
+                           ErrorCallback errorCallback) {
   if (key.ascii == '\\' && key.ctrlPressed) {
     auto seq = std::make_unique<InputStates::StateSequence>();
     seq->push_back(std::make_unique<InputStates::Empty>());
@@ -170,7 +209,7 @@ bool KeyHandler::handle(Key key, McBopomofo::InputState* state,
     std::string syllable = reading_.syllable().composedString();
     reading_.clear();
 
-    if (!lm_->hasUnigrams(syllable)) {
+    if (!countingLM_->hasUnigrams(syllable)) {
       errorCallback();
       if (grid_.length() == 0) {
         stateCallback(std::make_unique<InputStates::EmptyIgnoringPrevious>());
@@ -199,11 +238,12 @@ bool KeyHandler::handle(Key key, McBopomofo::InputState* state,
         walk();
       }
     }
+    std::string committed = autoCommitStableReadings();
     if (inputMode_ == McBopomofo::InputMode::McBopomofo &&
         associatedPhrasesEnabled_) {
       auto inputting = buildInputtingState();
       auto copy = std::make_unique<InputStates::Inputting>(*inputting);
-      stateCallback(std::move(inputting));
+      stateCallback(WithCommittedText(committed, std::move(inputting)));
       handleAssociatedPhrases(copy.get(), stateCallback, errorCallback, true);
     } else if (inputMode_ == McBopomofo::InputMode::PlainBopomofo) {
       auto inputting = buildInputtingState();
@@ -228,7 +268,7 @@ bool KeyHandler::handle(Key key, McBopomofo::InputState* state,
       }
     } else {
       auto inputting = buildInputtingState();
-      stateCallback(std::move(inputting));
+      stateCallback(WithCommittedText(committed, std::move(inputting)));
     }
     return true;
   }
@@ -341,7 +381,7 @@ bool KeyHandler::handle(Key key, McBopomofo::InputState* state,
     // Ctrl + Enter
     if (key.ctrlPressed && inputMode_ == InputMode::McBopomofo) {
       if (ctrlEnterKey_ == KeyHandlerCtrlEnter::OutputBpmfReadings) {
-        std::vector<std::string> readings = grid_.readings();
+        const auto& readings = grid_.readings();
         std::string readingValue;
         for (auto it = readings.begin(); it != readings.end(); ++it) {
           readingValue += *it;
@@ -378,8 +418,8 @@ bool KeyHandler::handle(Key key, McBopomofo::InputState* state,
     // See if we are in Marking state, and, if a valid mark, accept it.
     if (auto* marking = dynamic_cast<InputStates::Marking*>(state)) {
       if (marking->acceptable) {
-        userPhraseAdder_->addUserPhrase(marking->reading, marking->markedText);
-        onAddNewPhrase_(marking->markedText);
+        userPhraseAdder_->addUserPhrase(marking->reading, marking->markedText,
+                                        onPhraseWritten(marking->markedText));
 
         // If the cursor was at the end of the buffer when the marking started,
         // move back.
@@ -421,8 +461,9 @@ bool KeyHandler::handle(Key key, McBopomofo::InputState* state,
 
   // Punctuation key: backtick or grave accent.
   if (simpleAscii == kPunctuationListKey &&
-      lm_->hasUnigrams(kPunctuationListUnigramKey)) {
+      countingLM_->hasUnigrams(kPunctuationListUnigramKey)) {
     if (reading_.isEmpty()) {
+      punctuationListUndoPoint_ = UndoPoint{grid_.snapshot(), latestWalk_};
       grid_.insertReading(kPunctuationListUnigramKey);
       walk();
 
@@ -558,6 +599,7 @@ void KeyHandler::candidateSelected(
     return;
   }
 
+  punctuationListUndoPoint_.reset();
   pinNode(originalCursor, candidate);
   auto inputting = buildInputtingState();
   auto copy = std::make_unique<InputStates::Inputting>(*inputting);
@@ -594,10 +636,11 @@ bool KeyHandler::candidatePanelPunctuationMaybeEntered(
 
   std::string unigramKey =
       std::string(kPunctuationListUnigramKey) + "_" + key.ascii;
-  if (!lm_->hasUnigrams(unigramKey)) {
+  if (!countingLM_->hasUnigrams(unigramKey)) {
     return false;
   }
 
+  punctuationListUndoPoint_.reset();
   if (selectPhraseAfterCursorAsCandidate_) {
     grid_.deleteReadingAfterCursor();
   } else {
@@ -635,12 +678,18 @@ void KeyHandler::candidatePanelPunctuationListCancelled(
     stateCallback(std::move(emptyIgnorePreviousState));
     return;
   }
-  if (selectPhraseAfterCursorAsCandidate_) {
-    grid_.deleteReadingAfterCursor();
+  if (punctuationListUndoPoint_.has_value()) {
+    grid_.restore(punctuationListUndoPoint_->gridSnapshot);
+    latestWalk_ = std::move(punctuationListUndoPoint_->walk);
+    punctuationListUndoPoint_.reset();
   } else {
-    grid_.deleteReadingBeforeCursor();
+    if (selectPhraseAfterCursorAsCandidate_) {
+      grid_.deleteReadingAfterCursor();
+    } else {
+      grid_.deleteReadingBeforeCursor();
+    }
+    walk();
   }
-  walk();
   grid_.setCursor(originalCursor > 0 ? originalCursor - 1 : 0);
   if (grid_.length() == 0) {
     reset();
@@ -679,13 +728,14 @@ bool KeyHandler::handleCandidateKeyForTraditionalBopomofoIfRequired(
       std::string(1, key.ascii);
 
   std::string punctuation = kPunctuationKeyPrefix + std::string(1, key.ascii);
-  bool shouldAutoSelectCandidate = reading_.isValidKey(chrStr) ||
-                                   lm_->hasUnigrams(customPunctuation) ||
-                                   lm_->hasUnigrams(punctuation);
+  bool shouldAutoSelectCandidate =
+      reading_.isValidKey(chrStr) ||
+      countingLM_->hasUnigrams(customPunctuation) ||
+      countingLM_->hasUnigrams(punctuation);
   if (!shouldAutoSelectCandidate) {
     if (chrStr >= 'A' && chrStr <= 'Z') {
       std::string letter = std::string(kLetterPrefix) + chrStr;
-      if (lm_->hasUnigrams(letter)) {
+      if (countingLM_->hasUnigrams(letter)) {
         shouldAutoSelectCandidate = true;
       }
     }
@@ -703,20 +753,38 @@ bool KeyHandler::handleCandidateKeyForTraditionalBopomofoIfRequired(
 
 void KeyHandler::boostPhrase(const std::string& reading,
                              const std::string& value) {
-  userPhraseAdder_->addUserPhrase(reading, value);
-  onAddNewPhrase_(value);
+  userPhraseAdder_->addUserPhrase(reading, value, onPhraseWritten(value));
 }
 
 void KeyHandler::excludePhrase(const std::string& reading,
                                const std::string& value) {
-  userPhraseAdder_->removeUserPhrase(reading, value);
-  onAddNewPhrase_(value);
+  userPhraseAdder_->removeUserPhrase(reading, value, onPhraseWritten(value));
+}
+
+std::function<void()> KeyHandler::onPhraseWritten(
+    const std::string& value) const {
+  // The writes may finish on another thread, after onAddNewPhrase_ is changed,
+  // so the callback keeps copies.
+  return [onAddNewPhrase = onAddNewPhrase_, value]() {
+    if (onAddNewPhrase) {
+      onAddNewPhrase(value);
+    }
+  };
 }
 
 void KeyHandler::reset() {
   reading_.clear();
   grid_.clear();
   latestWalk_ = Formosa::Gramambular2::ReadingGrid::WalkResult();
+  punctuationListUndoPoint_.reset();
+}
+
+void KeyHandler::completePendingWalk(StateCallback stateCallback) {
+  if (!latestWalk_.partial) {
+    return;
+  }
+  walk(Formosa::Gramambular2::ReadingGrid::WalkLimits());
+  stateCallback(buildInputtingState());
 }
 
 #pragma region Settings
@@ -777,6 +845,14 @@ void KeyHandler::setBopomofoFontAnnotationSupportEnabled(bool enabled) {
   bopomofoFontAnnotationSupportEnabled_ = enabled;
 }
 
+void KeyHandler::setWalkDeadlineMicroseconds(int64_t microseconds) {
+  walkLimits_.deadlineMicroseconds = microseconds;
+}
+
+void KeyHandler::setAutoCommitLength(size_t readings) {
+  autoCommitLength_ = readings;
+}
+
 #pragma endregion Settings
 
 #pragma region Key_Handling
@@ -1091,7 +1167,7 @@ bool KeyHandler::handlePunctuation(const std::string& punctuationUnigramKey,
                                    McBopomofo::InputState* state,
                                    const StateCallback& stateCallback,
                                    const ErrorCallback& errorCallback) {
-  if (!lm_->hasUnigrams(punctuationUnigramKey)) {
+  if (!countingLM_->hasUnigrams(punctuationUnigramKey)) {
     return false;
   }
 
@@ -1104,7 +1180,8 @@ bool KeyHandler::handlePunctuation(const std::string& punctuationUnigramKey,
       const Formosa::Gramambular2::ReadingGrid::NodePtr& currentNode =
           *nodeIter;
       if (currentNode->reading() == punctuationUnigramKey) {
-        auto candidates = grid_.candidatesAt(actualPrefixCursorIndex);
+        const auto& candidates =
+            grid_.candidateViewsAt(actualPrefixCursorIndex);
         if (candidates.size() > 1) {
           if (selectPhraseAfterCursorAsCandidate_) {
             grid_.setCursor(actualPrefixCursorIndex);
@@ -1140,9 +1217,10 @@ bool KeyHandler::handlePunctuation(const std::string& punctuationUnigramKey,
       stateCallback(std::move(choosingCandidate));
     }
   } else {
+    std::string committed = autoCommitStableReadings();
     auto inputting = buildInputtingState();
     auto copy = std::make_unique<InputStates::Inputting>(*inputting);
-    stateCallback(std::move(inputting));
+    stateCallback(WithCommittedText(committed, std::move(inputting)));
     if (associatedPhrasesEnabled_) {
       handleAssociatedPhrases(copy.get(), stateCallback, errorCallback, true);
     }
@@ -1164,7 +1242,7 @@ bool KeyHandler::handleNumberInput(Key key,
     if (!number.empty()) {
       number = number.substr(0, number.length() - 1);
       auto candidates =
-          NumberInputHelper::FillCandidatesWithNumber(number, lm_);
+          NumberInputHelper::FillCandidatesWithNumber(number, countingLM_);
       auto newState =
           std::make_unique<InputStates::NumberInput>(number, candidates);
       stateCallback(std::move(newState));
@@ -1182,7 +1260,7 @@ bool KeyHandler::handleNumberInput(Key key,
     }
     std::string newNumber = state->number + key.ascii;
     auto candidates =
-        NumberInputHelper::FillCandidatesWithNumber(newNumber, lm_);
+        NumberInputHelper::FillCandidatesWithNumber(newNumber, countingLM_);
     auto newState =
         std::make_unique<InputStates::NumberInput>(newNumber, candidates);
     stateCallback(std::move(newState));
@@ -1199,7 +1277,7 @@ bool KeyHandler::handleNumberInput(Key key,
     }
     std::string newNumber = state->number + key.ascii;
     auto candidates =
-        NumberInputHelper::FillCandidatesWithNumber(newNumber, lm_);
+        NumberInputHelper::FillCandidatesWithNumber(newNumber, countingLM_);
     auto newState =
         std::make_unique<InputStates::NumberInput>(newNumber, candidates);
     stateCallback(std::move(newState));
@@ -1279,8 +1357,8 @@ bool KeyHandler::handleIroha(Key key, McBopomofo::InputStates::Iroha* state,
     }
 
     std::string unigram = "_kana_" + code;
-    if (lm_->hasUnigrams(unigram)) {
-      auto unigrams = lm_->getUnigrams(unigram);
+    if (countingLM_->hasUnigrams(unigram)) {
+      auto unigrams = countingLM_->getUnigrams(unigram);
       if (unigrams.size() == 1) {
         std::string value = unigrams[0].value();
         auto seq = std::make_unique<InputStates::StateSequence>();
@@ -1392,6 +1470,8 @@ std::string KeyHandler::getHanyuPinyin() {
 }
 
 KeyHandler::ComposedString KeyHandler::getComposedString(size_t builderCursor) {
+  ScopedHistogramTimer timer(&telemetry_.composedStringMicroseconds);
+
   // To construct an Inputting state, we need to first retrieve the entire
   // composing buffer from the current grid, then split the composed string
   // into head and tail, so that we can insert the current reading (if
@@ -1542,11 +1622,15 @@ std::unique_ptr<InputStates::Inputting> KeyHandler::buildInputtingState() {
 std::unique_ptr<InputStates::ChoosingCandidate>
 KeyHandler::buildChoosingCandidateState(InputStates::NotEmpty* nonEmptyState,
                                         size_t originalCursor) {
-  auto candidates = grid_.candidatesAt(actualCandidateCursorIndex());
+  ScopedHistogramTimer timer(&telemetry_.candidateBuildMicroseconds);
+  const auto& candidates =
+      grid_.candidateViewsAt(actualCandidateCursorIndex());
   std::vector<InputStates::ChoosingCandidate::Candidate> stateCandidates;
+  stateCandidates.reserve(candidates.size());
   for (const auto& c : candidates) {
-    stateCandidates.emplace_back(c.reading, c.value, c.rawValue);
+    stateCandidates.emplace_back(c.reading(), c.value(), c.rawValue());
   }
+  telemetry_.candidateCount.record(stateCandidates.size());
 
   return std::make_unique<InputStates::ChoosingCandidate>(
       nonEmptyState->composingBuffer, nonEmptyState->cursorIndex,
@@ -1601,7 +1685,7 @@ std::unique_ptr<InputStates::Marking> KeyHandler::buildMarkingState(
     status = localizedStrings_->syllablesRequired(kMinValidMarkingReadingCount);
   } else if (readings.size() > kMaxValidMarkingReadingCount) {
     status = localizedStrings_->syllablesMaximum(kMaxValidMarkingReadingCount);
-  } else if (MarkedPhraseExists(lm_, readingValue, marked)) {
+  } else if (MarkedPhraseExists(countingLM_, readingValue, marked)) {
     status = localizedStrings_->phraseAlreadyExists();
   } else {
     status = localizedStrings_->pressEnterToAddThePhrase();
@@ -1761,6 +1845,12 @@ void KeyHandler::pinNode(
     size_t originalCursor,
     const InputStates::ChoosingCandidate::Candidate& candidate,
     bool useMoveCursorAfterSelectionSetting) {
+  // The user override model learns from the difference between the walks
+  // before and after the override, so neither may be cut short.
+  if (latestWalk_.partial) {
+    walk(Formosa::Gramambular2::ReadingGrid::WalkLimits());
+  }
+
   size_t actualCursor = actualCandidateCursorIndex();
   Formosa::Gramambular2::ReadingGrid::Candidate gridCandidate(
       candidate.reading, candidate.value, "");
@@ -1769,7 +1859,7 @@ void KeyHandler::pinNode(
   }
 
   Formosa::Gramambular2::ReadingGrid::WalkResult prevWalk = latestWalk_;
-  walk();
+  walk(Formosa::Gramambular2::ReadingGrid::WalkLimits());
 
   // Update the user override model if warranted.
   size_t accumulatedCursor = 0;
@@ -1888,6 +1978,38 @@ void KeyHandler::pinNodeWithAssociatedPhrase(
   // Cursor is already at accumulatedCursor, so no more work here.
 }
 
-void KeyHandler::walk() { latestWalk_ = grid_.walk(); }
+std::string KeyHandler::autoCommitStableReadings() {
+  // Only typing at the end of a long buffer commits, and Plain Bopomofo
+  // commits every character anyway.
+  if (autoCommitLength_ == 0 || grid_.length() <= autoCommitLength_ ||
+      grid_.cursor() != grid_.length() || !reading_.isEmpty() ||
+      inputMode_ == McBopomofo::InputMode::PlainBopomofo) {
+    return {};
+  }
+  size_t stableReadings = latestWalk_.stableReadings;
+  if (stableReadings == 0) {
+    return {};
+  }
+
+  // The stable readings end at a node boundary, so the head is exactly the
+  // text of their nodes.
+  std::string committed = getComposedString(stableReadings).head;
+  grid_.dropReadingsBefore(stableReadings);
+  walk();
+  return committed;
+}
+
+void KeyHandler::walk() { walk(walkLimits_); }
+
+void KeyHandler::walk(
+    const Formosa::Gramambular2::ReadingGrid::WalkLimits& limits) {
+  latestWalk_ = grid_.walk(limits);
+  // The walk uses the wall clock, which can go backwards.
+  int64_t elapsed = std::max<int64_t>(latestWalk_.elapsedMicroseconds, 0);
+  telemetry_.walkMicroseconds.record(static_cast<uint64_t>(elapsed));
+  telemetry_.walkVertices.record(latestWalk_.vertices);
+  telemetry_.walkEdges.record(latestWalk_.edges);
+  telemetry_.gridLength.record(grid_.length());
+}
 
 }  // namespace McBopomofo
@@ -26,6 +26,7 @@
 
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 
 #include "DictionaryService.h"
@@ -37,6 +38,7 @@
 #include "InputState.h"
 #include "Key.h"
 #include "LanguageModelLoader.h"
+#include "Telemetry.h"
 
 namespace McBopomofo {
 
@@ -116,6 +118,21 @@ class KeyHandler {
 
   void reset();
 
+  // Whether the latest walk was cut short by the walk deadline. See
+  // setWalkDeadlineMicroseconds().
+  bool hasPendingWalk() const { return latestWalk_.partial; }
+
+  // Completes a walk that was cut short and enters the updated Inputting
+  // state. Meant to be called when the input method is idle. Does nothing if
+  // there is no pending walk.
+  void completePendingWalk(StateCallback stateCallback);
+
+  // Statistics of the walks, the key handling, and the state building since
+  // the KeyHandler was created or the telemetry was last reset.
+  const Telemetry& telemetry() const { return telemetry_; }
+
+  void resetTelemetry() { telemetry_.reset(); }
+
 #pragma region Dictionary Services
 
   bool hasDictionaryServices();
@@ -162,7 +179,9 @@ class KeyHandler {
   // Sets if half width punctuation is enabled or not.
   void setHalfWidthPunctuationEnabled(bool enabled);
 
-  // Sets the lambda for adding the phrases.
+  // Sets the lambda for adding the phrases. It is called once the phrase has
+  // been written to the user phrase files, possibly on the thread that writes
+  // them.
   void setOnAddNewPhrase(
       std::function<void(const std::string&)> onAddNewPhrase);
 
@@ -180,6 +199,20 @@ class KeyHandler {
     return bopomofoFontAnnotationSupportEnabled_;
   }
 
+  // Sets the deadline of the walks made while typing. 0 disables the deadline.
+  // A walk that runs out of time is completed greedily, and a full walk is
+  // made before any key that is not for the reading is handled.
+  void setWalkDeadlineMicroseconds(int64_t microseconds);
+
+  // Sets the length of the composing buffer, in readings, beyond which its
+  // stable beginning is committed while typing at its end, so that the buffer
+  // works as a sliding window and the work per key stays bounded. The text
+  // committed is what the whole buffer would have begun with, except that
+  // later overrides, such as suggestions, only see the rest of the buffer.
+  // Partial walks find no stable readings; see
+  // ReadingGrid::WalkResult::stableReadings. 0 disables it.
+  void setAutoCommitLength(size_t readings);
+
   // Compute the actual candidate cursor index based on the current index.
   size_t actualCandidateCursorIndex();
   // Compute the actual candidate cursor index.
@@ -292,10 +325,26 @@ class KeyHandler {
                                    const std::string& associatedPhraseReading,
                                    const std::string& associatedPhraseValue);
 
+  bool handleKey(Key key, McBopomofo::InputState* state,
+                 StateCallback stateCallback, ErrorCallback errorCallback);
+
+  // Removes the stable beginning of the composing buffer if it is longer than
+  // the auto-commit length, and returns the text of the removed part.
+  std::string autoCommitStableReadings();
+
+  // Returns the callback that calls onAddNewPhrase_ with the value, for when
+  // the phrase has been written.
+  std::function<void()> onPhraseWritten(const std::string& value) const;
+
+  // Walks the grid with the walk limits.
   void walk();
+  void walk(const Formosa::Gramambular2::ReadingGrid::WalkLimits& limits);
 
   std::shared_ptr<Formosa::Gramambular2::LanguageModel> lm_;
   std::shared_ptr<VariantAnnotator> variantAnnotator_;
+  // lm_, counting its lookups. All the lookups of the KeyHandler and its grid
+  // go through it; lm_ is only used directly for what only McBopomofoLM does.
+  std::shared_ptr<LookupCountingLanguageModel> countingLM_;
   Formosa::Gramambular2::ReadingGrid grid_;
   std::shared_ptr<UserPhraseAdder> userPhraseAdder_;
   std::unique_ptr<LocalizedStrings> localizedStrings_;
@@ -303,7 +352,16 @@ class KeyHandler {
   UserOverrideModel userOverrideModel_;
   Formosa::Mandarin::BopomofoReadingBuffer reading_;
   Formosa::Gramambular2::ReadingGrid::WalkResult latestWalk_;
+
+  // The grid and the walk before a speculative edit, such as inserting the
+  // punctuation list reading, so that cancelling it needs no edit or walk.
+  struct UndoPoint {
+    Formosa::Gramambular2::ReadingGrid::Snapshot gridSnapshot;
+    Formosa::Gramambular2::ReadingGrid::WalkResult walk;
+  };
+  std::optional<UndoPoint> punctuationListUndoPoint_;
   std::shared_ptr<DictionaryServices> dictionaryServices_;
+  Telemetry telemetry_;
 
 #pragma region Settings
 
@@ -319,6 +377,8 @@ class KeyHandler {
   bool chooseCandidateUsingSpace_ = true;
   bool bopomofoFontAnnotationSupportEnabled_ = false;
   KeyHandlerCtrlEnter ctrlEnterKey_ = KeyHandlerCtrlEnter::Disabled;
+  Formosa::Gramambular2::ReadingGrid::WalkLimits walkLimits_;
+  size_t autoCommitLength_ = 0;
   std::function<void(const std::string&)> onAddNewPhrase_;
 
 #pragma endregion Settings
@@ -21,8 +21,13 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -62,10 +67,52 @@ static std::shared_ptr<VariantAnnotator> CreateLoadedAnnotator() {
 
 class MockUserPhraseAdder : public UserPhraseAdder {
  public:
-  void addUserPhrase(const std::string_view&,
-                     const std::string_view&) override {}
-  void removeUserPhrase(const std::string_view&,
-                        const std::string_view&) override {}
+  void addUserPhrase(const std::string_view&, const std::string_view&,
+                     std::function<void()>) override {}
+  void removeUserPhrase(const std::string_view&, const std::string_view&,
+                        std::function<void()>) override {}
+};
+
+// Like LanguageModelLoader, writes the phrases to a file on a thread of its
+// own. The writes are held until finishWrites(), so that the tests can tell
+// what happens before them.
+class BackgroundWritingUserPhraseAdder : public UserPhraseAdder {
+ public:
+  explicit BackgroundWritingUserPhraseAdder(std::filesystem::path path)
+      : path_(std::move(path)) {}
+
+  void addUserPhrase(const std::string_view& reading,
+                     const std::string_view& phrase,
+                     std::function<void()> onWritten) override {
+    pendingWrites_.emplace_back(
+        std::string(phrase) + " " + std::string(reading) + "\n",
+        std::move(onWritten));
+  }
+
+  void removeUserPhrase(const std::string_view& reading,
+                        const std::string_view& phrase,
+                        std::function<void()> onWritten) override {
+    addUserPhrase(reading, phrase, std::move(onWritten));
+  }
+
+  void finishWrites() {
+    std::thread writer([this]() {
+      for (auto& [line, onWritten] : pendingWrites_) {
+        std::ofstream ofs(path_, std::ios_base::app);
+        ofs << line;
+        ofs.close();
+        if (onWritten) {
+          onWritten();
+        }
+      }
+    });
+    writer.join();
+    pendingWrites_.clear();
+  }
+
+ private:
+  std::filesystem::path path_;
+  std::vector<std::pair<std::string, std::function<void()>>> pendingWrites_;
 };
 
 class MockLocalizedString : public KeyHandler::LocalizedStrings {
@@ -234,6 +281,72 @@ TEST_F(KeyHandlerTest, FullSyllablesThenCompose) {
   ASSERT_EQ(inputtingState->cursorIndex, strlen("中文"));
 }
 
+TEST_F(KeyHandlerTest, TelemetryRecordsKeysAndWalks) {
+  handleKeySequence(asciiKeys("5j/ jp6 "));
+  const Telemetry& telemetry = keyHandler_->telemetry();
+  ASSERT_EQ(telemetry.keyMicroseconds.count(), 8);
+  ASSERT_EQ(telemetry.lmLookupsPerKey.count(), 8);
+  ASSERT_GT(telemetry.lmLookupsPerKey.max(), 0);
+  ASSERT_EQ(telemetry.walkMicroseconds.count(), 2);
+  ASSERT_EQ(telemetry.gridLength.max(), 2);
+  ASSERT_EQ(telemetry.candidateBuildMicroseconds.count(), 1);
+  ASSERT_GT(telemetry.candidateCount.max(), 0);
+  ASSERT_GT(telemetry.composedStringMicroseconds.count(), 0);
+
+  keyHandler_->resetTelemetry();
+  ASSERT_EQ(keyHandler_->telemetry().keyMicroseconds.count(), 0);
+}
+
+// The lookups that the KeyHandler makes itself are counted too, such as the
+// one that rejects a syllable the LM does not have, ㄅㄧㄤ.
+TEST_F(KeyHandlerTest, TelemetryCountsLookupsOutsideTheGrid) {
+  handleKeySequence(asciiKeys("1u; "), /*expectHandled=*/true,
+                    /*expectErrorCallbackAtEnd=*/true);
+  const Telemetry& telemetry = keyHandler_->telemetry();
+  ASSERT_EQ(telemetry.lmLookupsPerKey.count(), 4);
+  ASSERT_EQ(telemetry.lmLookupsPerKey.max(), 1);
+  ASSERT_EQ(telemetry.walkMicroseconds.count(), 0);
+}
+
+// Opens the candidate panel repeatedly at the same location, which is what
+// happens when the user pages through the candidates, closes the panel, and
+// opens it again. The latency is reported as test properties.
+TEST_F(KeyHandlerTest, CandidatePanelOpenLatency) {
+  auto keys = asciiKeys("5j/ jp6");
+  keys.emplace_back(Key::namedKey(Key::KeyName::LEFT));
+  auto inputtingState = handleKeySequence(keys);
+  ASSERT_TRUE(dynamic_cast<InputStates::Inputting*>(inputtingState.get()) !=
+              nullptr);
+  keyHandler_->resetTelemetry();
+
+  constexpr size_t kOpenCount = 1000;
+  size_t candidateCount = 0;
+  for (size_t i = 0; i < kOpenCount; ++i) {
+    std::unique_ptr<InputState> newState;
+    bool handled = keyHandler_->handle(
+        Key::asciiKey(Key::SPACE), inputtingState.get(),
+        [&newState](std::unique_ptr<InputState> s) { newState = std::move(s); },
+        []() {});
+    ASSERT_TRUE(handled);
+    auto* choosingCandidateState =
+        dynamic_cast<InputStates::ChoosingCandidate*>(newState.get());
+    ASSERT_TRUE(choosingCandidateState != nullptr);
+    if (i == 0) {
+      candidateCount = choosingCandidateState->candidates.size();
+      ASSERT_GT(candidateCount, 0);
+    }
+    ASSERT_EQ(choosingCandidateState->candidates.size(), candidateCount);
+  }
+
+  const Histogram& latency =
+      keyHandler_->telemetry().candidateBuildMicroseconds;
+  ASSERT_EQ(latency.count(), kOpenCount);
+  RecordProperty("candidates", static_cast<int>(candidateCount));
+  RecordProperty("panel_open_us_mean", std::to_string(latency.mean()));
+  RecordProperty("panel_open_us_p99",
+                 std::to_string(latency.percentile(99.0)));
+}
+
 TEST_F(KeyHandlerTest, EnterCandidateState) {
   auto endState = handleKeySequence(asciiKeys("5j/ jp6 "));
   auto choosingCandidateState =
@@ -247,6 +360,116 @@ TEST_F(KeyHandlerTest, EnterCandidateState) {
                   "ㄓㄨㄥ-ㄨㄣˊ", "中文", "中文")));
 }
 
+TEST_F(KeyHandlerTest, CancelPunctuationListRestoresGrid) {
+  auto keys = asciiKeys("5j/ jp6");
+  keys.emplace_back(Key::namedKey(Key::KeyName::LEFT));
+  keys.emplace_back(Key::asciiKey('`'));
+  auto endState = handleKeySequence(keys);
+  auto punctuationListState =
+      dynamic_cast<InputStates::ChoosingPunctuationList*>(endState.get());
+  ASSERT_TRUE(punctuationListState != nullptr);
+  ASSERT_GT(punctuationListState->candidates.size(), 1);
+
+  size_t walks = keyHandler_->telemetry().walkMicroseconds.count();
+  std::unique_ptr<InputState> newState;
+  keyHandler_->candidatePanelPunctuationListCancelled(
+      punctuationListState->originalCursor,
+      [&newState](std::unique_ptr<InputState> s) { newState = std::move(s); });
+  auto inputtingState = dynamic_cast<InputStates::Inputting*>(newState.get());
+  ASSERT_TRUE(inputtingState != nullptr);
+  ASSERT_EQ(inputtingState->composingBuffer, "中文");
+  ASSERT_EQ(inputtingState->cursorIndex, strlen("中"));
+
+  // The grid is restored from a snapshot, without another walk.
+  ASSERT_EQ(keyHandler_->telemetry().walkMicroseconds.count(), walks);
+}
+
+TEST_F(KeyHandlerTest, WalkDeadlineDoesNotChangeCommittedText) {
+  std::string typed;
+  for (size_t i = 0; i < 300; ++i) {
+    typed += "5j/ jp6";
+  }
+  auto keys = asciiKeys(typed);
+  keys.emplace_back(Key::asciiKey(Key::RETURN));
+  auto endState = handleKeySequence(keys);
+  auto committingState = dynamic_cast<InputStates::Committing*>(endState.get());
+  ASSERT_TRUE(committingState != nullptr);
+  std::string expected = committingState->text;
+
+  // Walks made while typing may be cut short, but the Return key completes
+  // the walk before the buffer is committed.
+  keyHandler_->setWalkDeadlineMicroseconds(1);
+  endState = handleKeySequence(asciiKeys(typed));
+  if (keyHandler_->hasPendingWalk()) {
+    std::unique_ptr<InputState> newState;
+    keyHandler_->completePendingWalk(
+        [&newState](std::unique_ptr<InputState> s) {
+          newState = std::move(s);
+        });
+    ASSERT_FALSE(keyHandler_->hasPendingWalk());
+    auto inputtingState = dynamic_cast<InputStates::Inputting*>(newState.get());
+    ASSERT_TRUE(inputtingState != nullptr);
+    ASSERT_EQ(inputtingState->composingBuffer, expected);
+  }
+  keyHandler_->reset();
+
+  endState = handleKeySequence(keys);
+  committingState = dynamic_cast<InputStates::Committing*>(endState.get());
+  ASSERT_TRUE(committingState != nullptr);
+  ASSERT_EQ(committingState->text, expected);
+}
+
+TEST_F(KeyHandlerTest, AutoCommitSameAsFullCommit) {
+  // 今天天氣很好，我們一起去公園散步。
+  std::string sentence = "rup wu0 wu0 fu4cp3cl3<ji3ap7u fu3fm4ej/ m06n041j4>";
+  std::string typed;
+  for (size_t i = 0; i < 20; ++i) {
+    typed += sentence;
+  }
+  auto keys = asciiKeys(typed);
+  keys.emplace_back(Key::asciiKey(Key::RETURN));
+  auto endState = handleKeySequence(keys);
+  auto committingState = dynamic_cast<InputStates::Committing*>(endState.get());
+  ASSERT_TRUE(committingState != nullptr);
+  std::string expected = committingState->text;
+
+  keyHandler_->setAutoCommitLength(10);
+  std::unique_ptr<InputState> state = std::make_unique<InputStates::Empty>();
+  std::string committed;
+  size_t commits = 0;
+  size_t maxComposingBufferLength = 0;
+  auto processState = [&](std::unique_ptr<InputState> s) {
+    if (auto* committing = dynamic_cast<InputStates::Committing*>(s.get())) {
+      committed += committing->text;
+      ++commits;
+    } else if (auto* inputting =
+                   dynamic_cast<InputStates::Inputting*>(s.get())) {
+      maxComposingBufferLength = std::max(maxComposingBufferLength,
+                                          inputting->composingBuffer.length());
+    }
+    state = std::move(s);
+  };
+  for (const Key& key : keys) {
+    keyHandler_->handle(
+        key, state.get(),
+        [&](std::unique_ptr<InputState> newState) {
+          if (auto* seq =
+                  dynamic_cast<InputStates::StateSequence*>(newState.get())) {
+            for (auto& s : seq->states) {
+              processState(std::move(s));
+            }
+          } else {
+            processState(std::move(newState));
+          }
+        },
+        []() {});
+  }
+
+  ASSERT_EQ(committed, expected);
+  ASSERT_GT(commits, 20);
+  ASSERT_LT(maxComposingBufferLength, expected.length() / 10);
+}
+
 TEST_F(KeyHandlerTest, CursorMovementLeft) {
   auto keys = asciiKeys("5j/ jp6");
   keys.emplace_back(Key::namedKey(Key::KeyName::LEFT));
@@ -451,4 +674,47 @@ TEST_F(KeyHandlerTest, BopomofoAnnotation) {
   keyHandler_->setBopomofoFontAnnotationSupportEnabled(false);
 }
 
+TEST_F(KeyHandlerTest, AddNewPhraseHookRunsAfterThePhraseIsWritten) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.keyhandlertest-add-phrase-hook.txt";
+  std::filesystem::remove(path);
+  auto adder = std::make_shared<BackgroundWritingUserPhraseAdder>(path);
+  keyHandler_ = std::make_unique<KeyHandler>(
+      languageModel_, variantAnnotator_, adder,
+      std::make_unique<MockLocalizedString>());
+
+  // For each call of the hook, the phrase and whether the file had it.
+  std::vector<std::pair<std::string, bool>> hookCalls;
+  keyHandler_->setOnAddNewPhrase([&](const std::string& phrase) {
+    std::ifstream ifs(path);
+    std::stringstream sst;
+    sst << ifs.rdbuf();
+    hookCalls.emplace_back(phrase, sst.str().find(phrase) != std::string::npos);
+  });
+
+  // Mark the last two syllables and add them with Enter.
+  auto keys = asciiKeys("su3w8 ");
+  keys.emplace_back(Key::namedKey(Key::KeyName::LEFT, /*shiftPressed=*/true));
+  keys.emplace_back(Key::namedKey(Key::KeyName::LEFT, /*shiftPressed=*/true));
+  auto markingState = handleKeySequence(keys);
+  auto* marking = dynamic_cast<InputStates::Marking*>(markingState.get());
+  ASSERT_TRUE(marking != nullptr);
+  ASSERT_TRUE(marking->acceptable);
+  std::string markedText = marking->markedText;
+  keys.emplace_back(Key::asciiKey(Key::RETURN));
+  handleKeySequence(keys);
+
+  keyHandler_->boostPhrase("ㄋㄧˇ", "你");
+  keyHandler_->excludePhrase("ㄊㄚ", "他");
+  EXPECT_TRUE(hookCalls.empty());
+
+  adder->finishWrites();
+  std::filesystem::remove(path);
+  ASSERT_EQ(hookCalls.size(), 3);
+  EXPECT_EQ(hookCalls[0], std::make_pair(markedText, true));
+  EXPECT_EQ(hookCalls[1], std::make_pair(std::string("你"), true));
+  EXPECT_EQ(hookCalls[2], std::make_pair(std::string("他"), true));
+}
+
 }  // namespace McBopomofo
@@ -27,8 +27,11 @@
 
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 
 #include "Log.h"
@@ -75,11 +78,14 @@ LanguageModelLoader::LanguageModelLoader(
   FCITX_MCBOPOMOFO_INFO() << "Associated phrases: " << associatedPhrasesV2Path;
   lm_->loadAssociatedPhrasesV2(associatedPhrasesV2Path.c_str());
 
-  FCITX_MCBOPOMOFO_INFO() << "Set macro converter";
-  auto converter = [this](const std::string& input) {
-    return this->inputMacroController_.handle(input);
+  FCITX_MCBOPOMOFO_INFO() << "Set macro expander";
+  auto expander = [this](const std::string& input) {
+    McBopomofoLM::MacroExpansion expansion;
+    expansion.value =
+        this->inputMacroController_.handle(input, &expansion.expiry);
+    return expansion;
   };
-  lm_->setMacroConverter(converter);
+  lm_->setMacroExpander(expander);
 
   std::string userDataPath = McBopomofo::fcitx5_compat::userDirectory();
 
@@ -141,73 +147,195 @@ void LanguageModelLoader::loadModelForMode(McBopomofo::InputMode mode) {
   }
 }
 
+LanguageModelLoader::~LanguageModelLoader() {
+  {
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    stopping_ = true;
+  }
+  writerCondition_.notify_all();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+}
+
 void LanguageModelLoader::addUserPhrase(const std::string_view& reading,
-                                        const std::string_view& phrase) {
+                                        const std::string_view& phrase,
+                                        std::function<void()> onWritten) {
   std::string readingStr(reading);
   std::string phraseStr(phrase);
   if (!userPhrasesPath_.pathExists()) {
     FCITX_MCBOPOMOFO_INFO()
         << "Not writing user phrases: data file does not exist";
+    if (onWritten) {
+      onWritten();
+    }
     return;
   }
-  removePhraseFromFile(excludedPhrasesPath_.path(), readingStr, phraseStr);
-  if (checkIfPhraseExists(userPhrasesPath_.path(), readingStr, phraseStr)) {
+  lm_->addUserPhrase(readingStr, phraseStr);
+
+  std::filesystem::path userPhrasesPath = userPhrasesPath_.path();
+  std::filesystem::path excludedPhrasesPath = excludedPhrasesPath_.path();
+  auto write = [this, userPhrasesPath, excludedPhrasesPath, readingStr,
+                phraseStr]() {
+    removePhraseFromFile(excludedPhrasesPath, readingStr, phraseStr);
+    if (checkIfPhraseExists(userPhrasesPath, readingStr, phraseStr)) {
+      FCITX_MCBOPOMOFO_INFO() << "Phrase already exists: " << phraseStr
+                              << ", reading: " << readingStr;
+      return;
+    }
+    if (!addPhraseToEndOfFile(userPhrasesPath, readingStr, phraseStr)) {
+      FCITX_MCBOPOMOFO_WARN() << "Failed to add user phrase: " << phraseStr
+                              << ", reading: " << readingStr;
+      return;
+    }
     FCITX_MCBOPOMOFO_INFO()
-        << "Phrase already exists: " << phrase << ", reading: " << reading;
-    return;
-  }
-  if (!addPhraseToEndOfFile(userPhrasesPath_.path(), readingStr, phraseStr)) {
-    FCITX_MCBOPOMOFO_WARN()
-        << "Failed to add user phrase: " << phrase << ", reading: " << reading;
-    return;
-  }
-  FCITX_MCBOPOMOFO_INFO() << "Added user phrase: " << phrase
-                          << ", reading: " << reading;
-  reloadUserModelsIfNeeded();
+        << "Added user phrase: " << phraseStr << ", reading: " << readingStr;
+  };
+  enqueueWrite(std::move(write), std::move(onWritten));
 }
 
 void LanguageModelLoader::removeUserPhrase(const std::string_view& reading,
-                                           const std::string_view& phrase) {
+                                           const std::string_view& phrase,
+                                           std::function<void()> onWritten) {
   std::string readingStr(reading);
   std::string phraseStr(phrase);
   if (!excludedPhrasesPath_.pathExists()) {
     FCITX_MCBOPOMOFO_INFO()
         << "Not writing excluded phrases: data file does not exist";
+    if (onWritten) {
+      onWritten();
+    }
     return;
   }
-  removePhraseFromFile(userPhrasesPath_.path(), readingStr, phraseStr);
-  if (checkIfPhraseExists(excludedPhrasesPath_.path(), readingStr, phraseStr)) {
+  lm_->removeUserPhrase(readingStr, phraseStr);
+
+  std::filesystem::path userPhrasesPath = userPhrasesPath_.path();
+  std::filesystem::path excludedPhrasesPath = excludedPhrasesPath_.path();
+  auto write = [this, userPhrasesPath, excludedPhrasesPath, readingStr,
+                phraseStr]() {
+    removePhraseFromFile(userPhrasesPath, readingStr, phraseStr);
+    if (checkIfPhraseExists(excludedPhrasesPath, readingStr, phraseStr)) {
+      FCITX_MCBOPOMOFO_INFO() << "Phrase already excluded: " << phraseStr
+                              << ", reading: " << readingStr;
+      return;
+    }
+    if (!addPhraseToEndOfFile(excludedPhrasesPath, readingStr, phraseStr)) {
+      FCITX_MCBOPOMOFO_WARN() << "Failed to exclude phrase: " << phraseStr
+                              << ", reading: " << readingStr;
+      return;
+    }
     FCITX_MCBOPOMOFO_INFO()
-        << "Phrase already excluded: " << phrase << ", reading: " << reading;
+        << "Excluded phrase: " << phraseStr << ", reading: " << readingStr;
+  };
+  enqueueWrite(std::move(write), std::move(onWritten));
+}
+
+void LanguageModelLoader::enqueueWrite(std::function<void()> write,
+                                       std::function<void()> onWritten) {
+  {
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    pendingWrites_.push_back(
+        PendingWrite{std::move(write), std::move(onWritten)});
+    if (!writer_.joinable()) {
+      writer_ = std::thread(&LanguageModelLoader::runWrites, this);
+    }
+  }
+  writerCondition_.notify_one();
+}
+
+void LanguageModelLoader::runWrites() {
+  std::unique_lock<std::mutex> lock(writerMutex_);
+  while (true) {
+    writerCondition_.wait(
+        lock, [this]() { return stopping_ || !pendingWrites_.empty(); });
+    if (pendingWrites_.empty()) {
+      // Only stop once everything enqueued has been written.
+      return;
+    }
+    PendingWrite pending = std::move(pendingWrites_.front());
+    pendingWrites_.pop_front();
+    writing_ = true;
+    lock.unlock();
+
+    std::error_code err;
+    auto userPhrasesBefore =
+        std::filesystem::last_write_time(userPhrasesPath_.path(), err);
+    auto excludedPhrasesBefore =
+        std::filesystem::last_write_time(excludedPhrasesPath_.path(), err);
+
+    pending.write();
+
+    auto userPhrasesAfter =
+        std::filesystem::last_write_time(userPhrasesPath_.path(), err);
+    auto excludedPhrasesAfter =
+        std::filesystem::last_write_time(excludedPhrasesPath_.path(), err);
+
+    lock.lock();
+    updateAfterWrite(userPhrasesState_, userPhrasesBefore, userPhrasesAfter);
+    updateAfterWrite(excludedPhrasesState_, excludedPhrasesBefore,
+                     excludedPhrasesAfter);
+    writing_ = false;
+    lock.unlock();
+
+    if (pending.onWritten) {
+      pending.onWritten();
+    }
+    lock.lock();
+  }
+}
+
+void LanguageModelLoader::updateAfterWrite(
+    UserFileState& state, std::filesystem::file_time_type before,
+    std::filesystem::file_time_type after) {
+  if (after == before) {
+    // The write did not touch this file.
     return;
   }
-  if (!addPhraseToEndOfFile(excludedPhrasesPath_.path(), readingStr,
-                            phraseStr)) {
-    FCITX_MCBOPOMOFO_WARN()
-        << "Failed to exclude phrase: " << phrase << ", reading: " << reading;
+  if (state.changedExternally || before != state.timestamp) {
+    // The file had an edit that the LM does not have, which is now mixed with
+    // ours. Only a full reload can pick it up.
+    state.changedExternally = true;
     return;
   }
-  FCITX_MCBOPOMOFO_INFO() << "Excluded phrase: " << phrase
-                          << ", reading: " << reading;
-  reloadUserModelsIfNeeded();
+  state.timestamp = after;
+}
+
+bool LanguageModelLoader::needsReload(TimestampedPath& path,
+                                      const UserFileState& state) {
+  if (!path.pathExists() || !path.timestampDifferentFromLastCheck()) {
+    return false;
+  }
+  path.checkTimestamp();
+  if (!state.changedExternally && path.timestamp() == state.timestamp) {
+    return false;
+  }
+  FCITX_MCBOPOMOFO_INFO() << "Will load: " << path.path();
+  return true;
 }
 
 bool LanguageModelLoader::reloadUserModelsIfNeeded() {
   bool shouldReloadUserPhrases = false;
   bool shouldReloadPhrasesReplacement = false;
 
-  if (userPhrasesPath_.pathExists() &&
-      userPhrasesPath_.timestampDifferentFromLastCheck()) {
-    shouldReloadUserPhrases = true;
-    userPhrasesPath_.checkTimestamp();
-    FCITX_MCBOPOMOFO_INFO() << "Will load: " << userPhrasesPath_.path();
-  }
-
-  if (excludedPhrasesPath_.pathExists() &&
-      excludedPhrasesPath_.timestampDifferentFromLastCheck()) {
-    shouldReloadUserPhrases = true;
-    excludedPhrasesPath_.checkTimestamp();
-    FCITX_MCBOPOMOFO_INFO() << "Will load: " << excludedPhrasesPath_.path();
+  // Our own writes are already in the LM, so the user phrase files are only
+  // reloaded when they are changed by something else. Until the pending writes
+  // are done, the files cannot be told apart from those of an external edit
+  // and are not checked.
+  {
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    if (!writing_ && pendingWrites_.empty()) {
+      // Both files are checked, so that their timestamps are up to date.
+      bool userPhrasesChanged =
+          needsReload(userPhrasesPath_, userPhrasesState_);
+      bool excludedPhrasesChanged =
+          needsReload(excludedPhrasesPath_, excludedPhrasesState_);
+      shouldReloadUserPhrases = userPhrasesChanged || excludedPhrasesChanged;
+      if (shouldReloadUserPhrases) {
+        // Both files are loaded below, as of their last checked timestamps.
+        userPhrasesState_ = {userPhrasesPath_.timestamp(), false};
+        excludedPhrasesState_ = {excludedPhrasesPath_.timestamp(), false};
+      }
+    }
   }
 
   // Phrases replacement is considered an advanced feature. We only enable
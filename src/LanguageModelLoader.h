@@ -24,9 +24,16 @@
 #ifndef SRC_LANGUAGEMODELLOADER_H_
 #define SRC_LANGUAGEMODELLOADER_H_
 
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
 
 #include "Engine/McBopomofoLM.h"
 #include "InputMacro.h"
@@ -39,10 +46,16 @@ namespace McBopomofo {
 class UserPhraseAdder {
  public:
   virtual ~UserPhraseAdder() = default;
+
+  // The change may be written to the user phrase files after the call
+  // returns. onWritten, if set, is called once the write is done, possibly on
+  // another thread.
   virtual void addUserPhrase(const std::string_view& reading,
-                             const std::string_view& phrase) = 0;
+                             const std::string_view& phrase,
+                             std::function<void()> onWritten) = 0;
   virtual void removeUserPhrase(const std::string_view& reading,
-                                const std::string_view& phrase) = 0;
+                                const std::string_view& phrase,
+                                std::function<void()> onWritten) = 0;
 };
 
 class LanguageModelLoader : public UserPhraseAdder {
@@ -52,6 +65,9 @@ class LanguageModelLoader : public UserPhraseAdder {
   explicit LanguageModelLoader(
       std::unique_ptr<LocalizedStrings> localizedStrings);
 
+  // Waits for the pending writes to the user phrase files.
+  ~LanguageModelLoader() override;
+
   std::shared_ptr<McBopomofoLM> getLM() { return lm_; }
 
   std::shared_ptr<VariantAnnotator> getVariantAnnotator() {
@@ -60,11 +76,17 @@ class LanguageModelLoader : public UserPhraseAdder {
 
   void loadModelForMode(McBopomofo::InputMode mode);
 
+  // Adding or removing a phrase takes effect in the LM at once, while the
+  // change is written to the user phrase files in the background. onWritten
+  // is called on the writer thread after the write, or at once if the file
+  // does not exist.
   void addUserPhrase(const std::string_view& reading,
-                     const std::string_view& phrase) override;
+                     const std::string_view& phrase,
+                     std::function<void()> onWritten) override;
 
   void removeUserPhrase(const std::string_view& reading,
-                        const std::string_view& phrase) override;
+                        const std::string_view& phrase,
+                        std::function<void()> onWritten) override;
 
   bool reloadUserModelsIfNeeded();
 
@@ -90,6 +112,32 @@ class LanguageModelLoader : public UserPhraseAdder {
                             const std::string& reading,
                             const std::string& value) const;
 
+  // Runs the write on the writer thread, after the writes enqueued earlier,
+  // and then onWritten.
+  void enqueueWrite(std::function<void()> write,
+                    std::function<void()> onWritten);
+  void runWrites();
+
+  // What the LM has of a user phrase file. Guarded by writerMutex_.
+  struct UserFileState {
+    // The timestamp of the file content that the LM has, either because the
+    // file was loaded or because we made the same change to the LM and then
+    // wrote it to the file.
+    std::filesystem::file_time_type timestamp = {};
+    // Set if the file was changed by something else before one of our writes
+    // to it, so that the timestamp no longer tells the edits apart.
+    bool changedExternally = false;
+  };
+
+  // Updates the state of a file after one of our writes, given the timestamps
+  // of the file before and after the write.
+  static void updateAfterWrite(UserFileState& state,
+                               std::filesystem::file_time_type before,
+                               std::filesystem::file_time_type after);
+
+  // Returns true if the file has changed since the LM last had its content.
+  static bool needsReload(TimestampedPath& path, const UserFileState& state);
+
   std::unique_ptr<LocalizedStrings> localizedStrings_;
 
   std::shared_ptr<McBopomofoLM> lm_;
@@ -101,6 +149,20 @@ class LanguageModelLoader : public UserPhraseAdder {
   TimestampedPath phrasesReplacementPath_;
   InputMacroController inputMacroController_;
 
+  std::thread writer_;
+  std::mutex writerMutex_;
+  std::condition_variable writerCondition_;
+  struct PendingWrite {
+    std::function<void()> write;
+    std::function<void()> onWritten;
+  };
+  std::deque<PendingWrite> pendingWrites_;
+  bool writing_ = false;
+  bool stopping_ = false;
+
+  UserFileState userPhrasesState_;
+  UserFileState excludedPhrasesState_;
+
  public:
   class LocalizedStrings {
    public:
@@ -0,0 +1,148 @@
+// Copyright (c) 2022 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "LanguageModelLoader.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+// fcitx5 puts its user data directory under FCITX_DATA_HOME, which is read
+// once, so it is set before any test runs.
+static const std::filesystem::path kTestDataHome =
+    std::filesystem::temp_directory_path() /
+    "org.openvanilla.mcbopomofo.languagemodelloadertest";
+
+class TestDataHomeEnvironment : public ::testing::Environment {
+ public:
+  void SetUp() override {
+    setenv("FCITX_DATA_HOME", kTestDataHome.c_str(), /*overwrite=*/1);
+  }
+};
+
+static ::testing::Environment* const kTestDataHomeEnvironment =
+    ::testing::AddGlobalTestEnvironment(new TestDataHomeEnvironment);
+
+class TestLocalizedStrings : public LanguageModelLoader::LocalizedStrings {
+ public:
+  std::string userPhraseFileHeader() override { return "# user phrases\n"; }
+  std::string excludedPhraseFileHeader() override {
+    return "# excluded phrases\n";
+  }
+};
+
+static void AppendLine(const std::filesystem::path& path,
+                       const std::string& line) {
+  std::ofstream ofs(path, std::ios::app);
+  ofs << line << "\n";
+}
+
+// Edits the file as an editor would. The timestamp is moved forward so that
+// the edit is not lost to the granularity of the file system clock.
+static void EditExternally(const std::filesystem::path& path,
+                           const std::string& line) {
+  auto timestamp = std::filesystem::last_write_time(path);
+  AppendLine(path, line);
+  std::filesystem::last_write_time(path, timestamp + std::chrono::seconds(1));
+}
+
+static bool HasValue(McBopomofoLM* lm, const std::string& reading,
+                     const std::string& value) {
+  for (const auto& unigram : lm->getUnigrams(reading)) {
+    if (unigram.value() == value) {
+      return true;
+    }
+  }
+  return false;
+}
+
+class LanguageModelLoaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::filesystem::remove_all(kTestDataHome);
+    std::filesystem::create_directories(kUserDataPath);
+    AppendLine(kUserPhrasesPath, "# user phrases");
+    AppendLine(kUserPhrasesPath, "甲 ㄐㄧㄚˇ");
+    AppendLine(kExcludedPhrasesPath, "# excluded phrases");
+
+    loader_ = std::make_unique<LanguageModelLoader>(
+        std::make_unique<TestLocalizedStrings>());
+    // Bail before any write if fcitx5 looked somewhere else.
+    ASSERT_EQ(loader_->userDataPath(), kUserDataPath.string());
+    ASSERT_TRUE(HasValue(loader_->getLM().get(), "ㄐㄧㄚˇ", "甲"));
+  }
+
+  void TearDown() override {
+    loader_.reset();
+    std::filesystem::remove_all(kTestDataHome);
+  }
+
+  void addUserPhraseAndWait(const std::string& reading,
+                            const std::string& phrase) {
+    std::promise<void> written;
+    loader_->addUserPhrase(reading, phrase,
+                           [&written]() { written.set_value(); });
+    written.get_future().wait();
+  }
+
+  const std::filesystem::path kUserDataPath = kTestDataHome / "mcbopomofo";
+  const std::filesystem::path kUserPhrasesPath = kUserDataPath / "data.txt";
+  const std::filesystem::path kExcludedPhrasesPath =
+      kUserDataPath / "exclude-phrases.txt";
+  std::unique_ptr<LanguageModelLoader> loader_;
+};
+
+TEST_F(LanguageModelLoaderTest, OwnWritesAreNotReloaded) {
+  addUserPhraseAndWait("ㄧˇ", "乙");
+  EXPECT_TRUE(HasValue(loader_->getLM().get(), "ㄧˇ", "乙"));
+  EXPECT_FALSE(loader_->reloadUserModelsIfNeeded());
+  EXPECT_TRUE(HasValue(loader_->getLM().get(), "ㄧˇ", "乙"));
+}
+
+TEST_F(LanguageModelLoaderTest, ExternalEditBeforeOwnWriteIsLoaded) {
+  EditExternally(kUserPhrasesPath, "丙 ㄅㄧㄥˇ");
+  addUserPhraseAndWait("ㄧˇ", "乙");
+  EXPECT_TRUE(loader_->reloadUserModelsIfNeeded());
+  EXPECT_TRUE(HasValue(loader_->getLM().get(), "ㄅㄧㄥˇ", "丙"));
+  EXPECT_TRUE(HasValue(loader_->getLM().get(), "ㄧˇ", "乙"));
+}
+
+TEST_F(LanguageModelLoaderTest, ExternalEditOfTheOtherFileIsLoaded) {
+  EditExternally(kExcludedPhrasesPath, "甲 ㄐㄧㄚˇ");
+  addUserPhraseAndWait("ㄧˇ", "乙");
+  EXPECT_TRUE(loader_->reloadUserModelsIfNeeded());
+  EXPECT_FALSE(HasValue(loader_->getLM().get(), "ㄐㄧㄚˇ", "甲"));
+  EXPECT_TRUE(HasValue(loader_->getLM().get(), "ㄧˇ", "乙"));
+}
+
+}  // namespace McBopomofo
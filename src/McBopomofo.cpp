@@ -31,6 +31,8 @@
 #include <fmt/format.h>
 #include <notifications_public.h>  // from fcitx-module/notifications
 
+#include <fstream>
+#include <functional>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -54,6 +56,9 @@ constexpr int kFcitxRawKeycode_9 = 18;
 // For determining whether Shift-Enter is pressed in the candidate panel.
 constexpr int kFcitxRawKeycode_Enter = 36;
 
+// The file in the user data directory that the telemetry is dumped to.
+constexpr char kTelemetryFilename[] = "telemetry.json";
+
 // Fctix5 notification timeout, in milliseconds.
 constexpr int32_t kFcitx5NotificationTimeoutInMs = 1000;
 
@@ -61,6 +66,10 @@ constexpr int32_t kFcitx5NotificationTimeoutInMs = 1000;
 // the panel will be changed to a vertical panel.
 constexpr size_t kForceVerticalCandidateThreshold = 8;
 
+// How long typing must pause before a walk that ran out of time is completed,
+// in microseconds.
+constexpr uint64_t kCompletePendingWalkDelayInUs = 50000;
+
 static Key MapFcitxKey(const fcitx::Key& key, const fcitx::Key& origKey) {
   bool shiftPressed = key.states() & fcitx::KeyState::Shift;
   bool ctrlPressed = key.states() & fcitx::KeyState::Ctrl;
@@ -461,6 +470,23 @@ static std::string GetOpenFileWith(const McBopomofoConfig& config) {
              : kDefaultOpenFileWith;
 }
 
+// Returns the hook that runs the add-phrase script. The hook is called after
+// the phrase is written to the user phrase files, on the thread that writes
+// them, so it keeps copies of the settings instead of reading the config.
+static std::function<void(const std::string&)> MakeAddPhraseHook(
+    const McBopomofoConfig& config, const std::string& userDataPath) {
+  if (!config.addScriptHookEnabled.value()) {
+    return nullptr;
+  }
+  std::string scriptPath = config.addScriptHookPath.value();
+  if (scriptPath.empty()) {
+    scriptPath = kDefaultAddPhraseHookPath;
+  }
+  return [scriptPath, userDataPath](const std::string& newPhrase) {
+    fcitx::startProcess({"/bin/sh", scriptPath, newPhrase}, userDataPath);
+  };
+}
+
 McBopomofoEngine::McBopomofoEngine(fcitx::Instance* instance)
     : instance_(instance) {
   languageModelLoader_ = std::make_shared<LanguageModelLoader>(
@@ -470,20 +496,6 @@ McBopomofoEngine::McBopomofoEngine(fcitx::Instance* instance)
       languageModelLoader_->getLM(),
       languageModelLoader_->getVariantAnnotator(), languageModelLoader_,
       std::make_unique<KeyHandlerLocalizedString>());
-  keyHandler_->setOnAddNewPhrase([this](std::string newPhrase) {
-    auto addScriptHookEnabled = config_.addScriptHookEnabled.value();
-    if (!addScriptHookEnabled) {
-      return;
-    }
-    auto scriptPath = config_.addScriptHookPath.value();
-    if (scriptPath.empty()) {
-      scriptPath = kDefaultAddPhraseHookPath;
-    }
-
-    auto userDataPath = languageModelLoader_->userDataPath();
-    fcitx::startProcess({"/bin/sh", scriptPath, std::move(newPhrase)},
-                        userDataPath);
-  });
 
   state_ = std::make_unique<InputStates::Empty>();
 
@@ -596,6 +608,13 @@ McBopomofoEngine::McBopomofoEngine(fcitx::Instance* instance)
   instance_->userInterfaceManager().registerAction(
       "mcbopomofo-user-excluded-phrases-edit", excludedPhrasesAction_.get());
 
+  dumpTelemetryAction_ = std::make_unique<fcitx::SimpleAction>();
+  dumpTelemetryAction_->setShortText(_("Dump Input Telemetry"));
+  dumpTelemetryAction_->connect<fcitx::SimpleAction::Activated>(
+      [this](fcitx::InputContext*) { dumpTelemetry(); });
+  instance_->userInterfaceManager().registerAction(
+      "mcbopomofo-dump-telemetry", dumpTelemetryAction_.get());
+
   // Required by convention of fcitx5 modules to load config on its own.
   // NOLINTNEXTLINE(clang-analyzer-optin.cplusplus.VirtualCall)
   reloadConfig();
@@ -612,6 +631,14 @@ void McBopomofoEngine::setConfig(const fcitx::RawConfig& config) {
 
 void McBopomofoEngine::reloadConfig() {
   fcitx::readAsIni(config_, kConfigPath);
+  applyWalkConfig();
+}
+
+void McBopomofoEngine::applyWalkConfig() {
+  keyHandler_->setWalkDeadlineMicroseconds(
+      static_cast<int64_t>(config_.walkDeadlineMilliseconds.value()) * 1000);
+  keyHandler_->setAutoCommitLength(
+      static_cast<size_t>(config_.autoCommitLength.value()));
 }
 
 void McBopomofoEngine::activate(const fcitx::InputMethodEntry& entry,
@@ -672,6 +699,11 @@ void McBopomofoEngine::activate(const fcitx::InputMethodEntry& entry,
                                          excludedPhrasesAction_.get());
   }
 
+  if (config_.showDebugItemsInMenu.value()) {
+    inputContext->statusArea().addAction(fcitx::StatusGroup::InputMethod,
+                                         dumpTelemetryAction_.get());
+  }
+
   keyHandler_->setInputMode(mode);
 
   // NOLINTNEXTLINE(clang-analyzer-deadcode.DeadStores)
@@ -717,6 +749,9 @@ void McBopomofoEngine::activate(const fcitx::InputMethodEntry& entry,
       config_.repeatedPunctuationToSelectCandidateEnabled.value());
   keyHandler_->setChooseCandidateUsingSpace(
       config_.chooseCandidateUsingSpace.value());
+  keyHandler_->setOnAddNewPhrase(
+      MakeAddPhraseHook(config_, languageModelLoader_->userDataPath()));
+  applyWalkConfig();
 
   if (mode == McBopomofo::InputMode::McBopomofo) {
     // Font annotation is only supported in McBopomofo, not Plain McBopomofo.
@@ -889,12 +924,42 @@ void McBopomofoEngine::keyEvent(const fcitx::InputMethodEntry& /*unused*/,
         // TODO(unassigned): beep?
       });
 
+  if (keyHandler_->hasPendingWalk()) {
+    scheduleCompletingPendingWalk(context);
+  }
+
   if (accepted) {
     keyEvent.filterAndAccept();
     return;
   }
 }
 
+void McBopomofoEngine::scheduleCompletingPendingWalk(
+    fcitx::InputContext* context) {
+  // The context may be gone by the time the timer fires. The walk is only
+  // completed while the engine is still inputting, so that the new state does
+  // not replace a candidate list, and the UI is updated by hand since this is
+  // not in a key event.
+  auto contextRef = context->watch();
+  completePendingWalkEvent_ = instance_->eventLoop().addTimeEvent(
+      CLOCK_MONOTONIC,
+      fcitx::now(CLOCK_MONOTONIC) + kCompletePendingWalkDelayInUs, 0,
+      [this, contextRef](fcitx::EventSourceTime* /*unused*/,
+                         uint64_t /*unused*/) {
+        fcitx::InputContext* context = contextRef.get();
+        if (context != nullptr &&
+            dynamic_cast<InputStates::Inputting*>(state_.get()) != nullptr) {
+          keyHandler_->completePendingWalk(
+              [this, context](std::unique_ptr<InputState> next) {
+                enterNewState(context, std::move(next));
+              });
+          context->updateUserInterface(
+              fcitx::UserInterfaceComponent::InputPanel);
+        }
+        return true;
+      });
+}
+
 bool McBopomofoEngine::handleCandidateKeyEvent(
     fcitx::InputContext* context, fcitx::Key key, fcitx::Key origKey,
     fcitx::CommonCandidateList* candidateList,
@@ -1977,6 +2042,32 @@ void McBopomofoEngine::showAndClearUserFileIssues() {
   userFileIssues_.clear();
 }
 
+void McBopomofoEngine::dumpTelemetry() {
+  std::string userDataPath = languageModelLoader_->userDataPath();
+  if (userDataPath.empty()) {
+    FCITX_MCBOPOMOFO_WARN() << "No user data directory to dump telemetry to";
+    return;
+  }
+
+  std::string path = userDataPath + "/" + kTelemetryFilename;
+  std::ofstream ofs(path);
+  ofs << keyHandler_->telemetry().toJson() << "\n";
+  ofs.close();
+  if (!ofs) {
+    FCITX_MCBOPOMOFO_ERROR() << "Failed to dump telemetry to: " << path;
+    return;
+  }
+  FCITX_MCBOPOMOFO_INFO() << "Dumped telemetry to: " << path;
+
+  if (notifications()) {
+    notifications()->call<fcitx::INotifications::showTip>(
+        "mcbopomofo-dump-telemetry", _("McBopomofo"), "fcitx_mcbopomofo",
+        _("Dump Input Telemetry"),
+        fmt::format(FmtRuntime(_("Input telemetry saved to {0}")), path),
+        kFcitx5NotificationTimeoutInMs);
+  }
+}
+
 FCITX_ADDON_FACTORY(McBopomofoEngineFactory);
 
 }  // namespace McBopomofo
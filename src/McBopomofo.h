@@ -27,6 +27,7 @@
 #include <fcitx-config/configuration.h>
 #include <fcitx-config/enum.h>
 #include <fcitx-config/iniparser.h>
+#include <fcitx-utils/eventloop.h>
 #include <fcitx-utils/i18n.h>
 #include <fcitx-utils/standardpath.h>
 #include <fcitx/action.h>
@@ -198,6 +199,25 @@ FCITX_CONFIGURATION(
         this, "AddScriptHookEnabled",
         _("Run the hook script after adding a phrase"), false};
 
+    // Whether to show the debug items, such as dumping the input telemetry, in
+    // the menu.
+    fcitx::Option<bool> showDebugItemsInMenu{
+        this, "ShowDebugItemsInMenu", _("Show debug items in menu"), false};
+
+    // The deadline of the walks made while typing, in milliseconds. A walk
+    // that runs out of time is completed once typing pauses. 0 disables it.
+    fcitx::Option<int, fcitx::IntConstrain> walkDeadlineMilliseconds{
+        this, "WalkDeadlineMilliseconds",
+        _("Deadline of the walks while typing (ms)"), 0,
+        fcitx::IntConstrain(0, 1000)};
+
+    // The length of the composing buffer, in readings, beyond which its
+    // stable beginning is committed while typing. 0 disables it.
+    fcitx::Option<int, fcitx::IntConstrain> autoCommitLength{
+        this, "AutoCommitLength",
+        _("Auto-commit composing buffers longer than (readings)"), 0,
+        fcitx::IntConstrain(0, 10000)};
+
     // If half-width punctuation is enabled or not.
     fcitx::HiddenOption<bool> halfWidthPunctuationEnable{
         this, "HalfWidthPunctuationEnable", _("Enable Half Width Punctuation"),
@@ -292,6 +312,17 @@ class McBopomofoEngine : public fcitx::InputMethodEngine {
 
   void showAndClearUserFileIssues();
 
+  // Applies the settings of the walks made while typing, and of the
+  // auto-commit that is based on them, to the KeyHandler.
+  void applyWalkConfig();
+
+  // Completes the pending walk of the KeyHandler once typing pauses. Each
+  // call pushes the walk back.
+  void scheduleCompletingPendingWalk(fcitx::InputContext* context);
+
+  // Writes the KeyHandler's telemetry as JSON to the user data directory.
+  void dumpTelemetry();
+
   fcitx::CandidateLayoutHint getCandidateLayoutHint() const;
 
   std::shared_ptr<LanguageModelLoader> languageModelLoader_;
@@ -307,6 +338,9 @@ class McBopomofoEngine : public fcitx::InputMethodEngine {
   std::unique_ptr<fcitx::SimpleAction> bopomofoFontAnnotationSupportAction_;
   std::unique_ptr<fcitx::SimpleAction> editUserPhrasesAction_;
   std::unique_ptr<fcitx::SimpleAction> excludedPhrasesAction_;
+  std::unique_ptr<fcitx::SimpleAction> dumpTelemetryAction_;
+
+  std::unique_ptr<fcitx::EventSourceTime> completePendingWalkEvent_;
 };
 
 class McBopomofoEngineFactory : public fcitx::AddonFactory {
@@ -0,0 +1,134 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "Telemetry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+namespace McBopomofo {
+
+void Histogram::record(uint64_t value) {
+  ++counts_[BucketIndex(value)];
+  ++count_;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+  sum_ += static_cast<long double>(value);
+}
+
+void Histogram::reset() { *this = Histogram(); }
+
+double Histogram::mean() const {
+  return count_ ? static_cast<double>(sum_ / static_cast<long double>(count_))
+                : 0;
+}
+
+uint64_t Histogram::percentile(double percentage) const {
+  if (!count_) {
+    return 0;
+  }
+  auto target = static_cast<uint64_t>(
+      std::ceil(percentage / 100.0 * static_cast<double>(count_)));
+  target = std::clamp<uint64_t>(target, 1, count_);
+
+  uint64_t accumulated = 0;
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    accumulated += counts_[i];
+    if (accumulated >= target) {
+      return std::min(BucketUpperBound(i), max_);
+    }
+  }
+  return max_;
+}
+
+std::string Histogram::toJson() const {
+  std::stringstream sst;
+  sst << "{\"count\":" << count() << ",\"min\":" << min()
+      << ",\"max\":" << max() << ",\"mean\":" << std::fixed
+      << std::setprecision(3) << mean() << ",\"p50\":" << percentile(50)
+      << ",\"p90\":" << percentile(90) << ",\"p99\":" << percentile(99)
+      << ",\"p999\":" << percentile(99.9) << ",\"buckets\":[";
+  bool first = true;
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    if (!counts_[i]) {
+      continue;
+    }
+    if (!first) {
+      sst << ",";
+    }
+    first = false;
+    sst << "[" << BucketUpperBound(i) << "," << counts_[i] << "]";
+  }
+  sst << "]}";
+  return sst.str();
+}
+
+size_t Histogram::BucketIndex(uint64_t value) {
+  if (value < kSubBucketCount) {
+    return static_cast<size_t>(value);
+  }
+  // The magnitude is the position of the highest set bit, and the sub-bucket
+  // is given by the kSubBucketBits bits that follow it.
+  size_t magnitude = 63 - static_cast<size_t>(__builtin_clzll(value));
+  size_t shift = magnitude - kSubBucketBits;
+  size_t subBucket = static_cast<size_t>(value >> shift) - kSubBucketCount;
+  return kSubBucketCount + shift * kSubBucketCount + subBucket;
+}
+
+uint64_t Histogram::BucketUpperBound(size_t index) {
+  if (index < kSubBucketCount) {
+    return index;
+  }
+  size_t shift = (index - kSubBucketCount) / kSubBucketCount;
+  uint64_t subBucket = (index - kSubBucketCount) % kSubBucketCount;
+  uint64_t lower = (kSubBucketCount + subBucket) << shift;
+  return lower + ((uint64_t{1} << shift) - 1);
+}
+
+ScopedHistogramTimer::~ScopedHistogramTimer() {
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start_);
+  histogram_->record(static_cast<uint64_t>(elapsed.count()));
+}
+
+void Telemetry::reset() { *this = Telemetry(); }
+
+std::string Telemetry::toJson() const {
+  std::stringstream sst;
+  sst << "{\"walkMicroseconds\":" << walkMicroseconds.toJson()
+      << ",\"walkVertices\":" << walkVertices.toJson()
+      << ",\"walkEdges\":" << walkEdges.toJson()
+      << ",\"gridLength\":" << gridLength.toJson()
+      << ",\"keyMicroseconds\":" << keyMicroseconds.toJson()
+      << ",\"lmLookupsPerKey\":" << lmLookupsPerKey.toJson()
+      << ",\"composedStringMicroseconds\":"
+      << composedStringMicroseconds.toJson()
+      << ",\"candidateBuildMicroseconds\":"
+      << candidateBuildMicroseconds.toJson()
+      << ",\"candidateCount\":" << candidateCount.toJson() << "}";
+  return sst.str();
+}
+
+}  // namespace McBopomofo
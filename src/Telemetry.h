@@ -0,0 +1,148 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_TELEMETRY_H_
+#define SRC_TELEMETRY_H_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Engine/gramambular2/language_model.h"
+
+namespace McBopomofo {
+
+// An HDR-style histogram of non-negative integers, such as microseconds or
+// counts. Values are bucketed first by magnitude (the highest set bit) and
+// then linearly within the magnitude, so the relative error of a recorded
+// value is bounded by 1/kSubBucketCount whatever its size, while the
+// histogram itself has a small and fixed footprint.
+class Histogram {
+ public:
+  static constexpr size_t kSubBucketBits = 4;
+  static constexpr size_t kSubBucketCount = 1 << kSubBucketBits;
+  static constexpr size_t kBucketCount =
+      kSubBucketCount + (64 - kSubBucketBits) * kSubBucketCount;
+
+  void record(uint64_t value);
+  void reset();
+
+  uint64_t count() const { return count_; }
+  uint64_t min() const { return count_ ? min_ : 0; }
+  uint64_t max() const { return max_; }
+  double mean() const;
+
+  // Returns the value below which the given percentage (0-100) of the
+  // recorded values fall, up to the precision of the buckets.
+  uint64_t percentile(double percentage) const;
+
+  // Returns the histogram as a JSON object, with the summary statistics and
+  // the non-empty buckets as [highest value in bucket, count] pairs.
+  std::string toJson() const;
+
+  // Exposed for testing.
+  static size_t BucketIndex(uint64_t value);
+  static uint64_t BucketUpperBound(size_t index);
+
+ private:
+  std::array<uint64_t, kBucketCount> counts_{};
+  uint64_t count_ = 0;
+  uint64_t min_ = std::numeric_limits<uint64_t>::max();
+  uint64_t max_ = 0;
+  // A long double so that the mean stays exact for any practical session.
+  long double sum_ = 0;
+};
+
+// Records the time spent in a scope into a histogram, in microseconds.
+class ScopedHistogramTimer {
+ public:
+  explicit ScopedHistogramTimer(Histogram* histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedHistogramTimer();
+  ScopedHistogramTimer(const ScopedHistogramTimer&) = delete;
+  ScopedHistogramTimer& operator=(const ScopedHistogramTimer&) = delete;
+
+ private:
+  Histogram* histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Aggregated statistics of the KeyHandler, so that latency outliers in the
+// field can be diagnosed.
+struct Telemetry {
+  // The walk, as reported by ReadingGrid::WalkResult.
+  Histogram walkMicroseconds;
+  Histogram walkVertices;
+  Histogram walkEdges;
+  // The number of readings in the grid when walked.
+  Histogram gridLength;
+  // The time it takes to handle a key, and the number of language model
+  // lookups made by the KeyHandler and its grid while doing so.
+  Histogram keyMicroseconds;
+  Histogram lmLookupsPerKey;
+  // The cost of building the composing buffer and the candidate list.
+  Histogram composedStringMicroseconds;
+  Histogram candidateBuildMicroseconds;
+  Histogram candidateCount;
+
+  void reset();
+
+  // Returns all the histograms as a single JSON object.
+  std::string toJson() const;
+};
+
+// A language model that forwards to another one and counts the lookups.
+class LookupCountingLanguageModel
+    : public Formosa::Gramambular2::LanguageModel {
+ public:
+  explicit LookupCountingLanguageModel(
+      std::shared_ptr<Formosa::Gramambular2::LanguageModel> lm)
+      : lm_(std::move(lm)) {}
+
+  std::vector<Unigram> getUnigrams(const std::string& reading) override {
+    ++lookups_;
+    return lm_->getUnigrams(reading);
+  }
+
+  bool hasUnigrams(const std::string& reading) override {
+    ++lookups_;
+    return lm_->hasUnigrams(reading);
+  }
+
+  // The number of lookups made so far.
+  uint64_t lookups() const { return lookups_; }
+
+ private:
+  std::shared_ptr<Formosa::Gramambular2::LanguageModel> lm_;
+  uint64_t lookups_ = 0;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_TELEMETRY_H_
@@ -0,0 +1,100 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Telemetry.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+TEST(TelemetryTest, EmptyHistogram) {
+  Histogram h;
+  ASSERT_EQ(h.count(), 0);
+  ASSERT_EQ(h.min(), 0);
+  ASSERT_EQ(h.max(), 0);
+  ASSERT_EQ(h.mean(), 0);
+  ASSERT_EQ(h.percentile(50), 0);
+  ASSERT_EQ(h.toJson(),
+            "{\"count\":0,\"min\":0,\"max\":0,\"mean\":0.000,\"p50\":0,"
+            "\"p90\":0,\"p99\":0,\"p999\":0,\"buckets\":[]}");
+}
+
+TEST(TelemetryTest, BucketBoundaries) {
+  for (uint64_t v = 0; v < Histogram::kSubBucketCount; ++v) {
+    ASSERT_EQ(Histogram::BucketIndex(v), v);
+    ASSERT_EQ(Histogram::BucketUpperBound(v), v);
+  }
+
+  // Every value must fall within its bucket, and the buckets must be
+  // contiguous.
+  std::vector<uint64_t> values{16,   17,        32,        33,
+                               1000, 123456789, UINT64_MAX - 1, UINT64_MAX};
+  for (uint64_t v : values) {
+    size_t index = Histogram::BucketIndex(v);
+    ASSERT_LT(index, Histogram::kBucketCount);
+    ASSERT_LE(v, Histogram::BucketUpperBound(index));
+    ASSERT_GT(v, Histogram::BucketUpperBound(index - 1));
+  }
+  ASSERT_EQ(Histogram::BucketIndex(UINT64_MAX), Histogram::kBucketCount - 1);
+  ASSERT_EQ(Histogram::BucketUpperBound(Histogram::kBucketCount - 1),
+            UINT64_MAX);
+}
+
+TEST(TelemetryTest, Percentiles) {
+  Histogram h;
+  for (uint64_t v = 1; v <= 1000; ++v) {
+    h.record(v);
+  }
+  ASSERT_EQ(h.count(), 1000);
+  ASSERT_EQ(h.min(), 1);
+  ASSERT_EQ(h.max(), 1000);
+  ASSERT_DOUBLE_EQ(h.mean(), 500.5);
+
+  // The relative error is bounded by the number of sub-buckets.
+  for (double p : {50.0, 90.0, 99.0}) {
+    auto expected = static_cast<double>(p * 10);
+    auto actual = static_cast<double>(h.percentile(p));
+    ASSERT_GE(actual, expected);
+    ASSERT_LE(actual, expected * (1 + 1.0 / Histogram::kSubBucketCount));
+  }
+  ASSERT_EQ(h.percentile(100), 1000);
+
+  h.reset();
+  ASSERT_EQ(h.count(), 0);
+}
+
+TEST(TelemetryTest, TelemetryJson) {
+  Telemetry t;
+  t.walkMicroseconds.record(42);
+  std::string json = t.toJson();
+  ASSERT_EQ(json.front(), '{');
+  ASSERT_EQ(json.back(), '}');
+  ASSERT_NE(json.find("\"walkMicroseconds\":{\"count\":1,\"min\":42,"),
+            std::string::npos);
+  ASSERT_NE(json.find("\"candidateCount\":{\"count\":0,"), std::string::npos);
+}
+
+}  // namespace McBopomofo
@@ -29,6 +29,10 @@ namespace McBopomofo {
 
 std::filesystem::path TimestampedPath::path() const { return path_; }
 
+std::filesystem::file_time_type TimestampedPath::timestamp() const {
+  return timestamp_;
+}
+
 bool TimestampedPath::pathExists() {
   [[maybe_unused]] std::error_code err;
   return !path_.empty() && std::filesystem::exists(path_, err);
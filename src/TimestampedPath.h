@@ -52,6 +52,9 @@ class TimestampedPath {
   bool timestampDifferentFromLastCheck();
   void checkTimestamp();
 
+  // The timestamp as of the last checkTimestamp() call.
+  [[nodiscard]] std::filesystem::file_time_type timestamp() const;
+
  protected:
   std::filesystem::path path_;
   std::filesystem::file_time_type timestamp_ = {};
@@ -104,6 +104,7 @@ TEST(TimestampedPathTest, BasicFunctionalities) {
   ASSERT_TRUE(p.timestampDifferentFromLastCheck());
   p.checkTimestamp();
   ASSERT_FALSE(p.timestampDifferentFromLastCheck());
+  ASSERT_EQ(p.timestamp(), t3);
 
   TimestampedPath p2 = p;
   ASSERT_TRUE(p2.pathExists());
@@ -122,6 +123,7 @@ TEST(TimestampedPathTest, BasicFunctionalities) {
 
   p.checkTimestamp();
   ASSERT_FALSE(p.timestampDifferentFromLastCheck());
+  ASSERT_EQ(p.timestamp(), std::filesystem::file_time_type{});
 
   p2.checkTimestamp();
   ASSERT_FALSE(p2.timestampDifferentFromLastCheck());